@@ -19,6 +19,9 @@
 # include "ctype.h"
 # include "svm_common.h"
 # include "kernel.h"           /* this contains a user supplied kernel */
+#if defined(__AVX512F__) || defined(__AVX2__)
+# include <immintrin.h>
+#endif
 
 #define MAX(x,y)      ((x) < (y) ? (y) : (x))
 #define MIN(x,y)      ((x) > (y) ? (y) : (x))
@@ -240,13 +243,217 @@ void free_svector_shallow(SVECTOR *vec)
   }
 }
 
-double sprod_ss(SVECTOR *a, SVECTOR *b) 
-     /* compute the inner product of two sparse vectors */
+/* Sparse-sparse products and sums. Both vectors are sorted by wnum,
+   so their common features are found by intersecting the two index
+   sequences: blocks of indices are compared all-against-all with
+   AVX-512 or AVX2 if available, and the shorter vector is galloped
+   through the longer one if their lengths differ by more than
+   GALLOP_RATIO. If one vector fills most of the index range they
+   share, nearly every step of the plain merge is a match, its
+   branches are predictable and it is kept. Without AVX2 or AVX-512
+   sprod_ss keeps the plain merge unless its first steps show one
+   vector far sparser than the other. Products of matching
+   weights are summed in index order on every path, so the result
+   does not depend on the path. */
+
+# define GALLOP_RATIO  64
+# define PROBE_STEPS   32
+# define GALLOP_PROBE  (8*GALLOP_RATIO)
+
+long words_length(WORD *words)
+     /* number of WORDs before the terminating wnum=0 */
+{
+  register WORD *w=words;
+  for(;;w+=4) {          /* unrolled, this is on every sparse-sparse call */
+    if(!w[0].wnum) return((long)(w-words));
+    if(!w[1].wnum) return((long)(w-words)+1);
+    if(!w[2].wnum) return((long)(w-words)+2);
+    if(!w[3].wnum) return((long)(w-words)+3);
+  }
+}
+
+static long gallop_words(WORD *w, long lo, long n, FNUM key)
+     /* first position p>=lo with w[p].wnum>=key, or n if none */
+{
+  long hi,mid,step;
+
+  if((lo>=n) || (w[lo].wnum>=key)) 
+    return(lo);
+  step=1;
+  hi=lo+1;
+  while((hi<n) && (w[hi].wnum<key)) {
+    lo=hi;
+    step<<=1;
+    hi=lo+step;
+  }
+  if(hi>n) hi=n;
+  while(hi-lo>1) {       /* w[lo].wnum<key<=w[hi].wnum */
+    mid=lo+(hi-lo)/2;
+    if(w[mid].wnum<key) lo=mid;
+    else hi=mid;
+  }
+  return(hi);
+}
+
+#if defined(__AVX512F__)
+# define SIMD_BLOCK 16
+
+static inline unsigned block_matches(WORD *a, WORD *b, int *pos)
+     /* bit k is set if a[k].wnum occurs among b[0..15].wnum; if pos is
+	not NULL, pos[k] is then its position in b */
+{
+  const __m512i even=_mm512_set_epi32(30,28,26,24,22,20,18,16,14,12,10,8,6,4,2,0);
+  const __m512i one=_mm512_set1_epi32(1);
+  __m512i va,vb,rot,vpos;
+  __mmask16 m,eq;
+  int r;
+
+  va=_mm512_permutex2var_epi32(_mm512_loadu_si512(a),even,_mm512_loadu_si512(a+8));
+  vb=_mm512_permutex2var_epi32(_mm512_loadu_si512(b),even,_mm512_loadu_si512(b+8));
+  rot=_mm512_set_epi32(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0);
+  m=_mm512_cmpeq_epi32_mask(va,vb);
+  vpos=rot;
+  for(r=1;r<16;r++) {    /* only the low 4 bits of rot select */
+    rot=_mm512_add_epi32(rot,one);
+    eq=_mm512_cmpeq_epi32_mask(va,_mm512_permutexvar_epi32(rot,vb));
+    m|=eq;
+    if(pos) vpos=_mm512_mask_mov_epi32(vpos,eq,rot);
+  }
+  if(pos && m)
+    _mm512_storeu_si512(pos,_mm512_and_si512(vpos,_mm512_set1_epi32(15)));
+  return((unsigned)m);
+}
+
+#elif defined(__AVX2__)
+# define SIMD_BLOCK 8
+
+static inline __m256i block_indices(WORD *w)
+{
+  const __m256i lo=_mm256_setr_epi32(0,2,4,6,0,2,4,6);
+  __m256i x0=_mm256_loadu_si256((const __m256i *)w);
+  __m256i x1=_mm256_loadu_si256((const __m256i *)(w+4));
+  return(_mm256_blend_epi32(_mm256_permutevar8x32_epi32(x0,lo),
+			    _mm256_permutevar8x32_epi32(x1,lo),0xF0));
+}
+
+static inline unsigned block_matches(WORD *a, WORD *b, int *pos)
+     /* bit k is set if a[k].wnum occurs among b[0..7].wnum; if pos is
+	not NULL, pos[k] is then its position in b */
+{
+  const __m256i one=_mm256_set1_epi32(1);
+  __m256i va,vb,rot,eq,any,vpos;
+  unsigned m;
+  int r;
+
+  va=block_indices(a);
+  vb=block_indices(b);
+  rot=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  any=_mm256_cmpeq_epi32(va,vb);
+  vpos=rot;
+  for(r=1;r<8;r++) {     /* only the low 3 bits of rot select */
+    rot=_mm256_add_epi32(rot,one);
+    eq=_mm256_cmpeq_epi32(va,_mm256_permutevar8x32_epi32(vb,rot));
+    any=_mm256_or_si256(any,eq);
+    if(pos) vpos=_mm256_blendv_epi8(vpos,rot,eq);
+  }
+  m=(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(any));
+  if(pos && m)
+    _mm256_storeu_si256((__m256i *)pos,_mm256_and_si256(vpos,_mm256_set1_epi32(7)));
+  return(m);
+}
+#endif
+
+static long common_words(WORD *a, long na, WORD *b, long nb, double *sum)
+     /* number of features a and b have in common; if sum is not NULL,
+	the products of their weights are added to it */
+{
+  register WORD *ai,*bj;
+  register double s=(sum ? (*sum) : 0);
+  long i,j,n=0;
+
+  if(na*GALLOP_RATIO<nb) {
+    for(i=0,j=0;(i<na) && (j<nb);i++) {
+      j=gallop_words(b,j,nb,a[i].wnum);
+      if((j<nb) && (b[j].wnum==a[i].wnum)) {
+	n++;
+	if(sum) s+=(a[i].weight) * (b[j].weight);
+	j++;
+      }
+    }
+    if(sum) (*sum)=s;
+    return(n);
+  }
+  if(nb*GALLOP_RATIO<na)
+    return(common_words(b,nb,a,na,sum));
+
+  i=0; j=0;
+#ifdef SIMD_BLOCK
+  if((MIN(na,nb)>=4*SIMD_BLOCK) 
+     && (4*MAX(na,nb) < 3*((long)MAX(a[na-1].wnum,b[nb-1].wnum)
+			   -MIN(a[0].wnum,b[0].wnum)+1))) {
+    unsigned m;
+    int k,pos[SIMD_BLOCK];
+    FNUM amax,bmax;
+
+    while((i+SIMD_BLOCK<=na) && (j+SIMD_BLOCK<=nb)) {
+      if(!sum) {
+	n+=__builtin_popcount(block_matches(a+i,b+j,NULL));
+      }
+      else {
+	m=block_matches(a+i,b+j,pos);
+	for(;m;m&=m-1) {   /* matches in increasing index order */
+	  k=__builtin_ctz(m);
+	  s+=(a[i+k].weight) * (b[j+pos[k]].weight);
+	  n++;
+	}
+      }
+      amax=a[i+SIMD_BLOCK-1].wnum;
+      bmax=b[j+SIMD_BLOCK-1].wnum;
+      if(amax<=bmax) i+=SIMD_BLOCK;
+      if(bmax<=amax) j+=SIMD_BLOCK;
+    }
+  }
+#endif
+  ai=a+i;
+  bj=b+j;
+  if(!sum) {
+    while (ai->wnum && bj->wnum) {
+      if(ai->wnum > bj->wnum) {
+	bj++;
+      }
+      else if (ai->wnum < bj->wnum) {
+	ai++;
+      }
+      else {
+	n++;
+	ai++;
+	bj++;
+      }
+    }
+    return(n);
+  }
+  while (ai->wnum && bj->wnum) {
+    if(ai->wnum > bj->wnum) {
+      bj++;
+    }
+    else if (ai->wnum < bj->wnum) {
+      ai++;
+    }
+    else {
+      s+=(ai->weight) * (bj->weight);
+      n++;
+      ai++;
+      bj++;
+    }
+  }
+  (*sum)=s;
+  return(n);
+}
+
+static double __attribute__((noinline)) merge_words(WORD *ai, WORD *bj, double sum)
+     /* the plain merge of sprod_ss from ai and bj on; kept out of line
+	so that its loop is compiled as it was before the probes */
 {
-    register double sum=0;
-    register WORD *ai,*bj;
-    ai=a->words;
-    bj=b->words;
     while (ai->wnum && bj->wnum) {
       if(ai->wnum > bj->wnum) {
 	bj++;
@@ -260,51 +467,129 @@ double sprod_ss(SVECTOR *a, SVECTOR *b)
 	bj++;
       }
     }
-    return((double)sum);
+    return(sum);
 }
 
-SVECTOR* multadd_ss(SVECTOR *a, SVECTOR *b, double factor) 
-     /* compute a+factor*b of two sparse vectors */
-     /* Note: SVECTOR lists are not followed, but only the first
-	SVECTOR is used */
+static double merge_or_gallop(WORD *a, WORD *ai, WORD *b, WORD *bj, double sum)
+     /* sprod_ss of the vectors starting at a and b from ai and bj on:
+	the plain merge, unless its first GALLOP_PROBE steps show one
+	vector advancing more than 2*GALLOP_RATIO times as fast as the
+	other. Only then are the vector lengths scanned, and the rest is
+	galloped if they differ by more than GALLOP_RATIO. */
 {
-    SVECTOR *vec;
-    register WORD *sum,*sumi;
+    long steps=0;
+
+    while (ai->wnum && bj->wnum && (steps<GALLOP_PROBE)) {
+      if(ai->wnum > bj->wnum) {
+	bj++;
+      }
+      else if (ai->wnum < bj->wnum) {
+	ai++;
+      }
+      else {
+	sum+=(ai->weight) * (bj->weight);
+	ai++;
+	bj++;
+      }
+      steps++;
+    }
+    if(ai->wnum && bj->wnum
+       && ((2*GALLOP_RATIO*(ai-a) < (bj-b))
+	   || (2*GALLOP_RATIO*(bj-b) < (ai-a)))) {
+      common_words(ai,words_length(ai),bj,words_length(bj),&sum);
+      return(sum);
+    }
+    return(merge_words(ai,bj,sum));
+}
+
+#ifdef SIMD_BLOCK
+double sprod_ss(SVECTOR *a, SVECTOR *b) 
+     /* compute the inner product of two sparse vectors */
+{
+    double sum=0;
     register WORD *ai,*bj;
-    long veclength;
-  
+    long steps=0,matches=0;
+
+    /* a few steps of the plain merge first: they finish short vectors,
+       and if nearly every step is a match the merge is also the
+       fastest way through the rest. If one vector all but stood
+       still, the blocks would not pay either. */
     ai=a->words;
     bj=b->words;
-    veclength=0;
-    while (ai->wnum && bj->wnum) {
+    while (ai->wnum && bj->wnum && (steps<PROBE_STEPS)) {
       if(ai->wnum > bj->wnum) {
-	veclength++;
 	bj++;
       }
       else if (ai->wnum < bj->wnum) {
-	veclength++;
 	ai++;
       }
       else {
-	veclength++;
+	sum+=(ai->weight) * (bj->weight);
+	matches++;
 	ai++;
 	bj++;
       }
+      steps++;
     }
-    while (bj->wnum) {
-      veclength++;
-      bj++;
-    }
-    while (ai->wnum) {
-      veclength++;
-      ai++;
-    }
-    veclength++;
+    if(!ai->wnum || !bj->wnum)
+      return(sum);
+    if(4*matches >= 3*steps)
+      return(merge_words(ai,bj,sum));
+    if(((ai-a->words) <= 1) || ((bj-b->words) <= 1))
+      return(merge_or_gallop(a->words,ai,b->words,bj,sum));
+    common_words(ai,words_length(ai),bj,words_length(bj),&sum);
+    return(sum);
+}
+#else
+double sprod_ss(SVECTOR *a, SVECTOR *b) 
+     /* compute the inner product of two sparse vectors */
+{
+    /* without block compares only galloping can beat the plain merge */
+    return(merge_or_gallop(a->words,a->words,b->words,b->words,0));
+}
+#endif
+
+SVECTOR* multadd_ss(SVECTOR *a, SVECTOR *b, double factor) 
+     /* compute a+factor*b of two sparse vectors */
+     /* Note: SVECTOR lists are not followed, but only the first
+	SVECTOR is used */
+{
+    SVECTOR *vec;
+    register WORD *sum,*sumi;
+    register WORD *ai,*bj;
+    long na,nb,i,p,veclength;
+    char *userdefined;
+  
+    na=words_length(a->words);
+    nb=words_length(b->words);
+    veclength=na+nb-common_words(a->words,na,b->words,nb,NULL)+1;
 
     sum=(WORD *)my_malloc(sizeof(WORD)*veclength);
     sumi=sum;
     ai=a->words;
     bj=b->words;
+    if(nb*GALLOP_RATIO<na) {
+      /* few features to add: copy the runs of a in between */
+      for(i=0;bj->wnum;bj++) {
+	p=gallop_words(ai,i,na,bj->wnum);
+	memcpy(sumi,ai+i,sizeof(WORD)*(p-i));
+	sumi+=p-i;
+	i=p;
+	if((i<na) && (ai[i].wnum==bj->wnum)) {
+	  (*sumi)=ai[i];
+	  sumi->weight+=factor*bj->weight;
+	  if(sumi->weight != 0)
+	    sumi++;
+	  i++;
+	}
+	else {
+	  (*sumi)=(*bj);
+	  sumi->weight*=factor;
+	  sumi++;
+	}
+      }
+      ai+=i;
+    }
     while (ai->wnum && bj->wnum) {
       if(ai->wnum > bj->wnum) {
 	(*sumi)=(*bj);
@@ -338,9 +623,12 @@ SVECTOR* multadd_ss(SVECTOR *a, SVECTOR *b, double factor)
       ai++;
     }
     sumi->wnum=0;
+    sumi->weight=0;
 
-    vec=create_svector(sum,"",1.0);
-    free(sum);
+    /* sum is handed over instead of copied */
+    userdefined=(char *)my_malloc(sizeof(char));
+    userdefined[0]=0;
+    vec=create_svector_shallow(sum,userdefined,1.0);
 
     return(vec);
 }
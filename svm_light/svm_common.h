@@ -292,7 +292,9 @@ SVECTOR *copy_svector(SVECTOR *);
 SVECTOR *copy_svector_shallow(SVECTOR *);
 void   free_svector(SVECTOR *);
 void   free_svector_shallow(SVECTOR *);
+long      words_length(WORD *);
 double    sprod_ss(SVECTOR *, SVECTOR *);
+SVECTOR*  multadd_ss(SVECTOR *, SVECTOR *, double);
 SVECTOR*  sub_ss(SVECTOR *, SVECTOR *); 
 SVECTOR*  add_ss(SVECTOR *, SVECTOR *); 
 SVECTOR*  add_list_ns(SVECTOR *a);
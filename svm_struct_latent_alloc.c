@@ -0,0 +1,455 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_alloc.c                                          */
+/*                                                                      */
+/*   Heap accounting for the Latent SVM^struct trainer. malloc, calloc, */
+/*   realloc, posix_memalign and free are replaced by versions that     */
+/*   pass on to the C library and, once tracking is enabled, record     */
+/*   every block with its size, the phase it was allocated in and its   */
+/*   allocation site, the innermost callers on the stack. This covers   */
+/*   my_malloc, the svm_light vector routines and the C library alike   */
+/*   without changing any call. Untracked blocks, e.g. those from       */
+/*   before tracking was enabled, are freed as usual.                   */
+/*                                                                      */
+/*   Sites are named by dladdr(), which only knows the functions of     */
+/*   the executable if it was linked with -rdynamic; otherwise they are */
+/*   printed as offsets for addr2line.                                  */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include "svm_struct_latent_profile.h"
+#include "svm_struct_latent_alloc.h"
+
+/* the allocator can only be replaced where the C library supports it,
+   and not under a sanitizer, which replaces it itself */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define ALLOC_INTERPOSE 1
+#endif
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#undef ALLOC_INTERPOSE
+#endif
+#endif
+
+#define N_SLOTS   (PROF_N_PHASES+2)  /* outside all phases, the phases, and
+                                        other threads */
+#define TOMBSTONE ((void *) 1)
+#define MB        (1024.0*1024.0)
+
+typedef struct alloc_block {
+  void   *ptr;           /* NULL if free, TOMBSTONE if removed */
+  size_t size;
+  int    site;
+  int    slot;
+} ALLOC_BLOCK;
+
+typedef struct alloc_site {
+  void   *frames[ALLOC_SITE_DEPTH];  /* innermost first */
+  long   live;
+  long   peak;
+  long   allocs;
+  long   frees;
+  long   last_live;      /* at the previous report */
+  int    growing;        /* reports in a row with more live bytes */
+} ALLOC_SITE;
+
+typedef struct alloc_slot {
+  long   live;           /* bytes allocated in the phase and not freed */
+  long   peak;           /* most live bytes in total while in the phase */
+  long   allocs;
+} ALLOC_SLOT;
+
+static int             enabled = 0;
+static __thread int    busy = 0;     /* inside the tracker on this thread */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ALLOC_BLOCK *blocks = NULL;   /* open addressing by address */
+static long        blocks_cap = 0;
+static long        blocks_used = 0;  /* including tombstones */
+static long        n_blocks = 0;
+
+/* site 0 collects whatever does not fit in the table */
+static ALLOC_SITE  sites[ALLOC_MAX_SITES];
+static int         n_sites = 1;
+static int         site_index[2*ALLOC_MAX_SITES];  /* by hash, -1 if free */
+
+static ALLOC_SLOT  slots[N_SLOTS];
+static long        live_bytes = 0;
+static long        peak_bytes = 0;
+
+#ifdef ALLOC_INTERPOSE
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void *ptr);
+
+static uint64_t hash_pointer(const void *p)
+{
+  uint64_t h = (uint64_t) (uintptr_t) p;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return(h);
+}
+
+static int find_site(void **frames)
+     /* with the lock held */
+{
+  uint64_t h = 0;
+  long k, mask = 2*ALLOC_MAX_SITES-1;
+  int d, s;
+
+  for(d = 0; d < ALLOC_SITE_DEPTH; d++)
+    h = hash_pointer((char *) frames[d]+h);
+  for(k = h & mask;; k = (k+1) & mask) {
+    s = site_index[k];
+    if(s < 0)
+      break;
+    if(memcmp(sites[s].frames, frames, sizeof(sites[s].frames)) == 0)
+      return(s);
+  }
+  if(n_sites == ALLOC_MAX_SITES)
+    return(0);
+  s = n_sites++;
+  memcpy(sites[s].frames, frames, sizeof(sites[s].frames));
+  site_index[k] = s;
+  return(s);
+}
+
+static void grow_blocks(void)
+     /* with the lock held; rehashes, dropping the tombstones */
+{
+  ALLOC_BLOCK *old = blocks;
+  long old_cap = blocks_cap, i, k;
+
+  /* a table mostly full of tombstones is only cleaned */
+  blocks_cap = (old_cap == 0) ? 65536 : (4*n_blocks < old_cap) ? old_cap : 2*old_cap;
+  blocks = (ALLOC_BLOCK *) __libc_calloc(blocks_cap, sizeof(ALLOC_BLOCK));
+  if(blocks == NULL) {
+    fprintf(stderr, "Out of memory for allocation tracking\n");
+    abort();
+  }
+  blocks_used = 0;
+  for(i = 0; i < old_cap; i++) {
+    if((old[i].ptr == NULL) || (old[i].ptr == TOMBSTONE))
+      continue;
+    for(k = hash_pointer(old[i].ptr) & (blocks_cap-1); blocks[k].ptr; k = (k+1) & (blocks_cap-1));
+    blocks[k] = old[i];
+    blocks_used++;
+  }
+  __libc_free(old);
+}
+
+static int __attribute__((noinline)) callers(void **frames)
+     /* the callers of the allocation function, innermost first */
+{
+  void *trace[ALLOC_SITE_DEPTH+2];
+  int n = backtrace(trace, ALLOC_SITE_DEPTH+2), d;
+
+  for(d = 0; d < ALLOC_SITE_DEPTH; d++)
+    frames[d] = (d+2 < n) ? trace[d+2] : NULL;
+  return(n);
+}
+
+static void track(void *ptr, size_t size, void **frames)
+{
+  long k;
+  int site, slot;
+
+  slot = prof_current_phase()+1;
+  pthread_mutex_lock(&lock);
+  if(2*(blocks_used+1) > blocks_cap)
+    grow_blocks();
+  for(k = hash_pointer(ptr) & (blocks_cap-1); blocks[k].ptr && (blocks[k].ptr != TOMBSTONE); k = (k+1) & (blocks_cap-1));
+  if(blocks[k].ptr == NULL)
+    blocks_used++;
+  site = find_site(frames);
+  blocks[k].ptr = ptr;
+  blocks[k].size = size;
+  blocks[k].site = site;
+  blocks[k].slot = slot;
+  n_blocks++;
+
+  live_bytes += size;
+  if(live_bytes > peak_bytes)
+    peak_bytes = live_bytes;
+  sites[site].live += size;
+  sites[site].allocs++;
+  if(sites[site].live > sites[site].peak)
+    sites[site].peak = sites[site].live;
+  slots[slot].live += size;
+  slots[slot].allocs++;
+  if(live_bytes > slots[slot].peak)
+    slots[slot].peak = live_bytes;
+  pthread_mutex_unlock(&lock);
+}
+
+static void untrack(void *ptr)
+{
+  long k;
+  ALLOC_BLOCK *b;
+
+  pthread_mutex_lock(&lock);
+  if(blocks_cap) {
+    for(k = hash_pointer(ptr) & (blocks_cap-1); blocks[k].ptr; k = (k+1) & (blocks_cap-1)) {
+      b = &blocks[k];
+      if(b->ptr != ptr)
+        continue;
+      live_bytes -= b->size;
+      sites[b->site].live -= b->size;
+      sites[b->site].frees++;
+      slots[b->slot].live -= b->size;
+      b->ptr = TOMBSTONE;
+      n_blocks--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void *malloc(size_t size)
+{
+  void *frames[ALLOC_SITE_DEPTH], *p;
+
+  if(!enabled || busy)
+    return(__libc_malloc(size));
+  busy = 1;
+  callers(frames);
+  p = __libc_malloc(size);
+  if(p)
+    track(p, size, frames);
+  busy = 0;
+  return(p);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  void *frames[ALLOC_SITE_DEPTH], *p;
+
+  if(!enabled || busy)
+    return(__libc_calloc(n, size));
+  busy = 1;
+  callers(frames);
+  p = __libc_calloc(n, size);
+  if(p)
+    track(p, n*size, frames);
+  busy = 0;
+  return(p);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  void *frames[ALLOC_SITE_DEPTH], *p;
+
+  if(!enabled || busy)
+    return(__libc_realloc(ptr, size));
+  busy = 1;
+  callers(frames);
+  p = __libc_realloc(ptr, size);
+  /* on failure the old block is still allocated */
+  if(ptr && (p || (size == 0)))
+    untrack(ptr);
+  if(p)
+    track(p, size, frames);
+  busy = 0;
+  return(p);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  void *frames[ALLOC_SITE_DEPTH], *p;
+
+  if((alignment % sizeof(void *)) || (alignment & (alignment-1)) || (alignment == 0))
+    return(EINVAL);
+  if(!enabled || busy) {
+    p = __libc_memalign(alignment, size);
+  }
+  else {
+    busy = 1;
+    callers(frames);
+    p = __libc_memalign(alignment, size);
+    if(p)
+      track(p, size, frames);
+    busy = 0;
+  }
+  if(p == NULL)
+    return(ENOMEM);
+  *memptr = p;
+  return(0);
+}
+
+void free(void *ptr)
+{
+  if(ptr && enabled && !busy) {
+    busy = 1;
+    untrack(ptr);
+    busy = 0;
+  }
+  __libc_free(ptr);
+}
+
+#endif /* ALLOC_INTERPOSE */
+
+int alloc_tracking_enable(void)
+     /* returns 0 if allocations cannot be tracked in this build */
+{
+#ifdef ALLOC_INTERPOSE
+  void *frames[ALLOC_SITE_DEPTH];
+
+  memset(site_index, -1, sizeof(site_index));
+  /* the first backtrace() loads the unwinder, which allocates */
+  busy = 1;
+  callers(frames);
+  busy = 0;
+  enabled = 1;
+  return(1);
+#else
+  return(0);
+#endif
+}
+
+int alloc_tracking_enabled(void)
+{
+  return(enabled);
+}
+
+long alloc_live_bytes(void)
+{
+  return(live_bytes);
+}
+
+long alloc_peak_bytes(void)
+{
+  return(peak_bytes);
+}
+
+static void print_site(ALLOC_SITE *s)
+     /* the callers, innermost first, as function names or offsets into
+        their object files */
+{
+  Dl_info info;
+  const char *file;
+  int d, n = 0;
+
+  if(s == &sites[0]) {
+    printf("(other sites)");
+    return;
+  }
+  for(d = 0; (d < ALLOC_SITE_DEPTH) && s->frames[d]; d++) {
+    printf("%s", n++ ? " < " : "");
+    /* the return address may already belong to the next function */
+    if(!dladdr((char *) s->frames[d]-1, &info))
+      printf("%p", s->frames[d]);
+    else if(info.dli_sname)
+      printf("%s", info.dli_sname);
+    else {
+      file = strrchr(info.dli_fname, '/');
+      printf("%s+%#lx", file ? file+1 : info.dli_fname,
+             (unsigned long) ((char *) s->frames[d]-(char *) info.dli_fbase));
+    }
+  }
+}
+
+static long sort_key;  /* 0: live bytes, 1: peak bytes */
+
+static int site_comp(const void *a, const void *b)
+{
+  const ALLOC_SITE *sa = &sites[*(const int *) a], *sb = &sites[*(const int *) b];
+  long ka = sort_key ? sa->peak : sa->live, kb = sort_key ? sb->peak : sb->live;
+
+  return((ka < kb) - (ka > kb));
+}
+
+static void print_sites(int top, int by_peak)
+     /* the top sites, and the growing ones that are not among them */
+{
+  int order[ALLOC_MAX_SITES], s, k;
+
+  for(s = 0; s < n_sites; s++)
+    order[s] = s;
+  sort_key = by_peak;
+  qsort(order, n_sites, sizeof(int), site_comp);
+  printf("  %10s %10s %10s %10s  site\n", "live MB", "peak MB", "allocs", "frees");
+  for(k = 0; k < n_sites; k++) {
+    s = order[k];
+    if((k >= top) && (sites[s].growing < ALLOC_GROWTH))
+      continue;
+    if((sites[s].allocs == 0) || ((k < top) && (sites[s].live == 0) && !by_peak))
+      continue;
+    printf("  %10.2f %10.2f %10ld %10ld  ", sites[s].live/MB, sites[s].peak/MB, sites[s].allocs, sites[s].frees);
+    print_site(&sites[s]);
+    if(sites[s].growing >= ALLOC_GROWTH)
+      printf("  [growing for %d reports]", sites[s].growing);
+    printf("\n");
+  }
+}
+
+static void print_slots(void)
+{
+  int k;
+
+  printf("  %10s %10s %10s  phase\n", "live MB", "peak MB", "allocs");
+  for(k = 0; k < N_SLOTS; k++) {
+    if(slots[k].allocs == 0)
+      continue;
+    printf("  %10.2f %10.2f %10ld  %s\n", slots[k].live/MB, slots[k].peak/MB, slots[k].allocs,
+           (k == 0) ? "(no phase)" : (k == N_SLOTS-1) ? "(other threads)" : prof_phase_key(k-1));
+  }
+}
+
+void alloc_report(const char *what, long iter, int top)
+     /* live bytes per phase and of the top sites, and the sites whose
+        live bytes grew since each of the last ALLOC_GROWTH reports */
+{
+  int s;
+
+  if(!enabled)
+    return;
+  busy = 1;
+  pthread_mutex_lock(&lock);
+  for(s = 0; s < n_sites; s++) {
+    if(sites[s].live > sites[s].last_live)
+      sites[s].growing++;
+    else
+      sites[s].growing = 0;
+    sites[s].last_live = sites[s].live;
+  }
+  printf("Heap after %s %ld: %.2f MB live in %ld blocks, %.2f MB peak\n", what, iter,
+         live_bytes/MB, n_blocks, peak_bytes/MB);
+  print_slots();
+  print_sites(top, 0);
+  fflush(stdout);
+  pthread_mutex_unlock(&lock);
+  busy = 0;
+}
+
+void alloc_summary(int top)
+     /* peak bytes per phase and of the top sites */
+{
+  if(!enabled)
+    return;
+  busy = 1;
+  pthread_mutex_lock(&lock);
+  printf("Heap at the end: %.2f MB live in %ld blocks, %.2f MB peak\n", live_bytes/MB, n_blocks,
+         peak_bytes/MB);
+  print_slots();
+  print_sites(top, 1);
+  fflush(stdout);
+  pthread_mutex_unlock(&lock);
+  busy = 0;
+}
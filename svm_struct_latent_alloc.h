@@ -0,0 +1,31 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_alloc.h                                          */
+/*                                                                      */
+/*   Heap accounting for the Latent SVM^struct trainer: live and peak   */
+/*   bytes per timed phase and per allocation site, to find the sites   */
+/*   that keep growing over a long run.                                 */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_ALLOC
+#define SVM_STRUCT_LATENT_ALLOC
+
+#define ALLOC_SITE_DEPTH 4     /* callers that identify an allocation site */
+#define ALLOC_MAX_SITES  4096  /* sites beyond this are counted together */
+#define ALLOC_GROWTH     3     /* reports in a row with more live bytes that
+                                  mark a site as growing */
+
+int  alloc_tracking_enable(void);
+int  alloc_tracking_enabled(void);
+long alloc_live_bytes(void);
+long alloc_peak_bytes(void);
+void alloc_report(const char *what, long iter, int n_sites);
+void alloc_summary(int n_sites);
+
+#endif
@@ -20,10 +20,18 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "svm_struct_latent_api_types.h"
+#include "svm_struct_latent_eval.h"
+#include "svm_struct_latent_soa.h"
+#include "svm_struct_latent_kernels.h"
+#include "svm_struct_latent_profile.h"
 #include <limits.h>
 #include <stdbool.h>
 #include <math.h>
 #include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MAX_INPUT_LINE_LENGTH 10000
 #define EQUALITY_EPSILON 1e-6
@@ -49,219 +57,237 @@ int img_score_comp(const void *a, const void *b) {
     return (aa->img_idx > bb->img_idx) ? 1 : -1;   // Cannot compare equal.
 }
 
-SVECTOR** readFeatures(char *feature_file, int n_fvecs) {
+SVECTOR *parse_feature_line(char *line) {
+/*
+  Parses one candidate of a feature file, a line of space separated
+  wnum:weight pairs, into a feature vector. The line is modified.
+*/
     WORD *words = NULL;
-    FILE *fp = fopen(feature_file, "r");
-    
     int fvec_length = 0;
     int fvec_buffer_length;
-    char *line = NULL;
-    size_t len = 0;
     size_t ln;
     char *pair, *single, *brkt, *brkb;
+    int j = 0;
+    SVECTOR *fvec;
 
-    SVECTOR **fvecs = (SVECTOR **)malloc(n_fvecs*sizeof(SVECTOR *));
-    if(!fvecs) die("Memory Error.");
+    ln = strlen(line);
+    if ((ln > 0) && (line[ln-1] == '\n'))
+        line[ln-1] = '\0';
+    
+    fvec_length = 0;
+    fvec_buffer_length = 10000;
+    words = (WORD *) malloc(fvec_buffer_length*sizeof(WORD));
+   
+    for(pair = strtok_r(line, " ", &brkt); pair; pair = strtok_r(NULL, " ", &brkt)){
+        fvec_length++;
+        if(fvec_length == fvec_buffer_length){
+            fvec_buffer_length = fvec_buffer_length*1.5;
+            words = (WORD *) realloc(words, fvec_buffer_length*sizeof(WORD));
+        }            
+        if(!words) die("Memory error.");
+        j = 0;
+        for (single = strtok_r(pair, ":", &brkb); single; single = strtok_r(NULL, ":", &brkb)){
+            if(j == 0){
+                words[fvec_length-1].wnum = atoi(single);
+            }
+            else{
+                words[fvec_length-1].weight = atof(single); 
+            }
+            j++;
+        }
+    } 
+    fvec_length++; 
+    if(fvec_length == fvec_buffer_length){
+        words = (WORD *) realloc(words, fvec_length*sizeof(WORD));
+        if(!words) die("Memory error.");
+    }        
+    words[fvec_length-1].wnum = 0;
+    words[fvec_length-1].weight = 0.0;
+
+    fvec = create_svector(words,"",1);
+    free(words);
+    return fvec;
+}
 
+SVECTOR** read_feature_file(char *feature_file, int n_fvecs) {
+/*
+  Reads the n_fvecs candidates of an image. Returns NULL if the file
+  cannot be opened or holds fewer than n_fvecs lines; lines beyond
+  n_fvecs are ignored.
+*/
+    FILE *fp = fopen(feature_file, "r");
+    char *line = NULL;
+    size_t len = 0;
     int i = 0;
-    int j = 0;
 
-    while( getline(&line,&len,fp) != -1) {
-        ln = strlen(line) - 1;
-        if (line[ln] == '\n')
-            line[ln] = '\0';
-        
-        fvec_length = 0;
-        fvec_buffer_length = 10000;
-        words = (WORD *) malloc(fvec_buffer_length*sizeof(WORD));
-       
-        for(pair = strtok_r(line, " ", &brkt); pair; pair = strtok_r(NULL, " ", &brkt)){
-            fvec_length++;
-            if(fvec_length == fvec_buffer_length){
-                fvec_buffer_length = fvec_buffer_length*1.5;
-                words = (WORD *) realloc(words, fvec_buffer_length*sizeof(WORD));
-            }            
-            if(!words) die("Memory error.");
-            j = 0;
-            for (single = strtok_r(pair, ":", &brkb); single; single = strtok_r(NULL, ":", &brkb)){
-                if(j == 0){
-                    words[fvec_length-1].wnum = atoi(single);
-                }
-                else{
-                    words[fvec_length-1].weight = atof(single); 
-                }
-                j++;
-            }
-        } 
-        fvec_length++; 
-        if(fvec_length == fvec_buffer_length){
-            words = (WORD *) realloc(words, fvec_length*sizeof(WORD));
-            if(!words) die("Memory error.");
-        }        
-        words[fvec_length-1].wnum = 0;
-        words[fvec_length-1].weight = 0.0;
+    if(fp==NULL){
+        return NULL;
+    }
+
+    SVECTOR **fvecs = (SVECTOR **)malloc(n_fvecs*sizeof(SVECTOR *));
+    if(!fvecs) die("Memory Error.");
 
-        fvecs[i] = create_svector(words,"",1);
-        free(words);
-        words = NULL;
+    while((i < n_fvecs) && (getline(&line,&len,fp) != -1)) {
+        fvecs[i] = parse_feature_line(line);
         i++;
+    }
+    free(line);
+    fclose(fp);
 
-        free(line);
-        line = NULL;
-   }
-   fclose(fp);
-   return fvecs;
+    if(i < n_fvecs){
+        while(i > 0)
+            free_svector(fvecs[--i]);
+        free(fvecs);
+        return NULL;
+    }
+    return fvecs;
 }
 
-SAMPLE read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm) {
-    SAMPLE sample;
+SVECTOR** readFeatures(char *feature_file, int n_fvecs) {
+    SVECTOR **fvecs = read_feature_file(feature_file, n_fvecs);
 
-    int i , j; 
-    
-    // open the file containing candidate bounding box dimensions/labels/featurePath and image label
-    FILE *fp = fopen(file, "r");
-    if(fp==NULL){
-        printf("Error: Cannot open input file %s\n",file);
-        exit(1);      
+    if(fvecs==NULL){
+        printf("Error: Cannot read %d candidates from feature file %s\n",n_fvecs,feature_file);
+        exit(1);
     }
+    return fvecs;
+}
 
-    // We treat all images as one example, since there is only one correct structural output Y* for all images combined
-    sample.n = 1;  
-    sample.examples = (EXAMPLE *) malloc(sample.n*sizeof(EXAMPLE));
-    if(!sample.examples) die("Memory error.");
-    sample.examples[0].n_pos = 0;
-    sample.examples[0].n_neg = 0;
-    
-    fscanf(fp,"%ld", &sample.examples[0].n_imgs);
+SOA_BLOCK *readFeatureBlock(char *feature_file, int n_fvecs) {
+    SOA_BLOCK *cands = read_feature_block(feature_file, n_fvecs);
+
+    if(cands==NULL){
+        printf("Error: Cannot read %d candidates from feature file %s\n",n_fvecs,feature_file);
+        exit(1);
+    }
+    return cands;
+}
+
+static void example_from_images(EXAMPLE *ex, MANIFEST *mf, long *imgs, long n_imgs, int need_area_ratios) {
+/*
+  Builds one ranking example from the manifest images imgs[0..n_imgs-1],
+  in this order. 
+*/
+    long i, k;
+
+    ex->n_imgs = n_imgs;
+    ex->n_pos = 0;
+    ex->n_neg = 0;
     
     /* Initialise pattern */
-    sample.examples[0].x.example_cost = 1;
-    sample.examples[0].x.x_is = (SUB_PATTERN *) malloc(sample.examples[0].n_imgs*sizeof(SUB_PATTERN));
-    if(!sample.examples[0].x.x_is) die("Memory error.");
-    sample.examples[0].y.labels = (int *) malloc(sample.examples[0].n_imgs*sizeof(int));
-    if(!sample.examples[0].y.labels) die("Memory error.");
+    ex->x.example_cost = 1;
+    ex->x.x_is = (SUB_PATTERN *) malloc(n_imgs*sizeof(SUB_PATTERN));
+    if(!ex->x.x_is) die("Memory error.");
+    ex->y.labels = (int *) malloc(n_imgs*sizeof(int));
+    if(!ex->y.labels) die("Memory error.");
     
-    for(i = 0; i < sample.examples[0].n_imgs; i++){
-        fscanf(fp, "%s", sample.examples[0].x.x_is[i].file_name);
-        fscanf(fp,"%d",&sample.examples[0].x.x_is[i].label);
-        fscanf(fp, "%d", &sample.examples[0].x.x_is[i].n_candidates);
-        
-        sample.examples[0].y.labels[i] = sample.examples[0].x.x_is[i].label;
+    for(i = 0; i < n_imgs; i++){
+        k = imgs[i];
+        ex->x.x_is[i].file_name = mf->pool + mf->name_offsets[k];
+        ex->x.x_is[i].label = mf->labels[k];
+        ex->x.x_is[i].n_candidates = mf->n_candidates[k];
+        ex->x.x_is[i].areaRatios = NULL;
+        ex->y.labels[i] = mf->labels[k];
         // Image label can be 0(negative image) or 1(positive image)
-        if(sample.examples[0].x.x_is[i].label == 0) {
-            sample.examples[0].n_neg++;
-        } else { 
-            sample.examples[0].n_pos++;
-            sample.examples[0].x.x_is[i].areaRatios = (int *) malloc (sample.examples[0].x.x_is[i].n_candidates*sizeof(int));
-            if(!sample.examples[0].x.x_is[i].areaRatios) die("Memory error.");
-            for(j = 0; j < sample.examples[0].x.x_is[i].n_candidates; j++){
-                fscanf(fp, "%d", &sample.examples[0].x.x_is[i].areaRatios[j]);
-            }    
+        if(mf->labels[k] != 0) {
+            ex->n_pos++;
+            if(need_area_ratios) {
+                if((long)(mf->area_offsets[k+1]-mf->area_offsets[k]) != mf->n_candidates[k]){
+                    printf("Error: positive image %s has no area ratio for every candidate\n", ex->x.x_is[i].file_name);
+                    exit(1);
+                }
+                ex->x.x_is[i].areaRatios = mf->area_ratios + mf->area_offsets[k];
+            }
+        }
+        else {
+            ex->n_neg++;
         }
-
-        sample.examples[0].x.x_is[i].phis = (SVECTOR **) malloc(sample.examples[0].x.x_is[i].n_candidates*sizeof(SVECTOR *));
-        if(!sample.examples[0].x.x_is[i].phis) die("Memory error.");  
     }
      
-    sample.examples[0].x.n_pos = sample.examples[0].n_pos;
-    sample.examples[0].x.n_neg = sample.examples[0].n_neg;
-    sample.examples[0].y.n_pos = sample.examples[0].n_pos;
-    sample.examples[0].y.n_neg = sample.examples[0].n_neg;
+    ex->x.n_pos = ex->n_pos;
+    ex->x.n_neg = ex->n_neg;
+    ex->y.n_pos = ex->n_pos;
+    ex->y.n_neg = ex->n_neg;
     
-    /* Intialise label*/
-    sample.examples[0].y.ranking = (int *) calloc((sample.examples[0].n_pos+sample.examples[0].n_neg), sizeof(int));
-    for(i = 0; i < (sample.examples[0].n_pos+sample.examples[0].n_neg); i++){
-        for(j = i+1; j < (sample.examples[0].n_pos+sample.examples[0].n_neg); j++){
-            if(sample.examples[0].x.x_is[i].label == 1){
-                if(sample.examples[0].x.x_is[j].label == 0){
-                    sample.examples[0].y.ranking[i]++;
-                    sample.examples[0].y.ranking[j]--;
-                }              
-            }
-            else{
-                if(sample.examples[0].x.x_is[j].label == 1){
-                    sample.examples[0].y.ranking[i]--;
-                    sample.examples[0].y.ranking[j]++;
-                }
-            }
+    /* Intialise label: every positive image is ranked above every negative image,
+       so the pairwise counts reduce to n_neg for positives and -n_pos for negatives */
+    ex->y.ranking = (int *) malloc(n_imgs*sizeof(int));
+    if(!ex->y.ranking) die("Memory error.");
+    for(i = 0; i < n_imgs; i++){
+        if(ex->x.x_is[i].label == 1){
+            ex->y.ranking[i] = ex->n_neg;
+        }
+        else{
+            ex->y.ranking[i] = -ex->n_pos;
         }
     }
-
-    return sample;
 }
 
-SAMPLE read_struct_test_examples(char *file, STRUCT_LEARN_PARM *sparm) {
+SAMPLE sample_from_manifest(MANIFEST *mf, int need_area_ratios, long n_strata) {
+/*
+  With n_strata = 1, all images form one example, since there is only
+  one correct structural output Y* for all images combined. Otherwise
+  the images are dealt round-robin into n_strata examples, positives
+  and negatives separately, so every example is a ranking problem with
+  about n_pos/n_strata positives and n_neg/n_strata negatives of its
+  own. The examples keep the manifest order of their images. 
+*/
     SAMPLE sample;
-
-    int i , j; 
-    
-    // open the file containing candidate bounding box dimensions/labels/featurePath and image label
-    FILE *fp = fopen(file, "r");
-    if(fp==NULL){
-        printf("Error: Cannot open input file %s\n",file);
-        exit(1);      
+    long i, k;
+    long *imgs, *start, *next, n_seen_pos, n_seen_neg;
+
+    if(n_strata < 1)
+        n_strata = 1;
+    if((n_strata > 1) && ((n_strata > mf->n_pos) || (n_strata > mf->n_neg))) {
+        printf("Error: Cannot split %ld positive and %ld negative images into %ld examples\n",
+               mf->n_pos, mf->n_neg, n_strata);
+        exit(1);
     }
 
-    // We treat all images as one example, since there is only one correct structural output Y* for all images combined
-    sample.n = 1;  
+    sample.n = (int) n_strata;
+    sample.manifest = mf;
     sample.examples = (EXAMPLE *) malloc(sample.n*sizeof(EXAMPLE));
     if(!sample.examples) die("Memory error.");
-    sample.examples[0].n_pos = 0;
-    sample.examples[0].n_neg = 0;
-    
-    fscanf(fp,"%ld", &sample.examples[0].n_imgs);
-    
-    /* Initialise pattern */
-    sample.examples[0].x.example_cost = 1;
-    sample.examples[0].x.x_is = (SUB_PATTERN *) malloc(sample.examples[0].n_imgs*sizeof(SUB_PATTERN));
-    if(!sample.examples[0].x.x_is) die("Memory error.");
-    sample.examples[0].y.labels = (int *) malloc(sample.examples[0].n_imgs*sizeof(int));
-    if(!sample.examples[0].y.labels) die("Memory error.");
-    
-    for(i = 0; i < sample.examples[0].n_imgs; i++){
-        fscanf(fp, "%s", sample.examples[0].x.x_is[i].file_name);
-        fscanf(fp,"%d",&sample.examples[0].x.x_is[i].label);
-        fscanf(fp, "%d", &sample.examples[0].x.x_is[i].n_candidates);
-        
-        sample.examples[0].y.labels[i] = sample.examples[0].x.x_is[i].label;
-        // Image label can be 0(negative image) or 1(positive image)
-        if(sample.examples[0].x.x_is[i].label == 0) {
-            sample.examples[0].n_neg++;
-        } else { 
-            sample.examples[0].n_pos++; 
-        }
 
-        sample.examples[0].x.x_is[i].phis = (SVECTOR **) malloc(sample.examples[0].x.x_is[i].n_candidates*sizeof(SVECTOR *));
-        if(!sample.examples[0].x.x_is[i].phis) die("Memory error.");  
+    /* the images of example k are imgs[start[k]..start[k+1]-1] */
+    imgs = (long *) malloc(mf->n_imgs*sizeof(long));
+    start = (long *) calloc(n_strata+1, sizeof(long));
+    next = (long *) malloc(n_strata*sizeof(long));
+    if(!imgs || !start || !next) die("Memory error.");
+    n_seen_pos = n_seen_neg = 0;
+    for(i = 0; i < mf->n_imgs; i++){
+        k = (mf->labels[i] != 0) ? (n_seen_pos++ % n_strata) : (n_seen_neg++ % n_strata);
+        start[k+1]++;
     }
-     
-    sample.examples[0].x.n_pos = sample.examples[0].n_pos;
-    sample.examples[0].x.n_neg = sample.examples[0].n_neg;
-    sample.examples[0].y.n_pos = sample.examples[0].n_pos;
-    sample.examples[0].y.n_neg = sample.examples[0].n_neg;
-    
-    /* Intialise label*/
-    sample.examples[0].y.ranking = (int *) calloc((sample.examples[0].n_pos+sample.examples[0].n_neg), sizeof(int));
-    for(i = 0; i < (sample.examples[0].n_pos+sample.examples[0].n_neg); i++){
-        for(j = i+1; j < (sample.examples[0].n_pos+sample.examples[0].n_neg); j++){
-            if(sample.examples[0].x.x_is[i].label == 1){
-                if(sample.examples[0].x.x_is[j].label == 0){
-                    sample.examples[0].y.ranking[i]++;
-                    sample.examples[0].y.ranking[j]--;
-                }              
-            }
-            else{
-                if(sample.examples[0].x.x_is[j].label == 1){
-                    sample.examples[0].y.ranking[i]--;
-                    sample.examples[0].y.ranking[j]++;
-                }
-            }
-        }
+    for(k = 0; k < n_strata; k++){
+        start[k+1] += start[k];
+        next[k] = start[k];
+    }
+    n_seen_pos = n_seen_neg = 0;
+    for(i = 0; i < mf->n_imgs; i++){
+        k = (mf->labels[i] != 0) ? (n_seen_pos++ % n_strata) : (n_seen_neg++ % n_strata);
+        imgs[next[k]++] = i;
+    }
+    for(k = 0; k < n_strata; k++){
+        example_from_images(&sample.examples[k], mf, imgs+start[k], start[k+1]-start[k], need_area_ratios);
     }
 
+    free(imgs);
+    free(start);
+    free(next);
     return sample;
 }
 
+SAMPLE read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm) {
+    // the manifest lists candidate bounding box area ratios/labels/featurePath for each image,
+    // either as text or packed by svm_struct_latent_pack
+    return sample_from_manifest(read_manifest(file, 1), 1, sparm->n_strata);
+}
+
+SAMPLE read_struct_test_examples(char *file, STRUCT_LEARN_PARM *sparm) {
+    return sample_from_manifest(read_manifest(file, 0), 0, 1);
+}
+
 void init_struct_model(SAMPLE sample, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, LEARN_PARM *lparm, KERNEL_PARM *kparm) {
 /*
   Initialize parameters in STRUCTMODEL sm. Set the diminension 
@@ -279,52 +305,120 @@ void init_latent_variables(SAMPLE *sample, LEARN_PARM *lparm, STRUCTMODEL *sm, S
   Initialize latent variables in the first iteration of training.
   Latent variables are stored at sample.examples[i].h, for 1<=i<=sample.n.
 */
-    sample->examples[0].h.h_is = (int *) malloc((sample->examples[0].n_pos+sample->examples[0].n_neg)*sizeof(int));
-    sample->examples[0].h.phi_h_is = (SVECTOR **) malloc((sample->examples[0].n_pos+sample->examples[0].n_neg)*sizeof(SVECTOR *));
-
-    long i;
+    long i, k;
+    EXAMPLE *ex;
     //int positive_candidate;
-    SVECTOR **fvecs = NULL;
+    SOA_BLOCK *cands = NULL;
 
     int j;
 
     int maxArea = 0;
     int maxAreaIdx = 0;
 
+    prof_begin(PROF_POS_IMPUTATION);
     srand(sparm->rng_seed);
-    for(i=0; i < (sample->examples[0].n_pos+sample->examples[0].n_neg); i++){
-        sample->examples[0].h.phi_h_is[i] = NULL;
-        if(sample->examples[0].x.x_is[i].label == 1){
-            maxArea = 0;
-            maxAreaIdx = 0;
-            //positive_candidate = (int) (((float)sample->examples[0].x.x_is[i].n_candidates)*((float)rand())/(RAND_MAX+1.0)); 
-            //sample->examples[0].h.h_is[i] = positive_candidate; 
-            for (j = 0; j < sample->examples[0].x.x_is[i].n_candidates; j++)
-            {
-                if(sample->examples[0].x.x_is[i].areaRatios[j] > maxArea){
-                    maxArea = sample->examples[0].x.x_is[i].areaRatios[j];
-                    maxAreaIdx = j;
+    for(k=0; k < sample->n; k++){
+        ex = &sample->examples[k];
+        ex->h.h_is = (int *) malloc((ex->n_pos+ex->n_neg)*sizeof(int));
+        ex->h.phi_h_is = (SVECTOR **) malloc((ex->n_pos+ex->n_neg)*sizeof(SVECTOR *));
+        for(i=0; i < (ex->n_pos+ex->n_neg); i++){
+            ex->h.phi_h_is[i] = NULL;
+            if(ex->x.x_is[i].label == 1){
+                maxArea = 0;
+                maxAreaIdx = 0;
+                //positive_candidate = (int) (((float)ex->x.x_is[i].n_candidates)*((float)rand())/(RAND_MAX+1.0)); 
+                //ex->h.h_is[i] = positive_candidate; 
+                for (j = 0; j < ex->x.x_is[i].n_candidates; j++)
+                {
+                    if(ex->x.x_is[i].areaRatios[j] > maxArea){
+                        maxArea = ex->x.x_is[i].areaRatios[j];
+                        maxAreaIdx = j;
+                    }
                 }
-            }
-            sample->examples[0].h.h_is[i] = maxAreaIdx;
+                ex->h.h_is[i] = maxAreaIdx;
             
-            fvecs = readFeatures(sample->examples[0].x.x_is[i].file_name, sample->examples[0].x.x_is[i].n_candidates);
-            sample->examples[0].h.phi_h_is[i] = copy_svector(fvecs[sample->examples[0].h.h_is[i]]);
-            for (j = 0; j < sample->examples[0].x.x_is[i].n_candidates; j++){
-                free_svector(fvecs[j]);
-            }
-            free(fvecs);
-            if(i % 15 == 0){
-                printf("%ld Postive image\n", i); fflush(stdout);
+                cands = readFeatureBlock(ex->x.x_is[i].file_name, ex->x.x_is[i].n_candidates);
+                ex->h.phi_h_is[i] = svector_from_soa(&cands->vecs[ex->h.h_is[i]]);
+                free_soa_block(cands);
+                if(i % 15 == 0){
+                    printf("%ld Postive image\n", i); fflush(stdout);
+                }
             }
+            else{
+                ex->h.h_is[i] = -1; // There is no latent variable for negative samples.
+            }                       
         }
-        else{
-            sample->examples[0].h.h_is[i] = -1; // There is no latent variable for negative samples.
-        }                       
     }
+    prof_end(PROF_POS_IMPUTATION);
 	
 }
 
+static int int_comp(const void *a, const void *b) {
+    int aa = *(const int *)a, bb = *(const int *)b;
+    return (aa > bb) - (aa < bb);
+}
+
+static long count_below(int *sorted, long n, int value) {
+/*
+  Number of entries of sorted smaller than value. 
+*/
+    long lo = 0, hi = n, mid;
+    while(lo < hi){
+        mid = lo+(hi-lo)/2;
+        if(sorted[mid] < value) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static long count_at_most(int *sorted, long n, int value) {
+/*
+  Number of entries of sorted not larger than value. 
+*/
+    long lo = 0, hi = n, mid;
+    while(lo < hi){
+        mid = lo+(hi-lo)/2;
+        if(sorted[mid] <= value) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void psi_coefficients(PATTERN x, LABEL y, int *coeff) {
+/*
+  The factor of every image's feature vector in n_pos*n_neg*psi(x,y,h),
+  the sum of Y_ij over the images of the other class, where Y_ij is 1
+  if positive i is ranked above negative j and -1 otherwise. Counted
+  with binary searches in the sorted ranks of the other class. 
+*/
+    long i;
+    long n_posRanks = 0, n_negRanks = 0;
+    int *posRanks = (int*) malloc((x.n_pos+1)*sizeof(int));
+    int *negRanks = (int*) malloc((x.n_neg+1)*sizeof(int));
+    if(!posRanks || !negRanks) die("Memory error");
+    
+    for(i = 0; i < (x.n_pos + x.n_neg); i++){
+        if(x.x_is[i].label == 1)
+            posRanks[n_posRanks++] = y.ranking[i];
+        else
+            negRanks[n_negRanks++] = y.ranking[i];
+    }
+    qsort(posRanks, n_posRanks, sizeof(int), int_comp);
+    qsort(negRanks, n_negRanks, sizeof(int), int_comp);
+    for(i = 0; i < (x.n_pos + x.n_neg); i++){
+        if(x.x_is[i].label == 1){
+            // negatives ranked below i, minus those that are not
+            coeff[i] = (int) (2*count_below(negRanks, n_negRanks, y.ranking[i])-n_negRanks);
+        }
+        else{
+            // positives not ranked above i, minus those that are
+            coeff[i] = (int) (n_posRanks-2*(n_posRanks-count_at_most(posRanks, n_posRanks, y.ranking[i])));
+        }
+    }
+    free(posRanks);
+    free(negRanks);
+}
+
 SVECTOR *psi(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
 /*
   Creates the feature vector \Psi(x,y,h) and return a pointer to 
@@ -338,7 +432,6 @@ SVECTOR *psi(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PAR
     long i;
     long j;
     
-    double Y_ij;
     double norm_factor;
     int y_i_count;
     
@@ -348,36 +441,20 @@ SVECTOR *psi(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PAR
     SVECTOR *temp4=NULL;
     SVECTOR *temp5=NULL;
     
+    prof_begin(PROF_PSI);
     WORD *words = (WORD *) malloc(sizeof(WORD));
 	words[0].wnum = 0;
 	words[0].weight = 0.0;
 	fvec = create_svector(words,"",1);
 	free(words);
 	
-	int *coeff = (int*) calloc((x.n_pos + x.n_neg), sizeof(int));
+	int *coeff = (int*) malloc((x.n_pos + x.n_neg)*sizeof(int));
+    if(!coeff) die("Memory error");
+    psi_coefficients(x, y, coeff);
 
     for(i = 0; i < (x.n_pos + x.n_neg); i++){
         if(x.x_is[i].label == 1){  
-            y_i_count = 0; 
-            
-            for(j = 0; j < (x.n_pos + x.n_neg); j++){
-                if(x.x_is[j].label == 0){
-                    if(y.ranking[i] > y.ranking[j]){
-                        Y_ij = 1;
-                    }
-                    else{
-                        Y_ij = -1;
-                    }
-                    if(Y_ij == 1){
-                        coeff[j]--;              
-                        y_i_count++;
-                    }
-                    else{
-                        coeff[j]++;                      
-                        y_i_count--;
-                    }                                                      
-                }
-            }
+            y_i_count = coeff[i];
             temp2 = smult_s(h.phi_h_is[i], y_i_count);
             temp3 = add_ss(fvec, temp2);
             free_svector(temp2);
@@ -398,8 +475,10 @@ SVECTOR *psi(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PAR
 
     norm_factor = 1/(double)(x.n_pos*x.n_neg);
     temp4 = smult_s(fvec, norm_factor);
-    free(fvec);
+    free_svector(fvec);
+    free(coeff);
     fvec = temp4;
+    prof_end(PROF_PSI);
      
     return(fvec);
 }
@@ -422,103 +501,50 @@ double *classify_struct_example(PATTERN x, LATENT_VAR h, STRUCTMODEL *sm) {
 }
 
 void encodeRanking(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap, int *optimumLocNegImg){
-    int i, j, i_prime, j_prime, oj_prime, oi_prime;
+/*
+  Encodes the ranking as, for every image, the number of images ranked
+  below it minus the number ranked above it. Within a class images are
+  ranked by score, ties by index, which is the order of the sorted
+  score lists; the positive at sorted position p (from 1) is ranked
+  above the negative at sorted position q iff p < optimumLocNegImg[q-1].
+  Counting instead of comparing all pairs makes this O(n). 
+*/
+    long i, p, o, below;
+    long n = x.n_pos+x.n_neg;
     
-    ybar->ranking = (int *) calloc((x.n_pos+x.n_neg), sizeof(int));
+    ybar->ranking = (int *) calloc(n, sizeof(int));
     if(!ybar->ranking) die("Memory error");
+    // negBelow[p]: negatives ranked below the positive at sorted position p
+    long *negBelow = (long *) calloc(x.n_pos+2, sizeof(long));
+    if(!negBelow) die("Memory error");
     
-    for(i = 0; i < (x.n_pos+x.n_neg); i++){
-        for(j = i+1; j < (x.n_pos+x.n_neg); j++){        
-            if(i == j){
-                //ybar->rank_matrix[i][j] = 0;
-            }
-            else if(x.x_is[i].label == x.x_is[j].label){                
-                if(x.x_is[i].label == 1){                                 
-                    if(positiveImgScores[imgIndexMap[i]].img_score > positiveImgScores[imgIndexMap[j]].img_score){
-                        //ybar->rank_matrix[i][j] = 1;
-                        ybar->ranking[i]++;
-                        ybar->ranking[j]--;
-                    }
-                    else if(positiveImgScores[imgIndexMap[j]].img_score > positiveImgScores[imgIndexMap[i]].img_score){
-                        //ybar->rank_matrix[i][j] = -1;
-                        ybar->ranking[i]--;
-                        ybar->ranking[j]++;
-                    }
-                    else{
-                        if(i < j){
-                            //ybar->rank_matrix[i][j] = 1;
-                            ybar->ranking[i]++;
-                            ybar->ranking[j]--;
-                        }
-                        else{
-                            //ybar->rank_matrix[i][j] = -1;
-                            ybar->ranking[i]--;
-                            ybar->ranking[j]++;
-                        }
-                    }
-                }
-                else{
-                    if(negativeImgScores[imgIndexMap[i]].img_score > negativeImgScores[imgIndexMap[j]].img_score){
-                        //ybar->rank_matrix[i][j] = 1;
-                        ybar->ranking[i]++;
-                        ybar->ranking[j]--;
-                    }
-                    else if(negativeImgScores[imgIndexMap[j]].img_score > negativeImgScores[imgIndexMap[i]].img_score){
-                        //ybar->rank_matrix[i][j] = -1;
-                        ybar->ranking[i]--;
-                        ybar->ranking[j]++;
-                    }
-                    else{
-                        if(i < j){
-                            //ybar->rank_matrix[i][j] = 1;
-                            ybar->ranking[i]++;
-                            ybar->ranking[j]--;
-                        }
-                        else{
-                            //ybar->rank_matrix[i][j] = -1;
-                            ybar->ranking[i]--;
-                            ybar->ranking[j]++;
-                        }
-                    }
-                }        
-            }
-            else if((x.x_is[i].label == 1) && (x.x_is[j].label == 0)){
-                i_prime = imgIndexMap[i]+1;
-                j_prime = imgIndexMap[j]+1;
-                oj_prime = optimumLocNegImg[j_prime-1];
-                              
-                if((oj_prime - i_prime - 0.5) > 0){
-                    //ybar->rank_matrix[i][j] = 1;
-                    ybar->ranking[i]++;
-                    ybar->ranking[j]--;
-                }
-                else{
-                    //ybar->rank_matrix[i][j] = -1;
-                    ybar->ranking[i]--;
-                    ybar->ranking[j]++;
-                }
-            }
-            else if((x.x_is[i].label == 0) && (x.x_is[j].label == 1)){
-                i_prime = imgIndexMap[i]+1;
-                j_prime = imgIndexMap[j]+1;
-                oi_prime = optimumLocNegImg[i_prime-1];
-                
-                if((j_prime - oi_prime + 0.5) > 0){
-                    //ybar->rank_matrix[i][j] = 1;
-                    ybar->ranking[i]++;
-                    ybar->ranking[j]--;
-                }
-                else{
-                    //ybar->rank_matrix[i][j] = -1;
-                    ybar->ranking[i]--;
-                    ybar->ranking[j]++;
-                }
-            }                    
-        }        
-    }    
+    for(i = 0; i < x.n_neg; i++){
+        negBelow[optimumLocNegImg[i]-1]++;
+    }
+    for(p = x.n_pos; p >= 0; p--){
+        negBelow[p] += negBelow[p+1];
+    }
+    
+    for(i = 0; i < n; i++){
+        p = imgIndexMap[i]+1;
+        if(x.x_is[i].label == 1){
+            below = (x.n_pos-p)+negBelow[p];
+        }
+        else{
+            o = optimumLocNegImg[p-1];
+            below = (x.n_neg-p)+(x.n_pos-o+1);
+        }
+        ybar->ranking[i] = (int) (2*below-(n-1));
+    }
+    free(negBelow);
 }
 
-void findOptimumNegLocations(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap){
+int *optimumNegLocations(PATTERN x, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores){
+/*
+  For every negative image, in sorted order, the sorted position of the
+  first positive image ranked below it (n_pos+1 if none) in the most
+  violated ranking. 
+*/
     int j, k;
     int *optimumLocNegImg = malloc(x.n_neg*sizeof(*optimumLocNegImg));
     if(!optimumLocNegImg) die("Memory error");
@@ -541,10 +567,50 @@ void findOptimumNegLocations(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScore
         }
         optimumLocNegImg[j-1] = maxIndex;
     }
+    return optimumLocNegImg;
+}
+
+void findOptimumNegLocations(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap){
+    int *optimumLocNegImg = optimumNegLocations(x, positiveImgScores, negativeImgScores);
+
     encodeRanking(x, ybar, positiveImgScores, negativeImgScores, imgIndexMap, optimumLocNegImg);
     free(optimumLocNegImg);
 }
 
+void refresh_float_weights(STRUCTMODEL *sm) {
+/*
+  Copies w into its single precision copy, if kept. Must be called
+  whenever w changes before candidates are scored again. 
+*/
+    long i;
+
+    if(!sm->w_float)
+        return;
+    for(i = 0; i <= sm->sizePsi; i++)
+        sm->w_float[i] = (float) sm->w[i];
+}
+
+void init_float_weights(STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Allocates the single precision copy of w if --s asks for it. 
+*/
+    sm->w_float = NULL;
+    if(sparm->float_weights){
+        sm->w_float = (float *) my_malloc((sm->sizePsi+1)*sizeof(float));
+        refresh_float_weights(sm);
+    }
+}
+
+double candidate_score(STRUCTMODEL *sm, SVECTOR_SOA *v) {
+/*
+  <w,v> for one candidate, from the single precision copy of w if
+  kept. 
+*/
+    if(sm->w_float)
+        return sprod_fs_soa(sm->w_float, v);
+    return sprod_ns_soa(sm->w, v);
+}
+
 void mine_negative_latent_variables(PATTERN x, LATENT_VAR *h, STRUCTMODEL *sm) {
     int i, j;    
 
@@ -553,79 +619,46 @@ void mine_negative_latent_variables(PATTERN x, LATENT_VAR *h, STRUCTMODEL *sm) {
     double maxScore = -DBL_MAX;
     double score;
 
-    SVECTOR **fvecs = NULL;
+    SOA_BLOCK *cands = NULL;
     
+    prof_begin(PROF_NEG_MINING);
     for(i = 0; i < (x.n_pos+x.n_neg); i++){
         maxScore = -DBL_MAX;
         if(x.x_is[i].label == 0){
             if (h->phi_h_is[i]){
                 free_svector(h->phi_h_is[i]);
             }
-            fvecs = readFeatures(x.x_is[i].file_name, x.x_is[i].n_candidates);
+            cands = readFeatureBlock(x.x_is[i].file_name, x.x_is[i].n_candidates);
             for(j = 0; j < x.x_is[i].n_candidates; j++){
-                score = sprod_ns(sm->w, fvecs[j]);      
+                score = candidate_score(sm, &cands->vecs[j]);      
                 if(score > maxScore){
                     maxScore = score;
                     h->h_is[i] = j;
                 }   
             }
-            h->phi_h_is[i] = copy_svector(fvecs[h->h_is[i]]);
-            for(j =0; j < x.x_is[i].n_candidates; j++){
-                free_svector(fvecs[j]);
-            }
-            free(fvecs);
+            h->phi_h_is[i] = svector_from_soa(&cands->vecs[h->h_is[i]]);
+            free_soa_block(cands);
             if(n_neg % 500 == 0){
                 printf("%d Negative image\n", n_neg); fflush(stdout);
             }
             n_neg++;
+            prof_count(PROF_IMAGES, 1);
+            prof_count(PROF_CANDIDATES, x.x_is[i].n_candidates);
         }
     }
+    prof_end(PROF_NEG_MINING);
 }
 
-void find_most_violated_constraint_marginrescaling(PATTERN *x, LABEL y, LATENT_VAR *h, LABEL *ybar, LATENT_VAR *hbar, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+static void most_violated_ranking(PATTERN *x, LATENT_VAR *h, STRUCTMODEL *sm, LABEL *ybar, double *scores) {
 /*
-  Finds the most violated constraint (loss-augmented inference), i.e.,
-  computing argmax_{(ybar,hbar)} [<w,psi(x,ybar,hbar)> + loss(y,ybar,hbar)].
-  The output (ybar,hbar) are stored at location pointed by 
-  pointers *ybar and *hbar. 
+  The ranking part of loss-augmented inference: scores every image
+  with its latent feature vector in h and finds the ranking ybar that
+  maximizes <w,psi(x,ybar,h)> + loss(y,ybar,h). The image scores are
+  also returned in scores if it is not NULL. 
 */
-    int i;    
-    
+    int i;
     double score;
 
-    /*SVECTOR **fvecs = NULL;
-    
-    for(i = 0; i < (x->n_pos+x->n_neg); i++){
-        maxScore = -DBL_MAX;
-        if(x->x_is[i].label == 0){
-            if (h->phi_h_is[i]){
-                free_svector(h->phi_h_is[i]);
-            }
-            fvecs = readFeatures(x->x_is[i].file_name, x->x_is[i].n_candidates);
-            for(j = 0; j < x->x_is[i].n_candidates; j++){
-                score = sprod_ns(sm->w, fvecs[j]);      
-                if(score > maxScore){
-                    maxScore = score;
-                    h->h_is[i] = j;
-                }   
-            }
-            h->phi_h_is[i] = copy_svector(fvecs[h->h_is[i]]);
-            for(j =0; j < x->x_is[i].n_candidates; j++){
-                free_svector(fvecs[j]);
-            }
-            free(fvecs);
-        }
-    }*/
-
-    hbar->h_is = malloc((x->n_pos+x->n_neg)*sizeof(int));
-    if(!hbar->h_is) die("Memory error");
-    hbar->phi_h_is = (SVECTOR **) malloc((x->n_pos+x->n_neg)*sizeof(SVECTOR *));
-
-    for(i = 0; i < (x->n_pos+x->n_neg); i++){
-        hbar->h_is[i] = h->h_is[i];
-        hbar->phi_h_is[i] = copy_svector(h->phi_h_is[i]);
-    }
-        
     IMG_SCORE *positiveImgScores = malloc(x->n_pos*sizeof(IMG_SCORE));
     if(!positiveImgScores) die("Memory error");
     IMG_SCORE *negativeImgScores = malloc(x->n_neg*sizeof(IMG_SCORE));    
@@ -634,9 +667,11 @@ void find_most_violated_constraint_marginrescaling(PATTERN *x, LABEL y, LATENT_V
     if(!imgIndexMap) die("Memory error");
     int negativeId = 0;
     int positiveId = 0;    
-    // find scores of all positive images
+    // find scores of all images
     for(i = 0; i < (x->n_pos + x->n_neg); i++){
         score = sprod_ns(sm->w, h->phi_h_is[i]);
+        if(scores)
+            scores[i] = score;
         if(x->x_is[i].label == 0){
             negativeImgScores[negativeId].img_idx = i;
             negativeImgScores[negativeId].img_score = score;
@@ -676,6 +711,53 @@ void find_most_violated_constraint_marginrescaling(PATTERN *x, LABEL y, LATENT_V
     free(imgIndexMap);
 }
 
+void find_most_violated_constraint_marginrescaling(PATTERN *x, LABEL y, LATENT_VAR *h, LABEL *ybar, LATENT_VAR *hbar, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Finds the most violated constraint (loss-augmented inference), i.e.,
+  computing argmax_{(ybar,hbar)} [<w,psi(x,ybar,hbar)> + loss(y,ybar,hbar)].
+  The output (ybar,hbar) are stored at location pointed by 
+  pointers *ybar and *hbar. 
+*/
+    int i;    
+
+    /*SVECTOR **fvecs = NULL;
+    
+    for(i = 0; i < (x->n_pos+x->n_neg); i++){
+        maxScore = -DBL_MAX;
+        if(x->x_is[i].label == 0){
+            if (h->phi_h_is[i]){
+                free_svector(h->phi_h_is[i]);
+            }
+            fvecs = readFeatures(x->x_is[i].file_name, x->x_is[i].n_candidates);
+            for(j = 0; j < x->x_is[i].n_candidates; j++){
+                score = sprod_ns(sm->w, fvecs[j]);      
+                if(score > maxScore){
+                    maxScore = score;
+                    h->h_is[i] = j;
+                }   
+            }
+            h->phi_h_is[i] = copy_svector(fvecs[h->h_is[i]]);
+            for(j =0; j < x->x_is[i].n_candidates; j++){
+                free_svector(fvecs[j]);
+            }
+            free(fvecs);
+        }
+    }*/
+
+    prof_begin(PROF_LOSS_AUG);
+    hbar->h_is = malloc((x->n_pos+x->n_neg)*sizeof(int));
+    if(!hbar->h_is) die("Memory error");
+    hbar->phi_h_is = (SVECTOR **) malloc((x->n_pos+x->n_neg)*sizeof(SVECTOR *));
+
+    for(i = 0; i < (x->n_pos+x->n_neg); i++){
+        hbar->h_is[i] = h->h_is[i];
+        hbar->phi_h_is[i] = copy_svector(h->phi_h_is[i]);
+    }
+        
+    most_violated_ranking(x, h, sm, ybar, NULL);
+    prof_end(PROF_LOSS_AUG);
+}
+
 void infer_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int outer_iter) {
 /*
   Complete the latent variable h for labeled examples, i.e.,
@@ -693,17 +775,18 @@ void infer_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm,
     double maxScore = -DBL_MAX;
     double curr_score;
     
-    SVECTOR **fvecs = NULL;
+    SOA_BLOCK *cands = NULL;
 
+    prof_begin(PROF_POS_IMPUTATION);
     for(i = 0; i < (x.n_pos+x.n_neg); i++){
         maxScore = -DBL_MAX;
         if(x.x_is[i].label == 1){
             free_svector(h->phi_h_is[i]);
-            fvecs = readFeatures(x.x_is[i].file_name, x.x_is[i].n_candidates);
+            cands = readFeatureBlock(x.x_is[i].file_name, x.x_is[i].n_candidates);
             for(j = 0; j < x.x_is[i].n_candidates; j++){
                 if(outer_iter < 6){
                     if(x.x_is[i].areaRatios[j] > sparm->min_area_ratios[outer_iter]){
-                        curr_score = sprod_ns(sm->w, fvecs[j]);      
+                        curr_score = candidate_score(sm, &cands->vecs[j]);      
                         if(curr_score > maxScore){
                             maxScore = curr_score;
                             h->h_is[i] = j;
@@ -711,23 +794,23 @@ void infer_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm,
                     }      
                 }
                 else{
-                    curr_score = sprod_ns(sm->w, fvecs[j]);      
+                    curr_score = candidate_score(sm, &cands->vecs[j]);      
                     if(curr_score > maxScore){
                         maxScore = curr_score;
                         h->h_is[i] = j;
                     }  
                 }                          
             }
-            h->phi_h_is[i] = copy_svector(fvecs[h->h_is[i]]);
-            for(j =0; j < x.x_is[i].n_candidates; j++){
-                free_svector(fvecs[j]);
-            }
-            free(fvecs);
+            h->phi_h_is[i] = svector_from_soa(&cands->vecs[h->h_is[i]]);
+            free_soa_block(cands);
             if(i % 15 == 0){
                 printf("%ld Postive image\n", i); fflush(stdout);
             }
+            prof_count(PROF_IMAGES, 1);
+            prof_count(PROF_CANDIDATES, x.x_is[i].n_candidates);
         }
     }
+    prof_end(PROF_POS_IMPUTATION);
 
     //return(h); 
 
@@ -752,14 +835,14 @@ void infer_test_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL
     double maxScore = -DBL_MAX;
     double curr_score;
     
-    SVECTOR **fvecs = NULL;
+    SOA_BLOCK *cands = NULL;
 
     for(i = 0; i < (x.n_pos+x.n_neg); i++){
         maxScore = -DBL_MAX;
-        fvecs = readFeatures(x.x_is[i].file_name, x.x_is[i].n_candidates);
+        cands = readFeatureBlock(x.x_is[i].file_name, x.x_is[i].n_candidates);
         for(j = 0; j < x.x_is[i].n_candidates; j++){
             //if(s.x_is[i].isConsider){
-            curr_score = sprod_ns(sm->w, fvecs[j]);
+            curr_score = candidate_score(sm, &cands->vecs[j]);
             if(curr_score != 0){
             	if(curr_score > maxScore){
 	                maxScore = curr_score;
@@ -768,11 +851,8 @@ void infer_test_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL
             }              
             //}                
         }
-        h->phi_h_is[i] = copy_svector(fvecs[h->h_is[i]]);
-        for(j =0; j < x.x_is[i].n_candidates; j++){
-            free_svector(fvecs[j]);
-        }
-        free(fvecs);
+        h->phi_h_is[i] = svector_from_soa(&cands->vecs[h->h_is[i]]);
+        free_soa_block(cands);
         if(i % 10 == 0){
             printf("%ld Postive image\n", i); fflush(stdout);
         }
@@ -782,64 +862,139 @@ void infer_test_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL
 
 }
 
+double score_candidates(SOA_BLOCK *cands, STRUCTMODEL *sm, int *best, double *cand_scores) {
+/*
+  Returns max_h <w,phi(x_i,h)> over the candidate feature vectors of
+  one image and stores the argmax in *best. As in
+  infer_test_latent_variables(), candidates scoring exactly zero are
+  ignored; if all of them do, the first candidate is chosen. If
+  cand_scores is not NULL, it receives the score of every candidate.
+*/
+    int j;
+    double maxScore = -DBL_MAX;
+    double curr_score;
+
+    *best = -1;
+    for(j = 0; j < cands->n_vecs; j++){
+        curr_score = candidate_score(sm, &cands->vecs[j]);
+        if(cand_scores)
+            cand_scores[j] = curr_score;
+        if(curr_score != 0){
+            if(curr_score > maxScore){
+                maxScore = curr_score;
+                *best = j;
+            }
+        }
+    }
+    if(*best < 0){
+        *best = 0;
+        maxScore = candidate_score(sm, &cands->vecs[0]);
+    }
+    prof_count(PROF_IMAGES, 1);
+    prof_count(PROF_CANDIDATES, cands->n_vecs);
+    return maxScore;
+}
+
+double score_test_image(SUB_PATTERN *x_i, STRUCTMODEL *sm, int *best, double *cand_scores) {
+/*
+  Fused test-time inference and scoring for a single image, without
+  keeping any feature vector. See score_candidates().
+*/
+    double maxScore;
+    SOA_BLOCK *cands = readFeatureBlock(x_i->file_name, x_i->n_candidates);
+
+    maxScore = score_candidates(cands, sm, best, cand_scores);
+    free_soa_block(cands);
+
+    return maxScore;
+}
 
 double loss(LABEL y, LABEL ybar, LATENT_VAR hbar, STRUCT_LEARN_PARM *sparm) {
 /*
   Computes the loss of prediction (ybar,hbar) against the
-  correct label y. 
+  correct label y, i.e. 1-AP of the ranking ybar. 
 */ 
 	double l;
 	
 	long i;
-    long j;
+    long n = y.n_pos+y.n_neg;
 
-    int *ranking = malloc((y.n_pos+y.n_neg)*sizeof(int)); // stores rank of all images
-    int *sortedImages = malloc((y.n_pos+y.n_neg)*sizeof(int)); // stores list of images sorted by rank. Higher rank to lower rank 
-    
-    /* convert rank matrix to rank list*/
-    for(i = 0; i < (y.n_pos+y.n_neg); i++){
-        ranking[i] = 1; // start with lowest rank for each sample i.e 1 
-        for(j = 0; j < (y.n_pos+y.n_neg); j++){
-            if(ybar.ranking[i] > ybar.ranking[j]){
-                ranking[i] = ranking[i] + 1;
-            } 
-        }
-        sortedImages[(y.n_pos+y.n_neg)-ranking[i]] = i;
-    }  
+    double *rankScores = malloc(n*sizeof(double)); // rank of all images as sort keys
+    long *sortedImages = malloc(n*sizeof(long)); // stores list of images sorted by rank. Higher rank to lower rank 
+    if(!rankScores || !sortedImages) die("Memory error.");
     
-    int posCount = 0;
-    int totalCount = 0;
-    double precisionAti = 0;
-    int label;
-    for(i = 0; i < (y.n_pos+y.n_neg); i++){
-        label = y.labels[sortedImages[i]];
-        if(label == 1){
-            posCount++;
-            totalCount++;
-        }
-        else{
-            totalCount++;
-        }
-        if(label == 1){
-            precisionAti = precisionAti + (double)posCount/(double)totalCount;
-        }
+    /* one sort instead of counting, for every image, the images ranked below it */
+    for(i = 0; i < n; i++){
+        rankScores[i] = ybar.ranking[i];
     }
-    precisionAti = precisionAti/(double)posCount;
+    rank_by_score(rankScores, n, sortedImages);
     
-    l = 1 - precisionAti;
+    l = 1 - average_precision(sortedImages, y.labels, n);
     
-    free(ranking);
+    free(rankScores);
     free(sortedImages);
 
 	return(l);
 
 }
 
-void write_struct_model(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+double most_violated_slack(PATTERN *x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+                           LABEL *ybar_out, double *loss_out) {
 /*
-  Writes the learned weight vector sm->w to file after training. 
+  The slack loss(y,ybar,hbar) - <w,psi(x,y,h)-psi(x,ybar,hbar)> of the
+  most violated constraint, as from find_most_violated_constraint_
+  marginrescaling(), psi() and loss(). As hbar = h, both psi are sums
+  of the same image feature vectors, so the inner product is that of
+  the image scores with the difference of the psi factors and neither
+  psi is built. If ybar_out is not NULL, ybar is returned there and
+  must be freed with free_label(); if loss_out is not NULL, the loss
+  is returned there. May be called from several threads at once. 
+*/
+    long i;
+    long n = x->n_pos+x->n_neg;
+    LABEL ybar;
+    double margin = 0;
+    double lossval, slack;
+
+    double *scores = (double *) malloc(n*sizeof(double));
+    int *coeff_y = (int *) malloc(n*sizeof(int));
+    int *coeff_ybar = (int *) malloc(n*sizeof(int));
+    if(!scores || !coeff_y || !coeff_ybar) die("Memory error");
+
+    prof_begin(PROF_LOSS_AUG);
+    most_violated_ranking(x, h, sm, &ybar, scores);
+    prof_end(PROF_LOSS_AUG);
+
+    psi_coefficients(*x, y, coeff_y);
+    psi_coefficients(*x, ybar, coeff_ybar);
+    for(i = 0; i < n; i++){
+        margin += (coeff_y[i]-coeff_ybar[i])*scores[i];
+    }
+    margin /= (double)(x->n_pos*x->n_neg);
+    lossval = loss(y, ybar, *h, sparm);
+    slack = lossval-margin;
+
+    if(loss_out)
+        *loss_out = lossval;
+    if(ybar_out)
+        *ybar_out = ybar;
+    else {
+        free(ybar.ranking);
+        free(ybar.labels);
+    }
+    free(scores);
+    free(coeff_y);
+    free(coeff_ybar);
+    return slack;
+}
+
+void write_struct_model_text(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Writes sm->w as one "index:weight" line per feature, in the original
+  feature order if a feature permutation is set. 
 */
   FILE *modelfl;
+  double *w = sm->w;
   int i;
   
   modelfl = fopen(file,"w");
@@ -847,24 +1002,186 @@ void write_struct_model(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
     printf("Cannot open model file %s for output!", file);
 		exit(1);
   }
+  if (feature_permutation_length() > 0) {
+    w = (double *) my_malloc((sm->sizePsi+1)*sizeof(double));
+    unpermute_weights(w, sm->w, sm->sizePsi);
+  }
   
   for (i=1;i<sm->sizePsi+1;i++) {
-    fprintf(modelfl, "%d:%.16g\n", i, sm->w[i]);
+    fprintf(modelfl, "%d:%.16g\n", i, w[i]);
   }
   fclose(modelfl);
+  if (w != sm->w)
+    free(w);
  
 }
 
+uint64_t model_checksum(double *w, long sizePsi) {
+/*
+  64-bit FNV-1a hash of the weight bytes w[0..sizePsi]. 
+*/
+  const unsigned char *p = (const unsigned char *) w;
+  size_t i, n = (sizePsi+1)*sizeof(double);
+  uint64_t h = 14695981039346656037ULL;
+
+  for (i=0;i<n;i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return(h);
+}
+
+int write_model_weights_binary(char *file, double *w, long sizePsi) {
+/*
+  Writes header and raw weights w[0..sizePsi] in the binary model
+  format, in the original feature order if a feature permutation is
+  set. Returns non-zero on failure. 
+*/
+  static const char zeros[MODEL_ALIGN] = {0};
+  MODEL_HEADER hdr;
+  FILE *modelfl;
+  double *wp = NULL;
+  int err;
+
+  if (feature_permutation_length() > 0) {
+    wp = (double *) my_malloc((sizePsi+1)*sizeof(double));
+    unpermute_weights(wp, w, sizePsi);
+    w = wp;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = MODEL_MAGIC;
+  hdr.version = MODEL_VERSION;
+  hdr.sizePsi = sizePsi;
+  hdr.dtype = MODEL_DTYPE_FLOAT64;
+  hdr.checksum = model_checksum(w, sizePsi);
+  hdr.weights_off = MODEL_ALIGN;
+
+  modelfl = fopen(file,"wb");
+  if (modelfl==NULL) {
+    free(wp);
+    return(1);
+  }
+  fwrite(&hdr, sizeof(hdr), 1, modelfl);
+  fwrite(zeros, 1, MODEL_ALIGN-sizeof(hdr), modelfl);
+  fwrite(w, sizeof(double), sizePsi+1, modelfl);
+  err = ferror(modelfl);
+  err = (fclose(modelfl) != 0) || err;
+  free(wp);
+  return(err);
+}
+
+void write_struct_model_binary(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Writes sm->w in the binary model format read back by read_struct_model(). 
+*/
+  if (write_model_weights_binary(file, sm->w, sm->sizePsi)) {
+    printf("Cannot write model file %s!", file);
+    exit(1);
+  }
+}
+
+void write_struct_model(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Writes the learned weight vector sm->w to file after training. 
+*/
+  if(sparm->binary_model)
+    write_struct_model_binary(file, sm, sparm);
+  else
+    write_struct_model_text(file, sm, sparm);
+}
+
+STRUCTMODEL read_struct_model_binary(char *file) {
+/*
+  Maps a binary model file. sm.w points directly into the read-only
+  mapping, which is released by free_struct_model(). 
+*/
+  STRUCTMODEL sm;
+  MODEL_HEADER *hdr;
+  struct stat st;
+  char *base;
+  int fd;
+
+  fd = open(file, O_RDONLY);
+  if (fd<0) {
+    printf("Cannot open model file %s for input!", file);
+	exit(1);
+  }
+  if (fstat(fd, &st)) die("Cannot stat model file.");
+  if ((size_t) st.st_size < sizeof(MODEL_HEADER)) {
+    printf("Truncated model file %s!\n", file);
+    exit(1);
+  }
+  base = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) die("Cannot map model file.");
+
+  hdr = (MODEL_HEADER *) base;
+  if (hdr->version != MODEL_VERSION || hdr->dtype != MODEL_DTYPE_FLOAT64) {
+    printf("Unsupported model file %s (version %u, dtype %u)!\n", file, hdr->version, hdr->dtype);
+    exit(1);
+  }
+  /* both are bounded by the file size before they are combined */
+  if ((hdr->weights_off % sizeof(double)) != 0
+      || hdr->weights_off > (uint64_t) st.st_size
+      || hdr->sizePsi >= (uint64_t) st.st_size/sizeof(double)
+      || hdr->weights_off+(hdr->sizePsi+1)*sizeof(double) > (uint64_t) st.st_size) {
+    printf("Truncated model file %s!\n", file);
+    exit(1);
+  }
+
+  sm.w = (double *) (base+hdr->weights_off);
+  sm.sizePsi = hdr->sizePsi;
+  if (model_checksum(sm.w, sm.sizePsi) != hdr->checksum) {
+    printf("Checksum mismatch in model file %s!\n", file);
+    exit(1);
+  }
+  sm.map_base = base;
+  sm.map_len = st.st_size;
+  sm.w_float = NULL;
+
+  return(sm);
+}
+
+void permute_model_weights(STRUCTMODEL *sm) {
+/*
+  Brings the weights of a model just read into the order of the
+  feature permutation. A mapped binary model is copied and unmapped;
+  a model with fewer features than the permutation is padded with
+  zero weights. 
+*/
+  long n = feature_permutation_length();
+  double *w;
+
+  if (n == 0)
+    return;
+  if (n < sm->sizePsi)
+    n = sm->sizePsi;
+  w = create_dense_vector(n);
+  permute_weights(w, sm->w, sm->sizePsi);
+  if (sm->map_base)
+    munmap(sm->map_base, sm->map_len);
+  else
+    free(sm->w);
+  sm->w = w;
+  sm->sizePsi = n;
+  sm->map_base = NULL;
+  sm->map_len = 0;
+}
+
 STRUCTMODEL read_struct_model(char *file, STRUCT_LEARN_PARM *sparm) {
 /*
   Reads in the learned model parameters from file into STRUCTMODEL sm.
   The input file format has to agree with the format in write_struct_model().
+  Binary models are recognised by their magic number, anything else is
+  read as text.
 */
   STRUCTMODEL sm;
 
   FILE *modelfl;
   int sizePsi,i, fnum;
   double fweight;
+  uint32_t magic = 0;
   
   modelfl = fopen(file,"r");
   if (modelfl==NULL) {
@@ -872,6 +1189,15 @@ STRUCTMODEL read_struct_model(char *file, STRUCT_LEARN_PARM *sparm) {
 	exit(1);
   }
 
+  if (fread(&magic, sizeof(magic), 1, modelfl) == 1 && magic == MODEL_MAGIC) {
+    fclose(modelfl);
+    sm = read_struct_model_binary(file);
+    permute_model_weights(&sm);
+    init_float_weights(&sm, sparm);
+    return(sm);
+  }
+  rewind(modelfl);
+
 	sizePsi = 1;
 	sm.w = (double*)malloc((sizePsi+1)*sizeof(double));
 	for (i=0;i<sizePsi+1;i++) {
@@ -880,8 +1206,12 @@ STRUCTMODEL read_struct_model(char *file, STRUCT_LEARN_PARM *sparm) {
 	while (!feof(modelfl)) {
 		fscanf(modelfl, "%d:%lf", &fnum, &fweight);
 		if(fnum > sizePsi) {
+			sm.w = (double *)realloc(sm.w,(fnum+1)*sizeof(double));
+			/* features missing from the file have weight 0 */
+			for (i=sizePsi+1;i<fnum+1;i++) {
+				sm.w[i] = 0.0;
+			}
 			sizePsi = fnum;
-			sm.w = (double *)realloc(sm.w,(sizePsi+1)*sizeof(double));
 		}
 		sm.w[fnum] = fweight;
 	}
@@ -889,6 +1219,10 @@ STRUCTMODEL read_struct_model(char *file, STRUCT_LEARN_PARM *sparm) {
 	fclose(modelfl);
 
 	sm.sizePsi = sizePsi;
+	sm.map_base = NULL;
+	sm.map_len = 0;
+	permute_model_weights(&sm);
+	init_float_weights(&sm, sparm);
 
   return(sm);
 
@@ -899,7 +1233,11 @@ void free_struct_model(STRUCTMODEL sm, STRUCT_LEARN_PARM *sparm) {
   Free any memory malloc'ed in STRUCTMODEL sm after training. 
 */
 
-  free(sm.w);
+  if (sm.map_base)
+    munmap(sm.map_base, sm.map_len);
+  else
+    free(sm.w);
+  free(sm.w_float);
 
 }
 
@@ -908,12 +1246,7 @@ void free_pattern(PATTERN x) {
   Free any memory malloc'ed when creating pattern x. 
 */
 
-     int i;
-
-    for(i = 0; i < (x.n_pos+x.n_neg); i++){
-        free(x.x_is[i].areaRatios);
-        free(x.x_is[i].phis);
-    }  
+    /* file names and area ratios belong to the manifest of the sample */
     free(x.x_is);
 
 }
@@ -956,6 +1289,7 @@ void free_struct_sample(SAMPLE s) {
     free_latent_var(s.examples[i].h, s.examples[i].x);
   }
   free(s.examples);
+  free_manifest(s.manifest);
 
 }
 
@@ -965,11 +1299,33 @@ void parse_struct_parameters(STRUCT_LEARN_PARM *sparm) {
   via the command line. 
 */
   int i;
+  int32_t *perm;
+  long perm_n;
   
   /* set default */
   sparm->feature_size = 90112;
   sparm->rng_seed = 0;
   sparm->learning_type = 0; // default learning type set to 0, corresponding to unpooled negatives
+  sparm->binary_model = 0;
+  sparm->snapshot_keep = 0;
+  sparm->snapshot_async = 1;
+  sparm->checkpoint_every = 0;
+  sparm->resume_file[0] = '\0';
+  sparm->n_threads = 0;
+  sparm->model_list = 0;
+  sparm->server_socket[0] = '\0';
+  sparm->feature_cache = 0;
+  sparm->evaluate = 0;
+  sparm->top_k = 0;
+  sparm->box_file[0] = '\0';
+  sparm->box_top_n = 0;
+  sparm->box_format = 0;
+  sparm->permutation_file[0] = '\0';
+  sparm->float_weights = 0;
+  sparm->profile = 0;
+  sparm->telemetry_file[0] = '\0';
+  sparm->alloc_sites = 0;
+  sparm->n_strata = 1;
   
   for (i=0;(i<sparm->custom_argc)&&((sparm->custom_argv[i])[0]=='-');i++) {
     switch ((sparm->custom_argv[i])[2]) {
@@ -977,10 +1333,43 @@ void parse_struct_parameters(STRUCT_LEARN_PARM *sparm) {
       case 'f': i++; sparm->feature_size = atoi(sparm->custom_argv[i]); break;
       case 'r': i++; sparm->rng_seed = atoi(sparm->custom_argv[i]); break;
       case 't': i++; sparm->learning_type = atoi(sparm->custom_argv[i]); break;
+      case 'b': i++; sparm->binary_model = atoi(sparm->custom_argv[i]); break;
+      case 'k': i++; sparm->snapshot_keep = atoi(sparm->custom_argv[i]); break;
+      case 'w': i++; sparm->snapshot_async = atoi(sparm->custom_argv[i]); break;
+      case 'c': i++; sparm->checkpoint_every = atoi(sparm->custom_argv[i]); break;
+      case 'R': i++; strcpy(sparm->resume_file, sparm->custom_argv[i]); break;
+      case 'p': i++; sparm->n_threads = atoi(sparm->custom_argv[i]); break;
+      case 'M': i++; sparm->model_list = atoi(sparm->custom_argv[i]); break;
+      case 'S': i++; strcpy(sparm->server_socket, sparm->custom_argv[i]); break;
+      case 'H': i++; sparm->feature_cache = atoi(sparm->custom_argv[i]); break;
+      case 'E': i++; sparm->evaluate = atoi(sparm->custom_argv[i]); break;
+      case 'T': i++; sparm->top_k = atol(sparm->custom_argv[i]); break;
+      case 'B': i++; strcpy(sparm->box_file, sparm->custom_argv[i]); break;
+      case 'N': i++; sparm->box_top_n = atoi(sparm->custom_argv[i]); break;
+      case 'F': i++; sparm->box_format = atoi(sparm->custom_argv[i]); break;
+      case 'P': i++; strcpy(sparm->permutation_file, sparm->custom_argv[i]); break;
+      case 's': i++; sparm->float_weights = atoi(sparm->custom_argv[i]); break;
+      case 'v': i++; sparm->profile = atoi(sparm->custom_argv[i]); break;
+      case 'J': i++; strcpy(sparm->telemetry_file, sparm->custom_argv[i]); break;
+      case 'A': i++; sparm->alloc_sites = atoi(sparm->custom_argv[i]); break;
+      case 'K': i++; sparm->n_strata = atol(sparm->custom_argv[i]); break;
       default: printf("\nUnrecognized option %s!\n\n", sparm->custom_argv[i]); exit(0);
     }
   }
 
+  if(sparm->permutation_file[0]) {
+    perm = read_feature_permutation(sparm->permutation_file, &perm_n);
+    if(perm == NULL) {
+      printf("Error: Cannot read feature permutation %s\n", sparm->permutation_file);
+      exit(1);
+    }
+    if(perm_n > sparm->feature_size) {
+      printf("Error: Feature permutation %s has %ld features, more than --f %ld\n", sparm->permutation_file, perm_n, sparm->feature_size);
+      exit(1);
+    }
+    set_feature_permutation(perm, perm_n);
+  }
+
 }
 
 void copy_label(LABEL l1, LABEL *l2)
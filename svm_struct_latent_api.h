@@ -16,6 +16,7 @@
 
 #include "./svm_light/svm_common.h"
 #include "svm_struct_latent_api_types.h"
+#include "svm_struct_latent_soa.h"
 #include <float.h>
 
 SAMPLE read_struct_examples(char *file, STRUCT_LEARN_PARM *sparm);
@@ -24,12 +25,27 @@ void init_struct_model(SAMPLE sample, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
 void init_latent_variables(SAMPLE *sample, LEARN_PARM *lparm, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 SVECTOR *psi(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 double *classify_struct_example(PATTERN x, LATENT_VAR h, STRUCTMODEL *sm);
+int *optimumNegLocations(PATTERN x, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores);
+void encodeRanking(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap, int *optimumLocNegImg);
+void findOptimumNegLocations(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap);
+int img_score_comp(const void *a, const void *b);
+void die(const char *message);
 void find_most_violated_constraint_marginrescaling(PATTERN *x, LABEL y, LATENT_VAR *h, LABEL *ybar, LATENT_VAR *hbar, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+double most_violated_slack(PATTERN *x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+                           LABEL *ybar_out, double *loss_out);
 //LATENT_VAR infer_latent_variables(PATTERN x, LABEL y, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
 void infer_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int outer_iter);
 double loss(LABEL y, LABEL ybar, LATENT_VAR hbar, STRUCT_LEARN_PARM *sparm);
 void write_struct_model(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+void write_struct_model_text(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+void write_struct_model_binary(char *file, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+int write_model_weights_binary(char *file, double *w, long sizePsi);
+uint64_t model_checksum(double *w, long sizePsi);
 STRUCTMODEL read_struct_model(char *file, STRUCT_LEARN_PARM *sparm);
+void permute_model_weights(STRUCTMODEL *sm);
+void init_float_weights(STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+void refresh_float_weights(STRUCTMODEL *sm);
+double candidate_score(STRUCTMODEL *sm, SVECTOR_SOA *v);
 void free_struct_model(STRUCTMODEL sm, STRUCT_LEARN_PARM *sparm);
 void free_pattern(PATTERN x);
 void free_label(LABEL y);
@@ -42,6 +58,12 @@ void print_label(LABEL l, FILE *flabel);
 
 void mine_negative_latent_variables(PATTERN x, LATENT_VAR *h, STRUCTMODEL *sm);
 void infer_test_latent_variables(PATTERN x, LABEL y, LATENT_VAR *h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+double score_test_image(SUB_PATTERN *x_i, STRUCTMODEL *sm, int *best, double *cand_scores);
+double score_candidates(SOA_BLOCK *cands, STRUCTMODEL *sm, int *best, double *cand_scores);
+SVECTOR *parse_feature_line(char *line);
+SVECTOR **read_feature_file(char *feature_file, int n_fvecs);
+SVECTOR **readFeatures(char *feature_file, int n_fvecs);
+SOA_BLOCK *readFeatureBlock(char *feature_file, int n_fvecs);
 SAMPLE read_struct_test_examples(char *file, STRUCT_LEARN_PARM *sparm);
 
 
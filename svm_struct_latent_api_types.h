@@ -15,6 +15,7 @@
 /************************************************************************/
 
 # include "svm_light/svm_common.h"
+# include "svm_struct_latent_manifest.h"
 
 typedef struct imgScore{
     int img_idx;
@@ -27,9 +28,8 @@ typedef struct sub_pattern {
   /*
     Type definition for input pattern x
   */
-  char file_name[1000];
-  int *areaRatios;
-  SVECTOR **phis;
+  char *file_name;     /* points into the manifest string pool */
+  int *areaRatios;     /* points into the manifest area ratios, NULL for negatives */
   int n_candidates;
   int label;
     
@@ -87,6 +87,7 @@ typedef struct example {
 typedef struct sample {
   int n;
   EXAMPLE *examples;
+  MANIFEST *manifest;  /* owns file names and area ratios of all examples */
 
 } SAMPLE;
 
@@ -98,8 +99,30 @@ typedef struct structmodel {
   /* other information that is needed for the stuctural model can be
      added here, e.g. the grammar rules for NLP parsing */
   long n;             /* number of examples */
+  void *map_base;     /* non-NULL if w points into a mapped binary model */
+  size_t map_len;
+  float *w_float;     /* single precision copy of w for scoring candidates,
+                         NULL if candidates are scored with w */
 } STRUCTMODEL;
 
+#define MODEL_MAGIC         0x4d53534cU  /* "LSSM" in little endian */
+#define MODEL_VERSION       1
+#define MODEL_DTYPE_FLOAT64 1
+#define MODEL_ALIGN         64
+
+/* Header of a binary model file. It is followed, at offset weights_off,
+   by the weights w[0..sizePsi] as raw doubles in host byte order. The
+   checksum is the 64-bit FNV-1a hash of these weight bytes. */
+typedef struct model_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sizePsi;
+  uint32_t dtype;
+  uint32_t reserved;
+  uint64_t checksum;
+  uint64_t weights_off;
+} MODEL_HEADER;
+
 
 typedef struct struct_learn_parm {
   double epsilon;              /* precision for which to solve
@@ -108,7 +131,7 @@ typedef struct struct_learn_parm {
 				  accumulate before recomputing the QP
 				  solution */
   double C;                    /* trade-off between margin and loss */
-  char   custom_argv[20][1000]; /* string set with the -u command line option */
+  char   custom_argv[64][1000]; /* string set with the -u command line option */
   int    custom_argc;          /* number of -u command line options */
   int    slack_norm;           /* norm to use in objective function
                                   for slack variables; 1 -> L1-norm, 
@@ -128,6 +151,33 @@ typedef struct struct_learn_parm {
 
   int learning_type;
   int min_area_ratios[6];
+
+  int binary_model;           /* write the final model in binary format */
+  int snapshot_keep;          /* number of per-iteration snapshots to keep, 0 keeps all */
+  int snapshot_async;         /* write snapshots on a background thread */
+  int checkpoint_every;       /* write a training checkpoint every N outer iterations, 0 disables */
+  char resume_file[1000];     /* checkpoint to resume training from, empty if none */
+  int n_threads;              /* worker threads, 0 uses all online CPUs */
+  int model_list;             /* classify: the model file lists one model per line */
+  char server_socket[1000];   /* classify: serve requests on this Unix socket, empty if none */
+  int feature_cache;          /* classify server: feature files kept in memory, 0 disables */
+  int evaluate;               /* classify: report AP, P@k and the PR curve of the scores */
+  long top_k;                 /* classify: write only the K best images, 0 writes all */
+  char box_file[1000];        /* classify: best box table of every image, empty if none */
+  int box_top_n;              /* classify: candidate scores per image in the box table */
+  int box_format;             /* classify: box table as CSV (0) or binary (1) */
+  char permutation_file[1000]; /* feature permutation applied on read, empty if none */
+  int float_weights;          /* score candidates with a float copy of w; classify: 2
+                                 also scores with w and reports the agreement */
+  int profile;                /* print phase times and counters per ACS and outer
+                                 iteration, 2: also per cutting plane */
+  char telemetry_file[1000];  /* JSON-lines progress events to this file or file
+                                 descriptor number, empty if none */
+  int alloc_sites;            /* track heap blocks and report the N sites with
+                                 the most live bytes per outer iteration, 0: off */
+  long n_strata;              /* split the training images into N examples with
+                                 the same share of positives and negatives,
+                                 each its own ranking, 1: one example */
   
 } STRUCT_LEARN_PARM;
 
@@ -0,0 +1,234 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_checkpoint.c                                     */
+/*                                                                      */
+/*   Checkpointing of the complete training state of Latent             */
+/*   SVM^struct: weight vector, latent assignments with their feature   */
+/*   vectors, valid examples of self-paced learning and the scalar      */
+/*   state of the outer loop.                                           */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_checkpoint.h"
+
+typedef struct checkpoint_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sizePsi;
+  uint64_t n_examples;
+  int32_t  outer_iter;
+  int32_t  latent_update;
+  int32_t  stop_crit;
+  int32_t  reserved;
+  double   spl_weight;
+  double   last_primal_obj;
+} CHECKPOINT_HEADER;
+
+typedef struct checkpoint_file {
+  FILE     *fp;
+  uint64_t hash;   /* FNV-1a over everything written so far */
+} CHECKPOINT_FILE;
+
+static void ckpt_write(CHECKPOINT_FILE *cf, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  size_t i;
+  for(i = 0; i < size; i++) {
+    cf->hash ^= p[i];
+    cf->hash *= 1099511628211ULL;
+  }
+  fwrite(data, 1, size, cf->fp);
+}
+
+static uint64_t ckpt_hash(const char *data, size_t size)
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+  for(i = 0; i < size; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  return(h);
+}
+
+static void ckpt_write_svector(CHECKPOINT_FILE *cf, SVECTOR *vec)
+     /* only the first SVECTOR of a list is stored; latent feature
+        vectors are single vectors read from the feature files */
+{
+  uint32_t nwords = 0, pad = 0;
+  double factor = 0.0;
+
+  if(vec) {
+    while(vec->words[nwords].wnum) nwords++;
+    nwords++;  /* keep the terminating zero */
+    factor = vec->factor;
+  }
+  ckpt_write(cf, &nwords, sizeof(nwords));
+  ckpt_write(cf, &pad, sizeof(pad));
+  ckpt_write(cf, &factor, sizeof(factor));
+  if(nwords)
+    ckpt_write(cf, vec->words, nwords*sizeof(WORD));
+}
+
+int write_checkpoint(char *file, TRAINING_STATE *st, double *w, long sizePsi,
+                     SAMPLE *sample, int *valid_examples)
+     /* writes to file.tmp and renames it, so that the previous
+        checkpoint stays intact until the new one is complete */
+{
+  CHECKPOINT_FILE cf;
+  CHECKPOINT_HEADER hdr;
+  char tmpfile[1100];
+  uint64_t n_imgs;
+  int32_t valid;
+  long i, j;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CHECKPOINT_MAGIC;
+  hdr.version = CHECKPOINT_VERSION;
+  hdr.sizePsi = sizePsi;
+  hdr.n_examples = sample->n;
+  hdr.outer_iter = st->outer_iter;
+  hdr.latent_update = st->latent_update;
+  hdr.stop_crit = st->stop_crit;
+  hdr.spl_weight = st->spl_weight;
+  hdr.last_primal_obj = st->last_primal_obj;
+
+  sprintf(tmpfile, "%s.tmp", file);
+  cf.fp = fopen(tmpfile, "wb");
+  if(cf.fp == NULL) {
+    printf("Warning: cannot open checkpoint file %s for output\n", tmpfile);
+    return(1);
+  }
+  cf.hash = 14695981039346656037ULL;
+
+  ckpt_write(&cf, &hdr, sizeof(hdr));
+  ckpt_write(&cf, w, (sizePsi+1)*sizeof(double));
+  for(i = 0; i < sample->n; i++) {
+    valid = valid_examples[i];
+    ckpt_write(&cf, &valid, sizeof(valid));
+  }
+  for(i = 0; i < sample->n; i++) {
+    EXAMPLE *ex = &sample->examples[i];
+    n_imgs = ex->x.n_pos+ex->x.n_neg;
+    ckpt_write(&cf, &n_imgs, sizeof(n_imgs));
+    for(j = 0; j < (long) n_imgs; j++) {
+      int32_t h = ex->h.h_is[j];
+      ckpt_write(&cf, &h, sizeof(h));
+    }
+    for(j = 0; j < (long) n_imgs; j++) {
+      ckpt_write_svector(&cf, ex->h.phi_h_is[j]);
+    }
+  }
+  fwrite(&cf.hash, sizeof(cf.hash), 1, cf.fp);
+
+  if(ferror(cf.fp) | fclose(cf.fp) | rename(tmpfile, file)) {
+    printf("Warning: cannot write checkpoint file %s\n", file);
+    remove(tmpfile);
+    return(1);
+  }
+  return(0);
+}
+
+static void ckpt_corrupt(char *file)
+{
+  printf("Error: checkpoint file %s is corrupt or does not match the training data\n", file);
+  exit(1);
+}
+
+static const char *ckpt_take(char *file, const char **cur, const char *end, size_t size)
+{
+  const char *p = *cur;
+  if((size_t)(end-p) < size) ckpt_corrupt(file);
+  *cur = p+size;
+  return(p);
+}
+
+void read_checkpoint(char *file, TRAINING_STATE *st, double *w, long sizePsi,
+                     SAMPLE *sample, int *valid_examples)
+     /* restores the state written by write_checkpoint(). The latent
+        variables of every example are allocated here, so this replaces
+        init_latent_variables(). */
+{
+  CHECKPOINT_HEADER hdr;
+  struct stat sb;
+  const char *base, *cur, *end;
+  uint64_t hash, n_imgs;
+  uint32_t nwords;
+  double factor;
+  int32_t v;
+  long i, j;
+  int fd;
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    printf("Error: Cannot open checkpoint file %s\n", file);
+    exit(1);
+  }
+  if(fstat(fd, &sb) || (size_t) sb.st_size < sizeof(hdr)+sizeof(hash)) ckpt_corrupt(file);
+  base = (const char *) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) ckpt_corrupt(file);
+
+  end = base+sb.st_size-sizeof(hash);
+  memcpy(&hash, end, sizeof(hash));
+  if(hash != ckpt_hash(base, end-base)) ckpt_corrupt(file);
+
+  cur = base;
+  memcpy(&hdr, ckpt_take(file, &cur, end, sizeof(hdr)), sizeof(hdr));
+  if((hdr.magic != CHECKPOINT_MAGIC) || (hdr.version != CHECKPOINT_VERSION)
+     || (hdr.sizePsi != (uint64_t) sizePsi) || (hdr.n_examples != (uint64_t) sample->n))
+    ckpt_corrupt(file);
+  st->outer_iter = hdr.outer_iter;
+  st->latent_update = hdr.latent_update;
+  st->stop_crit = hdr.stop_crit;
+  st->spl_weight = hdr.spl_weight;
+  st->last_primal_obj = hdr.last_primal_obj;
+
+  memcpy(w, ckpt_take(file, &cur, end, (sizePsi+1)*sizeof(double)), (sizePsi+1)*sizeof(double));
+  for(i = 0; i < sample->n; i++) {
+    memcpy(&v, ckpt_take(file, &cur, end, sizeof(v)), sizeof(v));
+    valid_examples[i] = v;
+  }
+
+  for(i = 0; i < sample->n; i++) {
+    EXAMPLE *ex = &sample->examples[i];
+    memcpy(&n_imgs, ckpt_take(file, &cur, end, sizeof(n_imgs)), sizeof(n_imgs));
+    if(n_imgs != (uint64_t)(ex->x.n_pos+ex->x.n_neg)) ckpt_corrupt(file);
+    ex->h.h_is = (int *) my_malloc(n_imgs*sizeof(int));
+    ex->h.phi_h_is = (SVECTOR **) my_malloc(n_imgs*sizeof(SVECTOR *));
+    for(j = 0; j < (long) n_imgs; j++) {
+      memcpy(&v, ckpt_take(file, &cur, end, sizeof(v)), sizeof(v));
+      ex->h.h_is[j] = v;
+    }
+    for(j = 0; j < (long) n_imgs; j++) {
+      memcpy(&nwords, ckpt_take(file, &cur, end, sizeof(nwords)), sizeof(nwords));
+      ckpt_take(file, &cur, end, sizeof(uint32_t));
+      memcpy(&factor, ckpt_take(file, &cur, end, sizeof(factor)), sizeof(factor));
+      if(nwords) {
+        /* words are 4-byte aligned in the file, as WORD requires */
+        WORD *words = (WORD *) ckpt_take(file, &cur, end, nwords*sizeof(WORD));
+        if(words[nwords-1].wnum != 0) ckpt_corrupt(file);
+        ex->h.phi_h_is[j] = create_svector(words, "", factor);
+      }
+      else {
+        ex->h.phi_h_is[j] = NULL;
+      }
+    }
+  }
+  if(cur != end) ckpt_corrupt(file);
+
+  munmap((void *) base, sb.st_size);
+}
@@ -0,0 +1,37 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_checkpoint.h                                     */
+/*                                                                      */
+/*   Checkpointing of the complete training state of Latent             */
+/*   SVM^struct, so that an interrupted run can be resumed exactly.     */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_CHECKPOINT
+#define SVM_STRUCT_LATENT_CHECKPOINT
+
+#define CHECKPOINT_MAGIC   0x4b43534cU  /* "LSCK" in little endian */
+#define CHECKPOINT_VERSION 1
+
+/* Scalar state of the outer loop in main(). The cutting-plane working
+   set and its alphas are local to each inner solve and empty between
+   outer iterations, which is where checkpoints are taken. */
+typedef struct training_state {
+  int    outer_iter;        /* next outer iteration to run */
+  int    latent_update;
+  int    stop_crit;
+  double spl_weight;
+  double last_primal_obj;
+} TRAINING_STATE;
+
+int  write_checkpoint(char *file, TRAINING_STATE *st, double *w, long sizePsi,
+                      SAMPLE *sample, int *valid_examples);
+void read_checkpoint(char *file, TRAINING_STATE *st, double *w, long sizePsi,
+                     SAMPLE *sample, int *valid_examples);
+
+#endif
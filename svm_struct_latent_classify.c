@@ -15,21 +15,176 @@
 /************************************************************************/
 
 #include <stdio.h>
+#include <string.h>
 #include "svm_struct_latent_api.h"
+#include "svm_struct_latent_score.h"
+#include "svm_struct_latent_server.h"
+#include "svm_struct_latent_eval.h"
+#include "svm_struct_latent_output.h"
 
 void read_input_parameters(int argc, char **argv, char *testfile, char *modelfile, char *scorefile, STRUCT_LEARN_PARM *sparm);
 
+void evaluate_scores(double *scores, long stride, int *labels, long n, char *scorefile) {
+/*
+  Reports AP and precision at k of the scores and writes the
+  precision-recall curve to scorefile.pr.
+*/
+  AP_EVAL *ev;
+  char prfile[1100];
 
-int main(int argc, char* argv[]) {
-  double *scores = NULL;
+  ev = evaluate_ranking(scores, stride, labels, n);
+  print_ap_eval(ev);
+  if(snprintf(prfile, sizeof(prfile), "%s.pr", scorefile) < (int) sizeof(prfile))
+    write_pr_curve(prfile, ev);
+  else
+    printf("Error: precision-recall file name for %s is too long\n", scorefile);
+  free_ap_eval(ev);
+}
+
+void write_top_k(SAMPLE *testsample, STRUCTMODEL *model, STRUCT_LEARN_PARM *sparm, char *scorefile) {
+/*
+  Writes "image best_box score file_name" for the K best images, best
+  first. Images of a packed manifest with candidate norms are pruned
+  by their score bound without reading their features.
+*/
+  PATTERN *x = &testsample->examples[0].x;
+  double *max_norms = testsample->manifest ? testsample->manifest->max_norms : NULL;
+  OUT_BUFFER *ob;
+  TOP_K *tk;
+  char *name;
   long i;
 
+  if(!max_norms)
+    printf("No candidate norms in the manifest, scoring all images.\n");
+  tk = score_top_k(x, model, max_norms, sparm->top_k, sparm->n_threads);
+  ob = open_out_buffer(scorefile);
+  if(!ob)
+    exit(1);
+  for(i = 0; i < tk->k; i++) {
+    out_long(ob, tk->img[i]);
+    out_char(ob, ' ');
+    out_long(ob, tk->best[i]);
+    out_char(ob, ' ');
+    out_fixed(ob, tk->scores[i], 5);
+    out_char(ob, ' ');
+    name = x->x_is[tk->img[i]].file_name;
+    out_bytes(ob, name, strlen(name));
+    out_char(ob, '\n');
+  }
+  if(close_out_buffer(ob))
+    printf("Error: cannot write score file %s\n", scorefile);
+  printf("Top %ld: %ld images scored, %ld pruned\n", tk->k, tk->n_scored, tk->n_pruned);
+  free_top_k(tk);
+}
+
+void compare_float_scoring(PATTERN *x, STRUCTMODEL *model, TEST_SCORES *ts, int *labels, int n_threads) {
+/*
+  Scores the test set again with the single precision copy of w and
+  reports how well its best boxes, ranking and AP agree with the
+  scores ts of the double precision weights.
+*/
+  TEST_SCORES *tf;
+  long *order_d, *order_f;
+  long i, n = ts->n_imgs, same_box = 0, same_rank = 0;
+  double diff, max_diff = 0;
+
+  tf = score_test_images(x, model, 0, n_threads);
+  order_d = (long *) my_malloc(n*sizeof(long));
+  order_f = (long *) my_malloc(n*sizeof(long));
+  rank_by_score(ts->scores, n, order_d);
+  rank_by_score(tf->scores, n, order_f);
+  for(i = 0; i < n; i++) {
+    same_box += (tf->best[i] == ts->best[i]);
+    same_rank += (order_f[i] == order_d[i]);
+    diff = tf->scores[i]-ts->scores[i];
+    if(diff < 0) diff = -diff;
+    if(diff > max_diff) max_diff = diff;
+  }
+  printf("Float weights: best box agrees on %ld of %ld images, rank on %ld, max score difference %.3g\n",
+         same_box, n, same_rank, max_diff);
+  printf("Float weights: AP %.6f, double weights: AP %.6f\n",
+         average_precision(order_f, labels, n), average_precision(order_d, labels, n));
+  free(order_d);
+  free(order_f);
+  free_test_scores(tf);
+}
+
+int classify_model_list(char *testfile, char *listfile, char *scoreprefix, STRUCT_LEARN_PARM *sparm) {
+/*
+  Scores the test set under every model named in listfile, one per
+  line, reading each feature file once. The best box and score of
+  every image under model k are written to scoreprefix.%04d, in the
+  order of the list.
+*/
+  MODEL_BANK *bank;
+  TEST_SCORES *ts;
+  SAMPLE testsample;
+  char scorefile[1100];
+  OUT_BUFFER *ob;
+  long i, k;
+
+  printf("Reading models..."); fflush(stdout);
+  bank = read_model_bank(listfile, sparm->feature_size, sparm);
+  printf("done (%ld models).\n", bank->n_models);
+
+	printf("Reading test examples..."); fflush(stdout);
+  testsample = read_struct_test_examples(testfile,sparm);
+	printf("done.\n");
+
+  ts = score_test_images_bank(&testsample.examples[0].x, bank, sparm->n_threads);
+  for(k = 0; k < bank->n_models; k++) {
+    if(snprintf(scorefile, sizeof(scorefile), "%s.%04ld", scoreprefix, k) >= (int) sizeof(scorefile)) {
+      printf("Error: score file name for %s is too long\n", scoreprefix);
+      exit(1);
+    }
+    ob = open_out_buffer(scorefile);
+    if(!ob)
+      exit(1);
+    for(i = 0; i < ts->n_imgs; i++) {
+      out_long(ob, ts->best[i*ts->n_models+k]);
+      out_char(ob, ' ');
+      out_fixed(ob, ts->scores[i*ts->n_models+k], 5);
+      out_char(ob, '\n');
+    }
+    if(close_out_buffer(ob))
+      printf("Error: cannot write score file %s\n", scorefile);
+    if(sparm->evaluate) {
+      printf("Model %ld (%s):\n", k, bank->files[k]);
+      evaluate_scores(ts->scores+k, ts->n_models, testsample.examples[0].y.labels, ts->n_imgs, scorefile);
+    }
+  }
+
+  free_test_scores(ts);
+  free_model_bank(bank);
+  return(0);
+}
+
+
+int serve_model(char *modelfile, STRUCT_LEARN_PARM *sparm) {
+/*
+  Keeps the model resident and answers scoring requests on the Unix
+  socket given with --S until a client shuts the server down.
+*/
+  STRUCTMODEL model;
+  int ret;
+
+  printf("Reading model..."); fflush(stdout);
+  model = read_struct_model(modelfile, sparm);
+  printf("done.\n");
+
+  ret = run_score_server(sparm->server_socket, &model, sparm);
+  free_struct_model(model, sparm);
+  return(ret);
+}
+
+int main(int argc, char* argv[]) {
+  TEST_SCORES *ts;
+
   char testfile[1024];
   char modelfile[1024];
     char scoreFile[1024];
-    FILE *fscore;
 
-  STRUCTMODEL model;
+  STRUCTMODEL model, scoring_model;
   STRUCT_LEARN_PARM sparm;
   LEARN_PARM lparm;
   KERNEL_PARM kparm;
@@ -38,7 +193,10 @@ int main(int argc, char* argv[]) {
 
   /* read input parameters */
   read_input_parameters(argc,argv,testfile,modelfile,scoreFile,&sparm);
-	fscore = fopen(scoreFile,"w");
+  if(sparm.model_list)
+    return(classify_model_list(testfile, modelfile, scoreFile, &sparm));
+  if(sparm.server_socket[0])
+    return(serve_model(modelfile, &sparm));
 
   /* read model file */
   printf("Reading model..."); fflush(stdout);
@@ -50,15 +208,31 @@ int main(int argc, char* argv[]) {
   testsample = read_struct_test_examples(testfile,&sparm);
 	printf("done.\n");
 
+  /* before init_struct_model(), which sets sizePsi to --f: the bound
+     of top-K retrieval takes the norm of the weights the model has */
+  if(sparm.top_k > 0) {
+    write_top_k(&testsample, &model, &sparm, scoreFile);
+    free_struct_model(model,&sparm);
+    return(0);
+  }
+
   init_struct_model(testsample,&model,&sparm,&lparm,&kparm);
 
-  infer_test_latent_variables(testsample.examples[0].x, testsample.examples[0].y, &testsample.examples[0].h, &model, &sparm);
-  scores = classify_struct_example(testsample.examples[0].x, testsample.examples[0].h,&model);
-  for(i = 0; i < (testsample.examples[0].n_pos+testsample.examples[0].n_neg); i++){
-    fprintf(fscore, "%0.5f\n", scores[i]);
-  }
-    
-  fclose(fscore);
+  /* latent inference and final scoring in one parallel pass; to
+     compare, the written scores are those of the double weights */
+  scoring_model = model;
+  if(sparm.float_weights == 2)
+    scoring_model.w_float = NULL;
+  ts = score_test_images(&testsample.examples[0].x, &scoring_model, sparm.box_file[0] ? sparm.box_top_n : 0, sparm.n_threads);
+  if(sparm.float_weights == 2)
+    compare_float_scoring(&testsample.examples[0].x, &model, ts, testsample.examples[0].y.labels, sparm.n_threads);
+  if(write_score_file(scoreFile, ts))
+    printf("Error: cannot write score file %s\n", scoreFile);
+  if(sparm.box_file[0] && write_box_table(sparm.box_file, ts, sparm.box_format))
+    printf("Error: cannot write box table %s\n", sparm.box_file);
+  if(sparm.evaluate)
+    evaluate_scores(ts->scores, 1, testsample.examples[0].y.labels, ts->n_imgs, scoreFile);
+  free_test_scores(ts);
 
   //free_struct_sample(testsample); TODO: Uncomment this, and fix this function. It frees h.h_is which was never allocated while classifying.
   free_struct_model(model,&sparm);
@@ -96,4 +270,8 @@ void read_input_parameters(int argc, char **argv, char *testfile, char *modelfil
 
   parse_struct_parameters(sparm);
 
+  /* a server is given only the model file */
+  if(sparm->server_socket[0])
+    strcpy(modelfile, testfile);
+
 }
@@ -0,0 +1,176 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_eval.c                                           */
+/*                                                                      */
+/*   Ranking evaluation for Latent SVM^struct. Images are ranked with   */
+/*   one LSD radix sort on the bit patterns of their scores; average    */
+/*   precision, precision at k and the precision-recall curve then      */
+/*   follow from a single pass over the ranking.                        */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_eval.h"
+#include "svm_struct_latent_profile.h"
+
+typedef struct radix_item {
+  uint64_t key;
+  long     idx;
+} RADIX_ITEM;
+
+static uint64_t descending_key(double score)
+     /* unsigned key whose increasing order is the decreasing order of
+        the scores; -0 and +0 map to the same key */
+{
+  uint64_t bits;
+
+  if(score == 0)
+    score = 0;
+  memcpy(&bits, &score, sizeof(bits));
+  bits = (bits & 0x8000000000000000ULL) ? ~bits : (bits | 0x8000000000000000ULL);
+  return(~bits);
+}
+
+void rank_by_score(double *scores, long n, long *order)
+     /* order[r] is the index of the image at rank r, highest score
+        first. The sort is stable, so equal scores keep input order. */
+{
+  RADIX_ITEM *a, *b, *t;
+  long count[256];
+  long i, sum, c;
+  int shift, d;
+
+  a = (RADIX_ITEM *) my_malloc(n*sizeof(RADIX_ITEM));
+  b = (RADIX_ITEM *) my_malloc(n*sizeof(RADIX_ITEM));
+  for(i = 0; i < n; i++) {
+    a[i].key = descending_key(scores[i]);
+    a[i].idx = i;
+  }
+  for(shift = 0; shift < 64; shift += 8) {
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < n; i++)
+      count[(a[i].key >> shift) & 0xff]++;
+    if((n == 0) || (count[(a[0].key >> shift) & 0xff] == n))
+      continue;  /* all keys share this digit */
+    for(sum = 0, d = 0; d < 256; d++) {
+      c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+    for(i = 0; i < n; i++)
+      b[count[(a[i].key >> shift) & 0xff]++] = a[i];
+    t = a; a = b; b = t;
+  }
+  for(i = 0; i < n; i++)
+    order[i] = a[i].idx;
+  free(a);
+  free(b);
+}
+
+double average_precision(long *order, int *labels, long n)
+     /* mean of the precision at the rank of every positive image */
+{
+  long i, posCount = 0;
+  double precisionAti = 0;
+
+  for(i = 0; i < n; i++) {
+    if(labels[order[i]] == 1) {
+      posCount++;
+      precisionAti = precisionAti + (double)posCount/(double)(i+1);
+    }
+  }
+  return(precisionAti/(double)posCount);
+}
+
+AP_EVAL *evaluate_ranking(double *scores, long stride, int *labels, long n)
+     /* ranks the n images whose scores are scores[0], scores[stride],
+        ... against their labels */
+{
+  AP_EVAL *ev = (AP_EVAL *) my_malloc(sizeof(AP_EVAL));
+  double t0 = prof_now(), t1;
+  double *s = scores;
+  long i;
+
+  ev->n = n;
+  ev->order = (long *) my_malloc(n*sizeof(long));
+  ev->tp = (long *) my_malloc(n*sizeof(long));
+  if(stride != 1) {
+    s = (double *) my_malloc(n*sizeof(double));
+    for(i = 0; i < n; i++)
+      s[i] = scores[i*stride];
+  }
+  rank_by_score(s, n, ev->order);
+  if(s != scores)
+    free(s);
+  t1 = prof_now();
+
+  ev->n_pos = 0;
+  for(i = 0; i < n; i++) {
+    if(labels[ev->order[i]] == 1)
+      ev->n_pos++;
+    ev->tp[i] = ev->n_pos;
+  }
+  ev->ap = average_precision(ev->order, labels, n);
+
+  ev->sort_seconds = t1-t0;
+  ev->eval_seconds = prof_now()-t0;
+  return(ev);
+}
+
+double precision_at(AP_EVAL *ev, long k)
+{
+  if(k > ev->n) k = ev->n;
+  if(k < 1) return(0);
+  return((double) ev->tp[k-1]/(double) k);
+}
+
+void print_ap_eval(AP_EVAL *ev)
+{
+  static const long ks[] = { 10, 20, 50, 100, 200, 500, 1000, 0 };
+  int i;
+
+  printf("AP: %.5f (%ld images, %ld positive)\n", ev->ap, ev->n, ev->n_pos);
+  for(i = 0; ks[i] && (ks[i] <= ev->n); i++)
+    printf("P@%ld: %.5f\n", ks[i], precision_at(ev, ks[i]));
+  printf("Ranked in %.6f sec, evaluated in %.6f sec\n", ev->sort_seconds, ev->eval_seconds);
+}
+
+int write_pr_curve(char *file, AP_EVAL *ev)
+     /* writes "rank recall precision" at the rank of every positive
+        image, which are the corners of the precision-recall curve */
+{
+  FILE *fp = fopen(file, "w");
+  long i;
+
+  if(fp == NULL) {
+    printf("Warning: cannot open %s for output\n", file);
+    return(1);
+  }
+  for(i = 0; i < ev->n; i++) {
+    if((ev->tp[i] > 0) && ((i == 0) || (ev->tp[i] != ev->tp[i-1])))
+      fprintf(fp, "%ld %.6f %.6f\n", i+1, (double) ev->tp[i]/ev->n_pos, (double) ev->tp[i]/(i+1));
+  }
+  if(fclose(fp)) {
+    printf("Warning: cannot write %s\n", file);
+    return(1);
+  }
+  return(0);
+}
+
+void free_ap_eval(AP_EVAL *ev)
+{
+  if(!ev)
+    return;
+  free(ev->order);
+  free(ev->tp);
+  free(ev);
+}
@@ -0,0 +1,36 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_eval.h                                           */
+/*                                                                      */
+/*   Ranking evaluation for Latent SVM^struct: average precision,       */
+/*   precision at k and the precision-recall curve.                     */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_EVAL
+#define SVM_STRUCT_LATENT_EVAL
+
+typedef struct ap_eval {
+  long   n;              /* images ranked */
+  long   n_pos;          /* images with label 1 */
+  double ap;             /* average precision, NaN without positives */
+  long   *order;         /* image indices by decreasing score */
+  long   *tp;            /* tp[k]: positives among the k+1 best images */
+  double sort_seconds;
+  double eval_seconds;   /* sorting included */
+} AP_EVAL;
+
+void    rank_by_score(double *scores, long n, long *order);
+double  average_precision(long *order, int *labels, long n);
+AP_EVAL *evaluate_ranking(double *scores, long stride, int *labels, long n);
+double  precision_at(AP_EVAL *ev, long k);
+void    print_ap_eval(AP_EVAL *ev);
+int     write_pr_curve(char *file, AP_EVAL *ev);
+void    free_ap_eval(AP_EVAL *ev);
+
+#endif
@@ -0,0 +1,801 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_infer_check.c                                    */
+/*                                                                      */
+/*   Differential check of the AP loss-augmented inference routines.    */
+/*   Random score vectors, with ties and with a single positive or      */
+/*   negative image, are run through the routines of the trainer and    */
+/*   through the straightforward pairwise versions they replaced; the   */
+/*   rankings, losses and joint feature vectors must agree, and for     */
+/*   small cases the ranking must reach the most violated constraint   */
+/*   found by trying every ranking. The time spent in both versions is  */
+/*   reported side by side.                                             */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_tools.h"
+
+#define MAX_SIZES    16
+#define MAX_REPORTED 10   /* mismatches printed in full */
+
+typedef enum routine {
+  R_LOCATIONS, R_ENCODE, R_LOSS, R_PSI, R_SLACK, N_ROUTINES
+} ROUTINE;
+
+static const char *routine_names[N_ROUTINES] = {
+  "optimumNegLocations", "encodeRanking", "loss", "psi", "most_violated_slack"
+};
+
+typedef struct check_parm {
+  long     trials;
+  long     max_pos;
+  long     max_neg;
+  double   tie_prob;           /* chance that a score is drawn from a
+                                  handful of values */
+  uint64_t seed;
+  double   tolerance;
+  double   slack_tolerance;    /* relative, for sums of single precision
+                                  feature weights */
+  double   max_interleavings;  /* largest exhaustive search */
+  long     sizes[MAX_SIZES];   /* images in the timed cases */
+  int      n_sizes;
+  long     dim;                /* features of the latent vectors */
+  long     nnz;
+} CHECK_PARM;
+
+typedef struct ap_case {
+  PATTERN    x;
+  LABEL      y;                /* the ground truth ranking */
+  LATENT_VAR h;
+  double     *scores;          /* <w,phi> of every image */
+} AP_CASE;
+
+typedef struct check_stats {
+  double reference[N_ROUTINES];  /* seconds */
+  double optimized[N_ROUTINES];
+  long   calls[N_ROUTINES];
+  long   exhaustive;             /* cases checked against all rankings */
+  long   mismatches;
+} CHECK_STATS;
+
+void read_input_parameters(int argc, char **argv, CHECK_PARM *cp);
+
+/************************************************************************/
+/*   Reference versions: the pairwise implementations the trainer used  */
+/*   before counting replaced them, kept verbatim apart from names.     */
+/************************************************************************/
+
+static void encode_ranking_reference(PATTERN x, LABEL *ybar, IMG_SCORE *positiveImgScores, IMG_SCORE *negativeImgScores, int *imgIndexMap, int *optimumLocNegImg){
+    int i, j, i_prime, j_prime, oj_prime, oi_prime;
+    
+    ybar->ranking = (int *) calloc((x.n_pos+x.n_neg), sizeof(int));
+    if(!ybar->ranking) die("Memory error");
+    
+    for(i = 0; i < (x.n_pos+x.n_neg); i++){
+        for(j = i+1; j < (x.n_pos+x.n_neg); j++){        
+            if(i == j){
+                //ybar->rank_matrix[i][j] = 0;
+            }
+            else if(x.x_is[i].label == x.x_is[j].label){                
+                if(x.x_is[i].label == 1){                                 
+                    if(positiveImgScores[imgIndexMap[i]].img_score > positiveImgScores[imgIndexMap[j]].img_score){
+                        //ybar->rank_matrix[i][j] = 1;
+                        ybar->ranking[i]++;
+                        ybar->ranking[j]--;
+                    }
+                    else if(positiveImgScores[imgIndexMap[j]].img_score > positiveImgScores[imgIndexMap[i]].img_score){
+                        //ybar->rank_matrix[i][j] = -1;
+                        ybar->ranking[i]--;
+                        ybar->ranking[j]++;
+                    }
+                    else{
+                        if(i < j){
+                            //ybar->rank_matrix[i][j] = 1;
+                            ybar->ranking[i]++;
+                            ybar->ranking[j]--;
+                        }
+                        else{
+                            //ybar->rank_matrix[i][j] = -1;
+                            ybar->ranking[i]--;
+                            ybar->ranking[j]++;
+                        }
+                    }
+                }
+                else{
+                    if(negativeImgScores[imgIndexMap[i]].img_score > negativeImgScores[imgIndexMap[j]].img_score){
+                        //ybar->rank_matrix[i][j] = 1;
+                        ybar->ranking[i]++;
+                        ybar->ranking[j]--;
+                    }
+                    else if(negativeImgScores[imgIndexMap[j]].img_score > negativeImgScores[imgIndexMap[i]].img_score){
+                        //ybar->rank_matrix[i][j] = -1;
+                        ybar->ranking[i]--;
+                        ybar->ranking[j]++;
+                    }
+                    else{
+                        if(i < j){
+                            //ybar->rank_matrix[i][j] = 1;
+                            ybar->ranking[i]++;
+                            ybar->ranking[j]--;
+                        }
+                        else{
+                            //ybar->rank_matrix[i][j] = -1;
+                            ybar->ranking[i]--;
+                            ybar->ranking[j]++;
+                        }
+                    }
+                }        
+            }
+            else if((x.x_is[i].label == 1) && (x.x_is[j].label == 0)){
+                i_prime = imgIndexMap[i]+1;
+                j_prime = imgIndexMap[j]+1;
+                oj_prime = optimumLocNegImg[j_prime-1];
+                              
+                if((oj_prime - i_prime - 0.5) > 0){
+                    //ybar->rank_matrix[i][j] = 1;
+                    ybar->ranking[i]++;
+                    ybar->ranking[j]--;
+                }
+                else{
+                    //ybar->rank_matrix[i][j] = -1;
+                    ybar->ranking[i]--;
+                    ybar->ranking[j]++;
+                }
+            }
+            else if((x.x_is[i].label == 0) && (x.x_is[j].label == 1)){
+                i_prime = imgIndexMap[i]+1;
+                j_prime = imgIndexMap[j]+1;
+                oi_prime = optimumLocNegImg[i_prime-1];
+                
+                if((j_prime - oi_prime + 0.5) > 0){
+                    //ybar->rank_matrix[i][j] = 1;
+                    ybar->ranking[i]++;
+                    ybar->ranking[j]--;
+                }
+                else{
+                    //ybar->rank_matrix[i][j] = -1;
+                    ybar->ranking[i]--;
+                    ybar->ranking[j]++;
+                }
+            }                    
+        }        
+    }    
+}
+
+static SVECTOR *psi_reference(PATTERN x, LABEL y, LATENT_VAR h, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Creates the feature vector \Psi(x,y,h) and return a pointer to 
+  sparse vector SVECTOR in SVM^light format. The dimension of the 
+  feature vector returned has to agree with the dimension in sm->sizePsi. 
+*/
+    SVECTOR *fvec=NULL;
+    
+    // your code here 
+  
+    long i;
+    long j;
+    
+    double Y_ij;
+    double norm_factor;
+    int y_i_count;
+    
+    SVECTOR *temp1=NULL;
+    SVECTOR *temp2=NULL;
+    SVECTOR *temp3=NULL;
+    SVECTOR *temp4=NULL;
+    SVECTOR *temp5=NULL;
+    
+    WORD *words = (WORD *) malloc(sizeof(WORD));
+	words[0].wnum = 0;
+	words[0].weight = 0.0;
+	fvec = create_svector(words,"",1);
+	free(words);
+	
+	int *coeff = (int*) calloc((x.n_pos + x.n_neg), sizeof(int));
+
+    for(i = 0; i < (x.n_pos + x.n_neg); i++){
+        if(x.x_is[i].label == 1){  
+            y_i_count = 0; 
+            
+            for(j = 0; j < (x.n_pos + x.n_neg); j++){
+                if(x.x_is[j].label == 0){
+                    if(y.ranking[i] > y.ranking[j]){
+                        Y_ij = 1;
+                    }
+                    else{
+                        Y_ij = -1;
+                    }
+                    if(Y_ij == 1){
+                        coeff[j]--;              
+                        y_i_count++;
+                    }
+                    else{
+                        coeff[j]++;                      
+                        y_i_count--;
+                    }                                                      
+                }
+            }
+            temp2 = smult_s(h.phi_h_is[i], y_i_count);
+            temp3 = add_ss(fvec, temp2);
+            free_svector(temp2);
+            free_svector(fvec);
+            fvec = temp3;
+        }        
+    }
+    
+    for(j = 0; j < (x.n_pos + x.n_neg); j++){
+        if(x.x_is[j].label == 0){
+            temp1 = smult_s(h.phi_h_is[j], coeff[j]);
+            temp5 = add_ss(fvec, temp1);
+            free_svector(temp1);
+            free_svector(fvec);
+            fvec = temp5; 
+        }
+    }
+
+    norm_factor = 1/(double)(x.n_pos*x.n_neg);
+    temp4 = smult_s(fvec, norm_factor);
+    free_svector(fvec);
+    free(coeff);
+    fvec = temp4;
+     
+    return(fvec);
+}
+
+static double loss_reference(LABEL y, LABEL ybar, LATENT_VAR hbar, STRUCT_LEARN_PARM *sparm) {
+/*
+  Computes the loss of prediction (ybar,hbar) against the
+  correct label y. 
+*/ 
+	double l;
+	
+	long i;
+    long j;
+
+    int *ranking = malloc((y.n_pos+y.n_neg)*sizeof(int)); // stores rank of all images
+    int *sortedImages = malloc((y.n_pos+y.n_neg)*sizeof(int)); // stores list of images sorted by rank. Higher rank to lower rank 
+    
+    /* convert rank matrix to rank list*/
+    for(i = 0; i < (y.n_pos+y.n_neg); i++){
+        ranking[i] = 1; // start with lowest rank for each sample i.e 1 
+        for(j = 0; j < (y.n_pos+y.n_neg); j++){
+            if(ybar.ranking[i] > ybar.ranking[j]){
+                ranking[i] = ranking[i] + 1;
+            } 
+        }
+        sortedImages[(y.n_pos+y.n_neg)-ranking[i]] = i;
+    }  
+    
+    int posCount = 0;
+    int totalCount = 0;
+    double precisionAti = 0;
+    int label;
+    for(i = 0; i < (y.n_pos+y.n_neg); i++){
+        label = y.labels[sortedImages[i]];
+        if(label == 1){
+            posCount++;
+            totalCount++;
+        }
+        else{
+            totalCount++;
+        }
+        if(label == 1){
+            precisionAti = precisionAti + (double)posCount/(double)totalCount;
+        }
+    }
+    precisionAti = precisionAti/(double)posCount;
+    
+    l = 1 - precisionAti;
+    
+    free(ranking);
+    free(sortedImages);
+
+	return(l);
+
+}
+
+static double slack_reference(AP_CASE *c, STRUCTMODEL *sm)
+     /* the slack as update_valid_examples() computed it, from both psi */
+{
+  LABEL ybar;
+  LATENT_VAR hbar;
+  SVECTOR *f, *fy, *fybar;
+  double slack;
+  long j;
+
+  find_most_violated_constraint_marginrescaling(&c->x, c->y, &c->h, &ybar, &hbar, sm, NULL);
+  fy = psi(c->x, c->y, c->h, sm, NULL);
+  fybar = psi(c->x, ybar, hbar, sm, NULL);
+  slack = loss(c->y, ybar, hbar, NULL);
+  for(f = fy; f; f = f->next)
+    for(j = 0; f->words[j].wnum; j++)
+      slack -= sm->w[f->words[j].wnum]*f->words[j].weight;
+  for(f = fybar; f; f = f->next)
+    for(j = 0; f->words[j].wnum; j++)
+      slack += sm->w[f->words[j].wnum]*f->words[j].weight;
+  free_svector(fy);
+  free_svector(fybar);
+  free_label(ybar);
+  free_latent_var(hbar, c->x);
+  return(slack);
+}
+
+/************************************************************************/
+/*   Random cases                                                        */
+/************************************************************************/
+
+static void make_case(AP_CASE *c, long n_pos, long n_neg, CHECK_PARM *cp)
+     /* labels in random order; scores either from a few values, so that
+        there are ties within and across the classes, or continuous, at a
+        random scale so that either the loss or the scores dominate */
+{
+  static const double grid[] = { -1, -0.5, 0, 0.5, 1 };
+  long n = n_pos+n_neg, i, k, t;
+  double scale = pow(10.0, 3*uniform()-2);
+
+  c->x.n_pos = n_pos;
+  c->x.n_neg = n_neg;
+  c->x.x_is = (SUB_PATTERN *) my_malloc(n*sizeof(SUB_PATTERN));
+  c->y.n_pos = n_pos;
+  c->y.n_neg = n_neg;
+  c->y.labels = (int *) my_malloc(n*sizeof(int));
+  c->y.ranking = (int *) my_malloc(n*sizeof(int));
+  c->h.h_is = (int *) my_malloc(n*sizeof(int));
+  c->h.phi_h_is = (SVECTOR **) my_malloc(n*sizeof(SVECTOR *));
+  c->scores = (double *) my_malloc(n*sizeof(double));
+
+  for(i = 0; i < n; i++)
+    c->y.labels[i] = (i < n_pos);
+  for(i = n-1; i > 0; i--) {
+    k = (long) (next_random()%(i+1));
+    t = c->y.labels[i]; c->y.labels[i] = c->y.labels[k]; c->y.labels[k] = t;
+  }
+  for(i = 0; i < n; i++) {
+    c->x.x_is[i].file_name = NULL;
+    c->x.x_is[i].areaRatios = NULL;
+    c->x.x_is[i].n_candidates = 1;
+    c->x.x_is[i].label = c->y.labels[i];
+    c->y.ranking[i] = c->y.labels[i] ? n_neg : -n_pos;
+    c->h.h_is[i] = 0;
+    c->h.phi_h_is[i] = random_svector(cp->nnz, cp->dim);
+    if(uniform() < cp->tie_prob)
+      c->scores[i] = scale*grid[next_random()%5];
+    else
+      c->scores[i] = scale*(2*uniform()-1);
+  }
+}
+
+static void free_case(AP_CASE *c)
+{
+  long i;
+
+  for(i = 0; i < c->x.n_pos+c->x.n_neg; i++)
+    free_svector(c->h.phi_h_is[i]);
+  free(c->h.phi_h_is);
+  free(c->h.h_is);
+  free(c->y.labels);
+  free(c->y.ranking);
+  free(c->x.x_is);
+  free(c->scores);
+}
+
+static void sort_scores(AP_CASE *c, IMG_SCORE **pos, IMG_SCORE **neg, int **map)
+     /* the sorted score lists and the index map, as built by
+        find_most_violated_constraint_marginrescaling() */
+{
+  long i, n = c->x.n_pos+c->x.n_neg, np = 0, nn = 0;
+
+  *pos = (IMG_SCORE *) my_malloc((c->x.n_pos+1)*sizeof(IMG_SCORE));
+  *neg = (IMG_SCORE *) my_malloc((c->x.n_neg+1)*sizeof(IMG_SCORE));
+  *map = (int *) my_malloc(n*sizeof(int));
+  for(i = 0; i < n; i++) {
+    if(c->x.x_is[i].label == 1) {
+      (*pos)[np].img_idx = i;
+      (*pos)[np++].img_score = c->scores[i];
+    }
+    else {
+      (*neg)[nn].img_idx = i;
+      (*neg)[nn++].img_score = c->scores[i];
+    }
+  }
+  qsort(*neg, nn, sizeof(IMG_SCORE), img_score_comp);
+  qsort(*pos, np, sizeof(IMG_SCORE), img_score_comp);
+  for(i = 0; i < np; i++)
+    (*map)[(*pos)[i].img_idx] = i;
+  for(i = 0; i < nn; i++)
+    (*map)[(*neg)[i].img_idx] = i;
+}
+
+/************************************************************************/
+/*   Exhaustive search                                                   */
+/************************************************************************/
+
+/* With both classes in score order, which is optimal for any placement,
+   a ranking is given by the number of positives above each negative. */
+typedef struct search {
+  long   n_pos, n_neg;
+  double *pos_scores, *neg_scores;  /* sorted, descending */
+  double *pos_prefix;               /* sums of the first k positive scores */
+  int    *above;
+  double best;
+} SEARCH;
+
+static double interleaving_value(SEARCH *s)
+     /* loss plus <w,psi> of the ranking in s->above */
+{
+  long p, q, negs_above = 0;
+  double ap = 0, score = 0, a;
+
+  for(p = 1; p <= s->n_pos; p++) {
+    while((negs_above < s->n_neg) && (s->above[negs_above] < p))
+      negs_above++;
+    ap += p/(double) (p+negs_above);
+  }
+  for(q = 0; q < s->n_neg; q++) {
+    a = s->above[q];
+    score += 2*s->pos_prefix[s->above[q]]-s->pos_prefix[s->n_pos]
+             -(2*a-s->n_pos)*s->neg_scores[q];
+  }
+  return(1-ap/s->n_pos+score/(double) (s->n_pos*s->n_neg));
+}
+
+static void search_interleavings(SEARCH *s, long q, int min_above)
+{
+  int a;
+  double v;
+
+  if(q == s->n_neg) {
+    v = interleaving_value(s);
+    if(v > s->best)
+      s->best = v;
+    return;
+  }
+  for(a = min_above; a <= s->n_pos; a++) {
+    s->above[q] = a;
+    search_interleavings(s, q+1, a);
+  }
+}
+
+static double most_violated_value(IMG_SCORE *pos, IMG_SCORE *neg, long n_pos, long n_neg)
+{
+  SEARCH s;
+  long k;
+
+  s.n_pos = n_pos;
+  s.n_neg = n_neg;
+  s.pos_scores = (double *) my_malloc(n_pos*sizeof(double));
+  s.neg_scores = (double *) my_malloc(n_neg*sizeof(double));
+  s.pos_prefix = (double *) my_malloc((n_pos+1)*sizeof(double));
+  s.above = (int *) my_malloc(n_neg*sizeof(int));
+  s.pos_prefix[0] = 0;
+  for(k = 0; k < n_pos; k++) {
+    s.pos_scores[k] = pos[k].img_score;
+    s.pos_prefix[k+1] = s.pos_prefix[k]+pos[k].img_score;
+  }
+  for(k = 0; k < n_neg; k++)
+    s.neg_scores[k] = neg[k].img_score;
+  s.best = -DBL_MAX;
+  search_interleavings(&s, 0, 0);
+  free(s.pos_scores);
+  free(s.neg_scores);
+  free(s.pos_prefix);
+  free(s.above);
+  return(s.best);
+}
+
+static double ranking_value(AP_CASE *c, LABEL *ybar, double loss_value)
+     /* loss plus <w,psi> of an encoded ranking, from the pairs */
+{
+  long i, j, n = c->x.n_pos+c->x.n_neg;
+  double score = 0;
+
+  for(i = 0; i < n; i++) {
+    if(c->x.x_is[i].label != 1)
+      continue;
+    for(j = 0; j < n; j++) {
+      if(c->x.x_is[j].label == 0)
+        score += ((ybar->ranking[i] > ybar->ranking[j]) ? 1 : -1)*(c->scores[i]-c->scores[j]);
+    }
+  }
+  return(loss_value+score/(double) (c->x.n_pos*c->x.n_neg));
+}
+
+static double interleavings(long n_pos, long n_neg)
+     /* binomial(n_pos+n_neg, n_neg) */
+{
+  double r = 1;
+  long k;
+
+  for(k = 1; k <= n_neg; k++)
+    r = r*(n_pos+k)/k;
+  return(r);
+}
+
+/************************************************************************/
+/*   Comparison                                                          */
+/************************************************************************/
+
+static double svector_difference(SVECTOR *a, SVECTOR *b)
+     /* largest difference of a feature, relative to its size */
+{
+  WORD *ai = a->words, *bj = b->words;
+  double d, worst = 0, x, y;
+
+  while(ai->wnum || bj->wnum) {
+    x = y = 0;
+    if(bj->wnum == 0 || (ai->wnum && (ai->wnum < bj->wnum)))
+      x = (ai++)->weight*a->factor;
+    else if(ai->wnum == 0 || (bj->wnum < ai->wnum))
+      y = (bj++)->weight*b->factor;
+    else {
+      x = (ai++)->weight*a->factor;
+      y = (bj++)->weight*b->factor;
+    }
+    d = fabs(x-y)/(1.0 > fabs(x) ? 1.0 : fabs(x));
+    if(d > worst)
+      worst = d;
+  }
+  return(worst);
+}
+
+static void mismatch(CHECK_STATS *st, const char *what, long trial, AP_CASE *c, double detail)
+{
+  st->mismatches++;
+  if(st->mismatches <= MAX_REPORTED) {
+    printf("MISMATCH %s: case %ld, %ld positive and %ld negative images (%g)\n",
+           what, trial, c->x.n_pos, c->x.n_neg, detail);
+  }
+  else if(st->mismatches == MAX_REPORTED+1)
+    printf("further mismatches not shown\n");
+}
+
+static void check_case(AP_CASE *c, STRUCTMODEL *sm, long trial, CHECK_PARM *cp, CHECK_STATS *st,
+                       int exhaustive)
+{
+  IMG_SCORE *pos, *neg;
+  int *map, *locations;
+  LABEL ybar_ref, ybar_opt, *labels[2];
+  SVECTOR *psi_ref, *psi_opt;
+  double t0, t1, t2, loss_ref, loss_opt, best, value, d, slack_ref, slack_opt;
+  long i, n = c->x.n_pos+c->x.n_neg;
+  int k;
+
+  sort_scores(c, &pos, &neg, &map);
+  t0 = prof_now();
+  locations = optimumNegLocations(c->x, pos, neg);
+  t1 = prof_now();
+  st->optimized[R_LOCATIONS] += t1-t0;
+  st->calls[R_LOCATIONS]++;
+
+  ybar_ref.n_pos = ybar_opt.n_pos = c->x.n_pos;
+  ybar_ref.n_neg = ybar_opt.n_neg = c->x.n_neg;
+  ybar_ref.labels = ybar_opt.labels = c->y.labels;
+  t0 = prof_now();
+  encode_ranking_reference(c->x, &ybar_ref, pos, neg, map, locations);
+  t1 = prof_now();
+  encodeRanking(c->x, &ybar_opt, pos, neg, map, locations);
+  t2 = prof_now();
+  st->reference[R_ENCODE] += t1-t0;
+  st->optimized[R_ENCODE] += t2-t1;
+  st->calls[R_ENCODE]++;
+  for(i = 0; (i < n) && (ybar_ref.ranking[i] == ybar_opt.ranking[i]); i++);
+  if(i < n)
+    mismatch(st, "ranking", trial, c, i);
+
+  t0 = prof_now();
+  loss_ref = loss_reference(c->y, ybar_ref, c->h, NULL);
+  t1 = prof_now();
+  loss_opt = loss(c->y, ybar_opt, c->h, NULL);
+  t2 = prof_now();
+  st->reference[R_LOSS] += t1-t0;
+  st->optimized[R_LOSS] += t2-t1;
+  st->calls[R_LOSS]++;
+  if(!(fabs(loss_ref-loss_opt) <= cp->tolerance))
+    mismatch(st, "loss", trial, c, loss_opt-loss_ref);
+
+  /* psi of the most violated ranking and of the ground truth */
+  labels[0] = &ybar_opt;
+  labels[1] = &c->y;
+  for(k = 0; k < 2; k++) {
+    t0 = prof_now();
+    psi_ref = psi_reference(c->x, *labels[k], c->h, NULL, NULL);
+    t1 = prof_now();
+    psi_opt = psi(c->x, *labels[k], c->h, NULL, NULL);
+    t2 = prof_now();
+    st->reference[R_PSI] += t1-t0;
+    st->optimized[R_PSI] += t2-t1;
+    st->calls[R_PSI]++;
+    d = svector_difference(psi_ref, psi_opt);
+    if(!(d <= cp->tolerance))
+      mismatch(st, k ? "psi of the ground truth" : "psi", trial, c, d);
+    free_svector(psi_ref);
+    free_svector(psi_opt);
+  }
+
+  /* the fused slack, with the image scores from w rather than c->scores;
+     psi has single precision weights, hence the tolerance */
+  t0 = prof_now();
+  slack_ref = slack_reference(c, sm);
+  t1 = prof_now();
+  slack_opt = most_violated_slack(&c->x, c->y, &c->h, sm, NULL, NULL, NULL);
+  t2 = prof_now();
+  st->reference[R_SLACK] += t1-t0;
+  st->optimized[R_SLACK] += t2-t1;
+  st->calls[R_SLACK]++;
+  if(!(fabs(slack_ref-slack_opt) <= cp->slack_tolerance*(1+fabs(slack_ref))))
+    mismatch(st, "slack", trial, c, slack_opt-slack_ref);
+
+  if(exhaustive) {
+    t0 = prof_now();
+    best = most_violated_value(pos, neg, c->x.n_pos, c->x.n_neg);
+    t1 = prof_now();
+    st->reference[R_LOCATIONS] += t1-t0;
+    st->exhaustive++;
+    value = ranking_value(c, &ybar_opt, loss_opt);
+    if(!(fabs(value-best) <= cp->tolerance*(1+fabs(best))))
+      mismatch(st, "not the most violated ranking", trial, c, value-best);
+  }
+
+  free(ybar_ref.ranking);
+  free(ybar_opt.ranking);
+  free(locations);
+  free(pos);
+  free(neg);
+  free(map);
+}
+
+static void print_times(const char *label, CHECK_STATS *st, int with_exhaustive)
+{
+  int r;
+
+  printf("%-14s %-20s %8s %14s %14s %9s\n", label, "routine", "calls", "reference (s)", "optimized (s)", "speedup");
+  for(r = 0; r < N_ROUTINES; r++) {
+    if(st->calls[r] == 0)
+      continue;
+    if((r == R_LOCATIONS) && !with_exhaustive) {
+      printf("%-14s %-20s %8ld %14s %14.6f %9s\n", "", routine_names[r], st->calls[r], "-",
+             st->optimized[r], "-");
+      continue;
+    }
+    printf("%-14s %-20s %8ld %14.6f %14.6f %9.1f\n", "", routine_names[r], st->calls[r],
+           st->reference[r], st->optimized[r],
+           (st->optimized[r] > 0) ? st->reference[r]/st->optimized[r] : 0);
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  CHECK_PARM cp;
+  CHECK_STATS random_stats, size_stats;
+  AP_CASE c;
+  STRUCTMODEL sm;
+  long trial, n_pos, n_neg, mismatches, k;
+  int s, exhaustive;
+
+  read_input_parameters(argc, argv, &cp);
+  memset(&random_stats, 0, sizeof(random_stats));
+  seed_random(cp.seed);
+  sm.sizePsi = cp.dim;
+  sm.w = (double *) my_malloc((cp.dim+1)*sizeof(double));
+  for(k = 0; k <= cp.dim; k++)
+    sm.w[k] = 2*uniform()-1;
+
+  for(trial = 0; trial < cp.trials; trial++) {
+    /* one case in eight has a single positive or a single negative */
+    n_pos = 1+(long) (next_random()%cp.max_pos);
+    n_neg = 1+(long) (next_random()%cp.max_neg);
+    switch(next_random()%8) {
+      case 0: n_pos = 1; break;
+      case 1: n_neg = 1; break;
+      default: break;
+    }
+    make_case(&c, n_pos, n_neg, &cp);
+    exhaustive = (interleavings(n_pos, n_neg) <= cp.max_interleavings);
+    check_case(&c, &sm, trial, &cp, &random_stats, exhaustive);
+    free_case(&c);
+  }
+  printf("%ld random cases, %ld checked against every ranking, %ld mismatches\n",
+         cp.trials, random_stats.exhaustive, random_stats.mismatches);
+  print_times("random cases", &random_stats, 1);
+  mismatches = random_stats.mismatches;
+
+  for(s = 0; s < cp.n_sizes; s++) {
+    char label[32];
+
+    memset(&size_stats, 0, sizeof(size_stats));
+    n_pos = cp.sizes[s]/4 > 0 ? cp.sizes[s]/4 : 1;
+    n_neg = cp.sizes[s]-n_pos > 0 ? cp.sizes[s]-n_pos : 1;
+    make_case(&c, n_pos, n_neg, &cp);
+    check_case(&c, &sm, -1-s, &cp, &size_stats, 0);
+    free_case(&c);
+    sprintf(label, "%ld images", n_pos+n_neg);
+    print_times(label, &size_stats, 0);
+    mismatches += size_stats.mismatches;
+  }
+
+  free(sm.w);
+  printf("%s\n", mismatches ? "FAILED" : "PASSED");
+  return(mismatches ? 1 : 0);
+}
+
+
+void read_input_parameters(int argc, char **argv, CHECK_PARM *cp) {
+
+  long i;
+  char *s;
+
+  /* set default */
+  cp->trials = 20000;
+  cp->max_pos = 8;
+  cp->max_neg = 10;
+  cp->tie_prob = 0.3;
+  cp->seed = 1;
+  cp->tolerance = 1e-6;
+  cp->slack_tolerance = 1e-5;
+  cp->max_interleavings = 20000;
+  cp->sizes[0] = 1000;
+  cp->sizes[1] = 10000;
+  cp->n_sizes = 2;
+  cp->dim = 1000;
+  cp->nnz = 8;
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 'n': i++; cp->trials = atol(argv[i]); break;
+      case 'p': i++; cp->max_pos = atol(argv[i]); break;
+      case 'm': i++; cp->max_neg = atol(argv[i]); break;
+      case 't': i++; cp->tie_prob = atof(argv[i]); break;
+      case 'r': i++; cp->seed = strtoull(argv[i], NULL, 10); break;
+      case 'e': i++; cp->tolerance = atof(argv[i]); break;
+      case 'E': i++; cp->slack_tolerance = atof(argv[i]); break;
+      case 'x': i++; cp->max_interleavings = atof(argv[i]); break;
+      case 'd': i++; cp->dim = atol(argv[i]); break;
+      case 'z': i++; cp->nnz = atol(argv[i]); break;
+      case 's': i++;
+        cp->n_sizes = 0;
+        for(s = strtok(argv[i], ","); s && (cp->n_sizes < MAX_SIZES); s = strtok(NULL, ","))
+          if(atol(s) >= 2)
+            cp->sizes[cp->n_sizes++] = atol(s);
+        break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  if ((i<argc) || (cp->trials < 0) || (cp->max_pos < 1) || (cp->max_neg < 1) || (cp->dim < 1)
+      || (cp->nnz < 1) || (cp->nnz > cp->dim) || (cp->tolerance < 0)) {
+    printf("\nusage: svm_struct_latent_infer_check [options]\n");
+    printf("       -n trials  random cases (default 20000)\n");
+    printf("       -p n       most positive images in a random case (default 8)\n");
+    printf("       -m n       most negative images in a random case (default 10)\n");
+    printf("       -t x       chance that a score is one of five values (default 0.3)\n");
+    printf("       -r seed    random seed (default 1)\n");
+    printf("       -e x       tolerance for losses, feature vectors and objectives\n");
+    printf("                  (default 1e-6)\n");
+    printf("       -E x       relative tolerance for slacks (default 1e-5)\n");
+    printf("       -x n       check cases with at most n rankings against all of\n");
+    printf("                  them (default 20000)\n");
+    printf("       -s list    images in the timed single cases (default 1000,10000,\n");
+    printf("                  a quarter of them positive; 0 for none)\n");
+    printf("       -d n       features of the latent feature vectors (default 1000)\n");
+    printf("       -z n       non-zero features per vector (default 8)\n\n");
+    printf("Compares encodeRanking, loss and psi with the pairwise versions they\n");
+    printf("replaced, most_violated_slack with the slack from both psi, and the\n");
+    printf("ranking from optimumNegLocations with the most violated\n");
+    printf("one found by trying every ranking, which is also what its reference time\n");
+    printf("is. Prints FAILED and exits with status 1 on any mismatch.\n\n");
+    exit(0);
+  }
+
+}
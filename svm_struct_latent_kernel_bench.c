@@ -0,0 +1,572 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_kernel_bench.c                                   */
+/*                                                                      */
+/*   Times the vector kernels that training spends its time in. By      */
+/*   default the sparse-sparse kernels of svm_common (sprod_ss and      */
+/*   multadd_ss) are compared with the plain two-pointer merges they    */
+/*   replaced, on random sorted vectors of various lengths and          */
+/*   overlaps, and checked to give identical results. With -m sweep    */
+/*   the other kernels (sprod_ns, add_vector_ns, add_list_nn, smult_s   */
+/*   and create_svector) are timed over vector lengths, densities and   */
+/*   working sets sized for L1, L2, the last level cache and DRAM.      */
+/*   Every sweep measurement is printed as one JSON line with ns per    */
+/*   call and the rates implied by the bytes and flops the call must    */
+/*   touch, so that runs from different commits can be compared line   */
+/*   by line.                                                           */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "./svm_light/svm_common.h"
+#include "svm_struct_latent_kernels.h"
+#include "svm_struct_latent_tools.h"
+
+#define N_LEVELS     4
+#define MAX_SWEEP_POOL (1L<<20) /* vectors cycled through per sweep case */
+#define LIST_LENGTH  16         /* vectors summed by add_list_nn */
+#define MIN_SECONDS  0.02       /* per round */
+#define ROUNDS       5          /* the best round is reported */
+
+typedef enum bench_mode {
+  MODE_COMPARE, MODE_SWEEP
+} BENCH_MODE;
+
+typedef enum kernel {
+  K_SPROD_NS, K_ADD_VECTOR_NS, K_ADD_LIST_NN, K_SMULT_S, K_CREATE_SVECTOR,
+  N_KERNELS
+} KERNEL;
+
+static const char *kernel_names[N_KERNELS] = {
+  "sprod_ns", "add_vector_ns", "add_list_nn", "smult_s", "create_svector"
+};
+
+static const char *level_names[N_LEVELS] = { "L1", "L2", "LLC", "DRAM" };
+
+static const double densities[] = { 0.001, 0.01, 0.1, 1.0, 0 };
+static const long   lengths[] = { 16, 256, 4096, 65536, 0 };
+
+typedef struct kbench_parm {
+  BENCH_MODE mode;
+  long   level_bytes[N_LEVELS];  /* working set per residency */
+  int    use_level[N_LEVELS];
+  int    use_kernel[N_KERNELS];
+  double min_seconds;
+} KBENCH_PARM;
+
+/* one measurement; bytes and flops are per call and averaged over the
+   vectors of the case */
+typedef struct result {
+  double ns;
+  double bytes;
+  double flops;
+  long   calls;
+} RESULT;
+
+typedef struct bench_case {
+  long na;        /* features in a */
+  long nb;        /* features in b */
+  long range;     /* feature numbers are drawn from 1..range */
+} BENCH_CASE;
+
+void read_input_parameters(int argc, char **argv, KBENCH_PARM *kp);
+
+static volatile double sink;
+
+/************************************************************************/
+/*   sprod_ss and multadd_ss against the merges they replaced           */
+/************************************************************************/
+
+static const BENCH_CASE cases[] = {
+  {     16,     16,     64 },
+  {    100,    100,   1000 },
+  {   1000,   1000,   2000 },
+  {   1000,   1000,  20000 },
+  {  10000,  10000,  20000 },
+  {  10000,  10000, 100000 },
+  {  90000,  90000,  90112 },
+  {     10,  10000,  20000 },
+  {    100,  90000,  90112 },
+  {   2000,  90000,  90112 },
+  {      0,      0,      0 }
+};
+
+static double __attribute__((noinline)) sprod_ss_merge(SVECTOR *a, SVECTOR *b)
+     /* sprod_ss as it was before the block and galloping kernels; not
+        inlined into the timing loop, since sprod_ss is not either */
+{
+  register double sum = 0;
+  register WORD *ai, *bj;
+
+  ai = a->words;
+  bj = b->words;
+  while(ai->wnum && bj->wnum) {
+    if(ai->wnum > bj->wnum)
+      bj++;
+    else if(ai->wnum < bj->wnum)
+      ai++;
+    else {
+      sum += (ai->weight)*(bj->weight);
+      ai++;
+      bj++;
+    }
+  }
+  return(sum);
+}
+
+static SVECTOR *multadd_ss_merge(SVECTOR *a, SVECTOR *b, double factor)
+     /* multadd_ss as it was: a counting merge, a second merge into a
+        scratch array and a copy into the new vector */
+{
+  SVECTOR *vec;
+  WORD *sum, *sumi, *ai, *bj;
+  long veclength = 0;
+
+  for(ai = a->words, bj = b->words; ai->wnum && bj->wnum; veclength++) {
+    if(ai->wnum > bj->wnum) bj++;
+    else if(ai->wnum < bj->wnum) ai++;
+    else { ai++; bj++; }
+  }
+  for(; bj->wnum; bj++) veclength++;
+  for(; ai->wnum; ai++) veclength++;
+  veclength++;
+
+  sum = (WORD *) my_malloc(sizeof(WORD)*veclength);
+  sumi = sum;
+  ai = a->words;
+  bj = b->words;
+  while(ai->wnum && bj->wnum) {
+    if(ai->wnum > bj->wnum) {
+      (*sumi) = (*bj);
+      sumi->weight *= factor;
+      sumi++;
+      bj++;
+    }
+    else if(ai->wnum < bj->wnum) {
+      (*sumi) = (*ai);
+      sumi++;
+      ai++;
+    }
+    else {
+      (*sumi) = (*ai);
+      sumi->weight += factor*bj->weight;
+      if(sumi->weight != 0)
+        sumi++;
+      ai++;
+      bj++;
+    }
+  }
+  for(; bj->wnum; bj++, sumi++) {
+    (*sumi) = (*bj);
+    sumi->weight *= factor;
+  }
+  for(; ai->wnum; ai++, sumi++)
+    (*sumi) = (*ai);
+  sumi->wnum = 0;
+
+  vec = create_svector(sum, "", 1.0);
+  free(sum);
+  return(vec);
+}
+
+static int same_words(SVECTOR *a, SVECTOR *b)
+{
+  WORD *ai, *bj;
+
+  for(ai = a->words, bj = b->words; ai->wnum && bj->wnum; ai++, bj++) {
+    if((ai->wnum != bj->wnum) || (ai->weight != bj->weight))
+      return(0);
+  }
+  return((ai->wnum == 0) && (bj->wnum == 0));
+}
+
+#define POOL_FEATURES 400000  /* features in the pool of vector pairs */
+#define MAX_POOL      64
+
+static long repetitions(long na, long nb)
+     /* enough calls for about 2e7 visited features per measurement */
+{
+  long r = 20000000/(na+nb+1);
+  return((r < 10) ? 10 : r);
+}
+
+static long pool_size(long na, long nb)
+     /* every measurement cycles through this many different pairs, so
+        that the branch predictor cannot learn the merge of one pair */
+{
+  long p = POOL_FEATURES/(na+nb+1);
+  return((p < 1) ? 1 : ((p > MAX_POOL) ? MAX_POOL : p));
+}
+
+static int compare_merges(void)
+     /* returns 1 if a kernel differs from its merge */
+{
+  SVECTOR *a[MAX_POOL], *b[MAX_POOL], *s1, *s2;
+  double t, t_merge, t_new, m_merge, m_new, p1, p2;
+  long c, r, reps, np, q;
+  int failed = 0;
+
+  seed_random(1);
+  printf("%8s %8s %8s | %12s %12s %7s | %12s %12s %7s\n", "na", "nb", "range",
+         "sprod merge", "sprod", "speedup", "multadd mrg", "multadd", "speedup");
+  for(c = 0; cases[c].na; c++) {
+    np = pool_size(cases[c].na, cases[c].nb);
+    for(q = 0; q < np; q++) {
+      a[q] = random_svector(cases[c].na, cases[c].range);
+      b[q] = random_svector(cases[c].nb, cases[c].range);
+      p1 = sprod_ss_merge(a[q], b[q]);
+      p2 = sprod_ss(a[q], b[q]);
+      s1 = multadd_ss_merge(a[q], b[q], -0.5);
+      s2 = multadd_ss(a[q], b[q], -0.5);
+      if((p1 != p2) || (sprod_ss(b[q], a[q]) != p1) || !same_words(s1, s2)) {
+        printf("MISMATCH for na=%ld nb=%ld range=%ld\n", cases[c].na, cases[c].nb, cases[c].range);
+        failed = 1;
+      }
+      free_svector(s1);
+      free_svector(s2);
+    }
+    reps = repetitions(cases[c].na, cases[c].nb);
+
+    t = prof_now();
+    for(r = 0; r < reps; r++) sink += sprod_ss_merge(a[r%np], b[r%np]);
+    t_merge = (prof_now()-t)/reps;
+    t = prof_now();
+    for(r = 0; r < reps; r++) sink += sprod_ss(a[r%np], b[r%np]);
+    t_new = (prof_now()-t)/reps;
+
+    reps = reps/4+1;
+    t = prof_now();
+    for(r = 0; r < reps; r++) free_svector(multadd_ss_merge(a[r%np], b[r%np], -0.5));
+    m_merge = (prof_now()-t)/reps;
+    t = prof_now();
+    for(r = 0; r < reps; r++) free_svector(multadd_ss(a[r%np], b[r%np], -0.5));
+    m_new = (prof_now()-t)/reps;
+
+    printf("%8ld %8ld %8ld | %10.0fns %10.0fns %6.2fx | %10.0fns %10.0fns %6.2fx\n",
+           cases[c].na, cases[c].nb, cases[c].range,
+           1e9*t_merge, 1e9*t_new, t_merge/t_new, 1e9*m_merge, 1e9*m_new, m_merge/m_new);
+    for(q = 0; q < np; q++) {
+      free_svector(a[q]);
+      free_svector(b[q]);
+    }
+  }
+  return(failed);
+}
+
+/************************************************************************/
+/*   the other kernels over lengths, densities and working sets         */
+/************************************************************************/
+
+static long pool_for(long level_bytes, double bytes_per_item)
+     /* items needed to fill the working set, at least 2 so that one
+        call does not leave the next one's data in registers */
+{
+  double p = level_bytes/bytes_per_item;
+  if(p < 2) p = 2;
+  if(p > MAX_SWEEP_POOL) p = MAX_SWEEP_POOL;
+  return((long) p);
+}
+
+static double time_round(KERNEL k, long reps, double *w, long d, SVECTOR **a, WORD **words, long np)
+     /* seconds for reps calls, cycling through the pool */
+{
+  double t = prof_now(), s = 0, *sum;
+  long r, q = 0;
+
+  switch(k) {
+    case K_SPROD_NS:
+      for(r = 0; r < reps; r++, q = (q+1 == np) ? 0 : q+1)
+        s += sprod_ns(w, a[q]);
+      break;
+    case K_ADD_VECTOR_NS:
+      for(r = 0; r < reps; r++, q = (q+1 == np) ? 0 : q+1)
+        add_vector_ns(w, a[q], 1e-9);
+      break;
+    case K_ADD_LIST_NN:
+      for(r = 0; r < reps; r++, q = (q+1 == np) ? 0 : q+1) {
+        sum = add_list_nn(a[q], d);
+        s += sum[1];
+        free(sum);
+      }
+      break;
+    case K_SMULT_S:
+      for(r = 0; r < reps; r++, q = (q+1 == np) ? 0 : q+1)
+        free_svector(smult_s(a[q], 0.5));
+      break;
+    case K_CREATE_SVECTOR:
+      for(r = 0; r < reps; r++, q = (q+1 == np) ? 0 : q+1)
+        free_svector(create_svector(words[q], "", 1.0));
+      break;
+    default:
+      break;
+  }
+  sink += s;
+  return(prof_now()-t);
+}
+
+static double measure(KERNEL k, double *w, long d, SVECTOR **a, WORD **words, long np,
+                      double min_seconds, long *calls)
+     /* best seconds per call over ROUNDS rounds of at least min_seconds;
+        a first pass over the pool warms it up to its residency */
+{
+  long reps = np;
+  double t, best = 0;
+  int round;
+
+  time_round(k, np, w, d, a, words, np);
+  while((t = time_round(k, reps, w, d, a, words, np)) < min_seconds/4)
+    reps *= 4;
+  reps = (long) (reps*min_seconds/(t > 0 ? t : 1e-9))+1;
+  for(round = 0; round < ROUNDS; round++) {
+    t = time_round(k, reps, w, d, a, words, np)/reps;
+    if((round == 0) || (t < best))
+      best = t;
+  }
+  *calls = reps;
+  return(best);
+}
+
+static void print_result(KERNEL k, int level, long working_set, long n, double density, long dim,
+                         RESULT *r)
+{
+  printf("{\"kernel\":\"%s\",\"residency\":\"%s\",\"working_set\":%ld,\"length\":%ld,"
+         "\"density\":%g,\"dim\":%ld,\"ns_per_op\":%.2f,\"bytes_per_op\":%.0f,\"flops_per_op\":%.0f,"
+         "\"gb_per_s\":%.3f,\"gflop_per_s\":%.3f,\"calls\":%ld}\n",
+         kernel_names[k], level_names[level], working_set, n, density, dim, r->ns, r->bytes, r->flops,
+         r->bytes/r->ns, r->flops/r->ns, r->calls);
+  fflush(stdout);
+}
+
+static void bench_dense(KERNEL k, int level, KBENCH_PARM *kp)
+     /* kernels that scatter or gather into a weight vector: w fills the
+        working set, a few sparse vectors are cycled through on top of it;
+        densities whose vectors alone would exceed it are skipped */
+{
+  long d = kp->level_bytes[level]/sizeof(double), n, np, q, list;
+  SVECTOR *a[LIST_LENGTH*4], *v;
+  double *w, per_item;
+  RESULT r;
+  int di;
+
+  if(d < 16)
+    return;
+  w = create_dense_vector(d);
+  for(q = 1; q <= d; q++)
+    w[q] = 1.0/q;
+  for(di = 0; densities[di] > 0; di++) {
+    n = (long) (densities[di]*d);
+    if(n < 1)
+      continue;
+    /* the sparse vectors may add at most the working set again */
+    per_item = (double) n*sizeof(WORD)*((k == K_ADD_LIST_NN) ? LIST_LENGTH : 1);
+    if(per_item > kp->level_bytes[level])
+      continue;
+    np = (long) (kp->level_bytes[level]/per_item);
+    if(np > ((k == K_ADD_LIST_NN) ? 4 : LIST_LENGTH*4))
+      np = (k == K_ADD_LIST_NN) ? 4 : LIST_LENGTH*4;
+    for(q = 0; q < np; q++) {
+      if(k == K_ADD_LIST_NN) {
+        /* a list of LIST_LENGTH vectors per call */
+        a[q] = NULL;
+        for(list = 0; list < LIST_LENGTH; list++) {
+          v = random_svector(n, d);
+          v->factor = 0.5;
+          v->next = a[q];
+          a[q] = v;
+        }
+      }
+      else
+        a[q] = random_svector(n, d);
+    }
+    r.ns = 1e9*measure(k, w, d, a, NULL, np, kp->min_seconds, &r.calls);
+    switch(k) {
+      case K_SPROD_NS:
+        r.bytes = n*(sizeof(WORD)+sizeof(double));
+        r.flops = 2.0*n;
+        break;
+      case K_ADD_VECTOR_NS:
+        r.bytes = n*(sizeof(WORD)+2*sizeof(double));
+        r.flops = 2.0*n;
+        break;
+      default:
+        r.bytes = (d+1)*sizeof(double)+LIST_LENGTH*n*(sizeof(WORD)+2*sizeof(double));
+        r.flops = 2.0*LIST_LENGTH*n;
+        break;
+    }
+    print_result(k, level, kp->level_bytes[level], n, densities[di], d, &r);
+    for(q = 0; q < np; q++)
+      free_svector(a[q]);
+  }
+  free(w);
+}
+
+static void bench_sparse(KERNEL k, int level, KBENCH_PARM *kp)
+     /* kernels on sparse vectors only: a pool of vectors with density =
+        length/range fills the working set */
+{
+  SVECTOR **a;
+  WORD **words = NULL;
+  long n, range, np, q, item;
+  int li, di;
+  RESULT r;
+
+  for(li = 0; lengths[li] > 0; li++) {
+    n = lengths[li];
+    item = (n+1)*sizeof(WORD);
+    if(item > kp->level_bytes[level])
+      continue;
+    for(di = 0; densities[di] > 0; di++) {
+      range = (long) (n/densities[di]);
+      if(range > 100000000)
+        continue;
+      np = pool_for(kp->level_bytes[level], item);
+      a = (SVECTOR **) my_malloc(np*sizeof(SVECTOR *));
+      if(k == K_CREATE_SVECTOR)
+        words = (WORD **) my_malloc(np*sizeof(WORD *));
+      for(q = 0; q < np; q++) {
+        if(k == K_CREATE_SVECTOR) {
+          words[q] = random_words(n, range);
+          a[q] = NULL;
+        }
+        else
+          a[q] = random_svector(n, range);
+      }
+      r.ns = 1e9*measure(k, NULL, 0, a, words, np, kp->min_seconds, &r.calls);
+      r.bytes = 2.0*n*sizeof(WORD);
+      r.flops = (k == K_SMULT_S) ? n : 0;
+      print_result(k, level, kp->level_bytes[level], n, densities[di], range, &r);
+      for(q = 0; q < np; q++) {
+        if(a[q]) free_svector(a[q]);
+        if(words) free(words[q]);
+      }
+      free(a);
+      free(words);
+      words = NULL;
+    }
+  }
+}
+
+static void sweep_kernels(KBENCH_PARM *kp)
+{
+  int k, l;
+
+  printf("{\"machine\":{\"l1\":%ld,\"l2\":%ld,\"llc\":%ld,\"dram\":%ld}}\n",
+         kp->level_bytes[0], kp->level_bytes[1], kp->level_bytes[2], kp->level_bytes[3]);
+  for(k = 0; k < N_KERNELS; k++) {
+    if(!kp->use_kernel[k])
+      continue;
+    for(l = 0; l < N_LEVELS; l++) {
+      if(!kp->use_level[l])
+        continue;
+      if((k == K_SPROD_NS) || (k == K_ADD_VECTOR_NS) || (k == K_ADD_LIST_NN))
+        bench_dense((KERNEL) k, l, kp);
+      else
+        bench_sparse((KERNEL) k, l, kp);
+    }
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  KBENCH_PARM kp;
+
+  read_input_parameters(argc, argv, &kp);
+  if(kp.mode == MODE_SWEEP) {
+    sweep_kernels(&kp);
+    return(0);
+  }
+  return(compare_merges());
+}
+
+static long cache_size(int name, long fallback)
+{
+  long s = sysconf(name);
+  return((s > 0) ? s : fallback);
+}
+
+void read_input_parameters(int argc, char **argv, KBENCH_PARM *kp) {
+
+  long i;
+  int k, l, any;
+  char *s;
+
+  /* set default: half of each cache, so that the working set stays
+     resident next to everything else; DRAM at eight times the last
+     level cache, between 64 MB and 1 GB. Some virtual machines report
+     caches far larger than the host has, hence the cap on the LLC. */
+  kp->level_bytes[0] = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32768)/2;
+  kp->level_bytes[1] = cache_size(_SC_LEVEL2_CACHE_SIZE, 1L<<20)/2;
+  kp->level_bytes[2] = cache_size(_SC_LEVEL3_CACHE_SIZE, 8L<<20)/2;
+  if(kp->level_bytes[2] > (64L<<20))
+    kp->level_bytes[2] = 64L<<20;
+  kp->level_bytes[3] = 8*kp->level_bytes[2];
+  if(kp->level_bytes[3] < (64L<<20))
+    kp->level_bytes[3] = 64L<<20;
+  if(kp->level_bytes[3] > (1L<<30))
+    kp->level_bytes[3] = 1L<<30;
+  for(l = 0; l < N_LEVELS; l++)
+    kp->use_level[l] = 1;
+  for(k = 0; k < N_KERNELS; k++)
+    kp->use_kernel[k] = 1;
+  kp->min_seconds = MIN_SECONDS;
+  kp->mode = MODE_COMPARE;
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 'm': i++; kp->mode = strcmp(argv[i], "sweep") ? MODE_COMPARE : MODE_SWEEP; break;
+      case 'k': i++;
+        for(k = 0; k < N_KERNELS; k++)
+          kp->use_kernel[k] = (strstr(argv[i], kernel_names[k]) != NULL);
+        break;
+      case 'r': i++;
+        for(l = 0; l < N_LEVELS; l++)
+          kp->use_level[l] = (strstr(argv[i], level_names[l]) != NULL);
+        break;
+      case 's': i++;
+        for(l = 0, s = strtok(argv[i], ","); s && (l < N_LEVELS); l++, s = strtok(NULL, ","))
+          kp->level_bytes[l] = atol(s)*1024;
+        break;
+      case 't': i++; kp->min_seconds = atof(argv[i]); break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  for(k = 0, any = 0; k < N_KERNELS; k++)
+    any |= kp->use_kernel[k];
+  for(l = 0; l < N_LEVELS; l++)
+    any &= (kp->level_bytes[l] > 0);
+  if ((i<argc) || !any || (kp->min_seconds <= 0)) {
+    printf("\nusage: svm_struct_latent_kernel_bench [options]\n");
+    printf("       -m mode  compare: sprod_ss and multadd_ss against the merges\n");
+    printf("                they replaced (default); sweep: the other kernels over\n");
+    printf("                working sets, lengths and densities\n");
+    printf("options of the sweep:\n");
+    printf("       -k list  kernels to time (default all): sprod_ns, add_vector_ns,\n");
+    printf("                add_list_nn, smult_s, create_svector\n");
+    printf("       -r list  working sets (default all): L1, L2, LLC, DRAM\n");
+    printf("       -s list  working set sizes in kB for L1,L2,LLC,DRAM (default half\n");
+    printf("                of each cache, at most 64 MB, and eight times that of\n");
+    printf("                the LLC, between 64 MB and 1 GB, for DRAM)\n");
+    printf("       -t x     seconds per timing round (default %.2f)\n\n", MIN_SECONDS);
+    printf("The comparison prints a table and fails if a kernel differs from its\n");
+    printf("merge. The sweep prints one JSON line per kernel, working set, length\n");
+    printf("and density. Dense kernels scale w to the working set; density is\n");
+    printf("the fraction of w a vector touches. Sparse kernels cycle through\n");
+    printf("enough vectors to fill the working set; density is length over\n");
+    printf("feature range. Bytes and flops per call are those the kernel must\n");
+    printf("touch; the allocations made by add_list_nn, smult_s and\n");
+    printf("create_svector are timed with them, as they are part of every use\n");
+    printf("in training.\n\n");
+    exit(0);
+  }
+
+}
@@ -0,0 +1,157 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_kernels.c                                        */
+/*                                                                      */
+/*   Dense vector kernels for Latent SVM^struct. The loop bodies are    */
+/*   written once and instantiated by macro for the feature dimensions  */
+/*   in DENSE_DIMENSIONS, so that the compiler sees a constant trip     */
+/*   count; select_dense_kernels() picks the instance for the run.      */
+/*   Eight products are accumulated at a time, in two AVX2 registers    */
+/*   if available and in eight scalars otherwise, in the same order.    */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "svm_struct_latent_kernels.h"
+
+#define DENSE_ALIGN 64
+
+static inline __attribute__((always_inline))
+double dense_dot_body(const double *a, const double *b, long n)
+{
+  long i, nb = n & ~7L;
+  double sum;
+#ifdef __AVX2__
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  double t[4];
+
+  for(i = 0; i < nb; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a+i+4), _mm256_loadu_pd(b+i+4)));
+  }
+  _mm256_storeu_pd(t, _mm256_add_pd(s0, s1));
+  sum = (t[0]+t[1])+(t[2]+t[3]);
+#else
+  double s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int k;
+
+  for(i = 0; i < nb; i += 8) {
+    for(k = 0; k < 8; k++)
+      s[k] += a[i+k]*b[i+k];
+  }
+  sum = ((s[0]+s[4])+(s[1]+s[5]))+((s[2]+s[6])+(s[3]+s[7]));
+#endif
+  for(i = nb; i < n; i++)
+    sum += a[i]*b[i];
+  return(sum);
+}
+
+static inline __attribute__((always_inline))
+void dense_axpy_body(double *y, double s, const double *x, long n)
+{
+  long i, nb = n & ~7L;
+#ifdef __AVX2__
+  __m256d vs = _mm256_set1_pd(s);
+
+  for(i = 0; i < nb; i += 8) {
+    _mm256_storeu_pd(y+i, _mm256_add_pd(_mm256_loadu_pd(y+i), _mm256_mul_pd(vs, _mm256_loadu_pd(x+i))));
+    _mm256_storeu_pd(y+i+4, _mm256_add_pd(_mm256_loadu_pd(y+i+4), _mm256_mul_pd(vs, _mm256_loadu_pd(x+i+4))));
+  }
+#else
+  int k;
+
+  for(i = 0; i < nb; i += 8) {
+    for(k = 0; k < 8; k++)
+      y[i+k] += s*x[i+k];
+  }
+#endif
+  for(i = nb; i < n; i++)
+    y[i] += s*x[i];
+}
+
+static double dense_dot_generic(const double *a, const double *b, long n)
+{
+  return(dense_dot_body(a, b, n));
+}
+
+static void dense_axpy_generic(double *y, double s, const double *x, long n)
+{
+  dense_axpy_body(y, s, x, n);
+}
+
+/* feature dimensions (sizePsi) with their own kernels */
+#define DENSE_DIMENSIONS(X) \
+  X(1024) X(2048) X(4096) X(8192) X(16384) X(25088) X(32768) X(65536) X(90112)
+
+#define DEFINE_DENSE_KERNELS(D) \
+  static double dense_dot_##D(const double *a, const double *b, long n) \
+  { return(dense_dot_body(a, b, (D)+1)); } \
+  static void dense_axpy_##D(double *y, double s, const double *x, long n) \
+  { dense_axpy_body(y, s, x, (D)+1); }
+
+DENSE_DIMENSIONS(DEFINE_DENSE_KERNELS)
+
+#define DENSE_KERNEL_ENTRY(D) { (D)+1, "dimension " #D, dense_dot_##D, dense_axpy_##D },
+
+static const DENSE_KERNELS dense_kernel_table[] = {
+  DENSE_DIMENSIONS(DENSE_KERNEL_ENTRY)
+  { 0, NULL, NULL, NULL }
+};
+
+DENSE_KERNELS select_dense_kernels(long sizePsi)
+     /* kernels for vectors indexed 0..sizePsi */
+{
+  DENSE_KERNELS k;
+  int i;
+
+  for(i = 0; dense_kernel_table[i].n; i++) {
+    if(dense_kernel_table[i].n == sizePsi+1)
+      return(dense_kernel_table[i]);
+  }
+  k.n = sizePsi+1;
+  k.name = "generic";
+  k.dot = dense_dot_generic;
+  k.axpy = dense_axpy_generic;
+  return(k);
+}
+
+double *create_dense_vector(long sizePsi)
+     /* zeroed vector indexed 0..sizePsi, aligned to a cache line; it
+        is released with free() */
+{
+  void *v;
+
+  if(posix_memalign(&v, DENSE_ALIGN, (sizePsi+1)*sizeof(double))) {
+    perror("Out of memory!\n");
+    exit(1);
+  }
+  memset(v, 0, (sizePsi+1)*sizeof(double));
+  return((double *) v);
+}
+
+double* add_list_nn(SVECTOR *a, long totwords) 
+     /* computes the linear combination of the SVECTOR list weighted
+	by the factor of each SVECTOR. assumes that the number of
+	features is small compared to the number of elements in the
+	list */
+{
+    SVECTOR *f;
+    double *sum;
+
+    sum=create_dense_vector(totwords);
+
+    for(f=a;f;f=f->next)  
+      add_vector_ns(sum,f,f->factor);
+
+    return(sum);
+}
@@ -0,0 +1,40 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_kernels.h                                        */
+/*                                                                      */
+/*   Dense vector kernels for Latent SVM^struct, specialized at         */
+/*   compile time for common feature dimensions.                        */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_KERNELS
+#define SVM_STRUCT_LATENT_KERNELS
+
+#include "./svm_light/svm_common.h"
+
+typedef double (*DENSE_DOT)(const double *a, const double *b, long n);
+typedef void   (*DENSE_AXPY)(double *y, double s, const double *x, long n);
+
+/* Kernels for dense vectors of n doubles, i.e. index 0 to sizePsi of
+   a weight vector. The specialized kernels ignore their n argument
+   and use the length they were compiled for. */
+typedef struct dense_kernels {
+  long       n;
+  const char *name;
+  DENSE_DOT  dot;       /* returns <a,b> */
+  DENSE_AXPY axpy;      /* y += s*x */
+} DENSE_KERNELS;
+
+DENSE_KERNELS select_dense_kernels(long sizePsi);
+double        *create_dense_vector(long sizePsi);
+
+/* sum of a list of sparse vectors, each weighted by its factor, as a
+   dense vector from create_dense_vector() */
+double        *add_list_nn(SVECTOR *a, long totwords);
+
+#endif
@@ -0,0 +1,361 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_manifest.c                                       */
+/*                                                                      */
+/*   Reading and writing of text and packed image manifests for         */
+/*   Latent SVM^struct.                                                 */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "svm_struct_latent_manifest.h"
+
+#define ALIGN8(x) (((x)+7) & ~((uint64_t) 7))
+
+static void manifest_error(char *file, char *message)
+{
+  printf("Error: %s: %s\n", file, message);
+  exit(1);
+}
+
+static char *next_token(char **cur, char *end, size_t *len)
+     /* returns the next whitespace separated token in [*cur,end) */
+{
+  char *p = *cur, *tok;
+  while((p < end) && isspace((unsigned char) *p)) p++;
+  if(p >= end) {
+    *cur = p;
+    return(NULL);
+  }
+  tok = p;
+  while((p < end) && !isspace((unsigned char) *p)) p++;
+  *len = p-tok;
+  *cur = p;
+  return(tok);
+}
+
+static long next_long(char *file, char **cur, char *end)
+{
+  size_t len;
+  char *tok = next_token(cur, end, &len);
+  if(!tok) manifest_error(file, "unexpected end of manifest");
+  return(strtol(tok, NULL, 10));
+}
+
+MANIFEST *read_manifest_text(char *file, int with_area_ratios)
+     /* Parses the text manifest: the number of images followed by
+        "file_name label n_candidates" for each image. If
+        with_area_ratios is set, positive images are additionally
+        followed by n_candidates area ratios. */
+{
+  MANIFEST *mf;
+  FILE *fp;
+  char *buf, *cur, *end, *tok;
+  size_t len, nread;
+  long i, j, size, pool_cap, area_cap;
+  struct stat st;
+
+  fp = fopen(file, "r");
+  if(fp==NULL) {
+    printf("Error: Cannot open input file %s\n",file);
+    exit(1);
+  }
+  if(fstat(fileno(fp), &st)) manifest_error(file, "cannot stat manifest");
+  size = (long) st.st_size;
+  buf = (char *) malloc(size+1);
+  if(!buf) manifest_error(file, "memory error");
+  nread = fread(buf, 1, size, fp);
+  fclose(fp);
+  buf[nread] = '\0';
+  cur = buf;
+  end = buf+nread;
+
+  mf = (MANIFEST *) calloc(1, sizeof(MANIFEST));
+  if(!mf) manifest_error(file, "memory error");
+  mf->n_imgs = next_long(file, &cur, end);
+  if(mf->n_imgs <= 0) manifest_error(file, "invalid number of images");
+
+  mf->labels = (int *) malloc(mf->n_imgs*sizeof(int));
+  mf->n_candidates = (int *) malloc(mf->n_imgs*sizeof(int));
+  mf->name_offsets = (uint64_t *) malloc(mf->n_imgs*sizeof(uint64_t));
+  mf->area_offsets = (uint64_t *) malloc((mf->n_imgs+1)*sizeof(uint64_t));
+  pool_cap = 64*mf->n_imgs;
+  mf->pool = (char *) malloc(pool_cap);
+  area_cap = 16;
+  mf->area_ratios = (int *) malloc(area_cap*sizeof(int));
+  if(!mf->labels || !mf->n_candidates || !mf->name_offsets || !mf->area_offsets
+     || !mf->pool || !mf->area_ratios)
+    manifest_error(file, "memory error");
+
+  for(i = 0; i < mf->n_imgs; i++) {
+    tok = next_token(&cur, end, &len);
+    if(!tok) manifest_error(file, "unexpected end of manifest");
+    while(mf->pool_size+(long)len+1 > pool_cap) {
+      pool_cap *= 2;
+      mf->pool = (char *) realloc(mf->pool, pool_cap);
+      if(!mf->pool) manifest_error(file, "memory error");
+    }
+    mf->name_offsets[i] = mf->pool_size;
+    memcpy(mf->pool+mf->pool_size, tok, len);
+    mf->pool[mf->pool_size+len] = '\0';
+    mf->pool_size += len+1;
+
+    mf->labels[i] = (int) next_long(file, &cur, end);
+    mf->n_candidates[i] = (int) next_long(file, &cur, end);
+    if(mf->n_candidates[i] <= 0) manifest_error(file, "image without candidates");
+
+    mf->area_offsets[i] = mf->n_area_ratios;
+    // Image label can be 0(negative image) or 1(positive image)
+    if(mf->labels[i] == 0) {
+      mf->n_neg++;
+    }
+    else {
+      mf->n_pos++;
+      if(with_area_ratios) {
+        while(mf->n_area_ratios+mf->n_candidates[i] > area_cap) {
+          area_cap *= 2;
+          mf->area_ratios = (int *) realloc(mf->area_ratios, area_cap*sizeof(int));
+          if(!mf->area_ratios) manifest_error(file, "memory error");
+        }
+        for(j = 0; j < mf->n_candidates[i]; j++) {
+          mf->area_ratios[mf->n_area_ratios++] = (int) next_long(file, &cur, end);
+        }
+      }
+    }
+  }
+  mf->area_offsets[mf->n_imgs] = mf->n_area_ratios;
+  free(buf);
+
+  return(mf);
+}
+
+int is_packed_manifest(char *file)
+{
+  uint32_t magic = 0;
+  FILE *fp = fopen(file, "rb");
+  if(fp==NULL) {
+    printf("Error: Cannot open input file %s\n",file);
+    exit(1);
+  }
+  if(fread(&magic, sizeof(magic), 1, fp) != 1)
+    magic = 0;
+  fclose(fp);
+  return(magic == MANIFEST_MAGIC);
+}
+
+MANIFEST *read_manifest_packed(char *file)
+     /* Maps a packed manifest written by write_manifest_packed(). The
+        returned arrays point directly into the read-only mapping. */
+{
+  MANIFEST *mf;
+  MANIFEST_HEADER *hdr;
+  struct stat st;
+  char *base;
+  uint64_t n, i, n_pos, max_norms_off;
+  int fd;
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    printf("Error: Cannot open input file %s\n",file);
+    exit(1);
+  }
+  if(fstat(fd, &st)) manifest_error(file, "cannot stat manifest");
+  if((size_t) st.st_size < offsetof(MANIFEST_HEADER, max_norms_off))
+    manifest_error(file, "truncated packed manifest");
+  base = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) manifest_error(file, "mmap failed");
+
+  hdr = (MANIFEST_HEADER *) base;
+  if(hdr->magic != MANIFEST_MAGIC) manifest_error(file, "not a packed manifest");
+  if((hdr->version != 1) && (hdr->version != MANIFEST_VERSION))
+    manifest_error(file, "unsupported packed manifest version");
+  max_norms_off = 0;
+  if(hdr->version >= 2) {
+    if((size_t) st.st_size < sizeof(MANIFEST_HEADER))
+      manifest_error(file, "truncated packed manifest");
+    max_norms_off = hdr->max_norms_off;
+  }
+  n = hdr->n_imgs;
+  /* every count is bounded by the file size before it is multiplied */
+  if((n == 0) || (n > (uint64_t) st.st_size)
+     || (hdr->n_area_ratios > (uint64_t) st.st_size)
+     || (hdr->pool_size > (uint64_t) st.st_size)
+     || (hdr->n_pos+hdr->n_neg != n)
+     || (hdr->labels_off+n*sizeof(int32_t) > (uint64_t) st.st_size)
+     || (hdr->n_candidates_off+n*sizeof(int32_t) > (uint64_t) st.st_size)
+     || (hdr->name_off+n*sizeof(uint64_t) > (uint64_t) st.st_size)
+     || (hdr->area_off+(n+1)*sizeof(uint64_t) > (uint64_t) st.st_size)
+     || (hdr->area_ratios_off+hdr->n_area_ratios*sizeof(int32_t) > (uint64_t) st.st_size)
+     || (hdr->pool_off+hdr->pool_size > (uint64_t) st.st_size)
+     || (max_norms_off+(max_norms_off ? n*sizeof(double) : 0) > (uint64_t) st.st_size))
+    manifest_error(file, "corrupt packed manifest");
+
+  mf = (MANIFEST *) calloc(1, sizeof(MANIFEST));
+  if(!mf) manifest_error(file, "memory error");
+  mf->n_imgs = (long) n;
+  mf->n_pos = (long) hdr->n_pos;
+  mf->n_neg = (long) hdr->n_neg;
+  mf->n_area_ratios = (long) hdr->n_area_ratios;
+  mf->pool_size = (long) hdr->pool_size;
+  mf->labels = (int *) (base+hdr->labels_off);
+  mf->n_candidates = (int *) (base+hdr->n_candidates_off);
+  mf->name_offsets = (uint64_t *) (base+hdr->name_off);
+  mf->area_offsets = (uint64_t *) (base+hdr->area_off);
+  mf->area_ratios = (int *) (base+hdr->area_ratios_off);
+  mf->pool = base+hdr->pool_off;
+  mf->max_norms = max_norms_off ? (double *) (base+max_norms_off) : NULL;
+  mf->map_base = base;
+  mf->map_len = st.st_size;
+
+  if(mf->pool_size && mf->pool[mf->pool_size-1] != '\0')
+    manifest_error(file, "corrupt file name pool");
+  for(i = 0, n_pos = 0; i < n; i++) {
+    if(mf->name_offsets[i] >= (uint64_t) mf->pool_size)
+      manifest_error(file, "corrupt file name offsets");
+    if(mf->area_offsets[i] > mf->area_offsets[i+1])
+      manifest_error(file, "corrupt area ratio offsets");
+    n_pos += (mf->labels[i] != 0);
+  }
+  if(mf->area_offsets[n] > (uint64_t) mf->n_area_ratios)
+    manifest_error(file, "corrupt area ratio offsets");
+  if(n_pos != hdr->n_pos)
+    manifest_error(file, "image counts do not match the labels");
+
+  return(mf);
+}
+
+MANIFEST *read_manifest(char *file, int with_area_ratios)
+{
+  if(is_packed_manifest(file))
+    return(read_manifest_packed(file));
+  return(read_manifest_text(file, with_area_ratios));
+}
+
+static void write_section(FILE *fp, uint64_t *pos, void *data, uint64_t size)
+{
+  static const char zeros[8] = {0};
+  uint64_t pad = ALIGN8(*pos)-(*pos);
+  if(pad) fwrite(zeros, 1, pad, fp);
+  if(size) fwrite(data, 1, size, fp);
+  *pos += pad+size;
+}
+
+int write_manifest_packed(char *file, MANIFEST *mf)
+{
+  MANIFEST_HEADER hdr;
+  uint64_t pos, n;
+  FILE *fp;
+
+  memset(&hdr, 0, sizeof(hdr));
+  n = mf->n_imgs;
+  hdr.magic = MANIFEST_MAGIC;
+  hdr.version = MANIFEST_VERSION;
+  hdr.n_imgs = n;
+  hdr.n_pos = mf->n_pos;
+  hdr.n_neg = mf->n_neg;
+  hdr.n_area_ratios = mf->n_area_ratios;
+  hdr.pool_size = mf->pool_size;
+  hdr.labels_off = ALIGN8(sizeof(MANIFEST_HEADER));
+  hdr.n_candidates_off = ALIGN8(hdr.labels_off+n*sizeof(int32_t));
+  hdr.name_off = ALIGN8(hdr.n_candidates_off+n*sizeof(int32_t));
+  hdr.area_off = ALIGN8(hdr.name_off+n*sizeof(uint64_t));
+  hdr.area_ratios_off = ALIGN8(hdr.area_off+(n+1)*sizeof(uint64_t));
+  hdr.pool_off = ALIGN8(hdr.area_ratios_off+hdr.n_area_ratios*sizeof(int32_t));
+  if(mf->max_norms)
+    hdr.max_norms_off = ALIGN8(hdr.pool_off+hdr.pool_size);
+
+  fp = fopen(file, "wb");
+  if(fp==NULL) {
+    printf("Cannot open manifest file %s for output!", file);
+    return(1);
+  }
+  pos = 0;
+  write_section(fp, &pos, &hdr, sizeof(hdr));
+  write_section(fp, &pos, mf->labels, n*sizeof(int32_t));
+  write_section(fp, &pos, mf->n_candidates, n*sizeof(int32_t));
+  write_section(fp, &pos, mf->name_offsets, n*sizeof(uint64_t));
+  write_section(fp, &pos, mf->area_offsets, (n+1)*sizeof(uint64_t));
+  write_section(fp, &pos, mf->area_ratios, hdr.n_area_ratios*sizeof(int32_t));
+  write_section(fp, &pos, mf->pool, hdr.pool_size);
+  if(mf->max_norms)
+    write_section(fp, &pos, mf->max_norms, n*sizeof(double));
+  if(ferror(fp)) {
+    fclose(fp);
+    return(1);
+  }
+  return(fclose(fp) != 0);
+}
+
+void compute_max_norms(MANIFEST *mf)
+     /* reads the feature file of every image and records the largest
+        Euclidean norm among its candidates. The norm bounds the score
+        |<w,phi>| <= |w| |phi| of every candidate, which lets test-time
+        retrieval skip images that cannot rank high enough. */
+{
+  FILE *fp;
+  char *line = NULL, *p, *q;
+  size_t len = 0;
+  double sq, v, max_sq;
+  long i, j;
+
+  mf->max_norms = (double *) malloc(mf->n_imgs*sizeof(double));
+  if(!mf->max_norms) manifest_error("manifest", "memory error");
+  for(i = 0; i < mf->n_imgs; i++) {
+    fp = fopen(mf->pool+mf->name_offsets[i], "r");
+    if(fp == NULL) {
+      printf("Error: Cannot open feature file %s\n", mf->pool+mf->name_offsets[i]);
+      exit(1);
+    }
+    max_sq = 0;
+    for(j = 0; (j < mf->n_candidates[i]) && (getline(&line, &len, fp) != -1); j++) {
+      sq = 0;
+      for(p = line; (p = strchr(p, ':')) != NULL; p = q) {
+        v = strtod(p+1, &q);
+        if(q == p+1) q++;
+        sq += v*v;
+      }
+      if(sq > max_sq)
+        max_sq = sq;
+    }
+    fclose(fp);
+    if(j < mf->n_candidates[i]) {
+      printf("Error: feature file %s has fewer than %d candidates\n", mf->pool+mf->name_offsets[i], mf->n_candidates[i]);
+      exit(1);
+    }
+    mf->max_norms[i] = sqrt(max_sq);
+  }
+  free(line);
+}
+
+void free_manifest(MANIFEST *mf)
+{
+  if(!mf)
+    return;
+  if(mf->map_base) {
+    munmap(mf->map_base, mf->map_len);
+  }
+  else {
+    free(mf->labels);
+    free(mf->n_candidates);
+    free(mf->name_offsets);
+    free(mf->area_offsets);
+    free(mf->area_ratios);
+    free(mf->pool);
+    free(mf->max_norms);
+  }
+  free(mf);
+}
@@ -0,0 +1,75 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_manifest.h                                       */
+/*                                                                      */
+/*   Compact image manifest for Latent SVM^struct. The manifest keeps   */
+/*   file names in one string pool and labels, candidate counts and     */
+/*   area ratios in flat arrays, so that a packed manifest can be       */
+/*   loaded with a single mmap.                                         */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_MANIFEST
+#define SVM_STRUCT_LATENT_MANIFEST
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MANIFEST_MAGIC   0x464d534cU  /* "LSMF" in little endian */
+#define MANIFEST_VERSION 2
+
+/* On-disk header of a packed manifest. All section offsets are in
+   bytes from the start of the file and are 8-byte aligned. Integers
+   are stored in host byte order. Version 1 files end the header before
+   max_norms_off. */
+typedef struct manifest_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t n_imgs;
+  uint64_t n_pos;
+  uint64_t n_neg;
+  uint64_t n_area_ratios;    /* total number of area ratios */
+  uint64_t pool_size;        /* bytes in the file name pool */
+  uint64_t labels_off;       /* int32_t[n_imgs] */
+  uint64_t n_candidates_off; /* int32_t[n_imgs] */
+  uint64_t name_off;         /* uint64_t[n_imgs], offsets into pool */
+  uint64_t area_off;         /* uint64_t[n_imgs+1], offsets into area ratios */
+  uint64_t area_ratios_off;  /* int32_t[n_area_ratios] */
+  uint64_t pool_off;         /* char[pool_size], NUL separated names */
+  uint64_t max_norms_off;    /* double[n_imgs], 0 if not stored */
+} MANIFEST_HEADER;
+
+typedef struct manifest {
+  long     n_imgs;
+  long     n_pos;
+  long     n_neg;
+  long     n_area_ratios;
+  long     pool_size;
+  int      *labels;          /* image label, 0 (negative) or 1 (positive) */
+  int      *n_candidates;    /* number of candidate boxes per image */
+  uint64_t *name_offsets;    /* file name of image i is pool+name_offsets[i] */
+  uint64_t *area_offsets;    /* area ratios of image i are
+                                area_ratios[area_offsets[i]..area_offsets[i+1]) */
+  int      *area_ratios;
+  char     *pool;
+  double   *max_norms;       /* largest candidate feature norm per image,
+                                NULL if unknown */
+
+  void     *map_base;        /* non-NULL if the arrays point into an mmap */
+  size_t   map_len;
+} MANIFEST;
+
+MANIFEST *read_manifest(char *file, int with_area_ratios);
+MANIFEST *read_manifest_text(char *file, int with_area_ratios);
+MANIFEST *read_manifest_packed(char *file);
+int      is_packed_manifest(char *file);
+int      write_manifest_packed(char *file, MANIFEST *mf);
+void     compute_max_norms(MANIFEST *mf);
+void     free_manifest(MANIFEST *mf);
+
+#endif
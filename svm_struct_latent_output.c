@@ -0,0 +1,266 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_output.c                                         */
+/*                                                                      */
+/*   Buffered writers for the classifier output of Latent SVM^struct.   */
+/*   Text is formatted straight into a large buffer that is handed to   */
+/*   write(2) when full; binary sections are written from the score    */
+/*   arrays without copying.                                            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_score.h"
+#include "svm_struct_latent_output.h"
+
+#define OUT_BUFFER_SIZE (1<<20)
+#define ALIGN8(x) (((x)+7) & ~((uint64_t) 7))
+
+static const double pow10_d[10] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+static const unsigned long long pow10_u[10] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+                                                1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL };
+
+OUT_BUFFER *open_out_buffer(char *file)
+{
+  OUT_BUFFER *ob;
+  int fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+
+  if(fd < 0) {
+    printf("Cannot open %s for output!\n", file);
+    return(NULL);
+  }
+  ob = (OUT_BUFFER *) my_malloc(sizeof(OUT_BUFFER));
+  ob->fd = fd;
+  ob->cap = OUT_BUFFER_SIZE;
+  ob->buf = (char *) my_malloc(ob->cap);
+  ob->len = 0;
+  ob->failed = 0;
+  return(ob);
+}
+
+static void write_all(OUT_BUFFER *ob, const char *data, size_t size)
+{
+  ssize_t n;
+
+  while((size > 0) && !ob->failed) {
+    n = write(ob->fd, data, size);
+    if(n < 0) {
+      if(errno == EINTR) continue;
+      ob->failed = 1;
+      break;
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+static void flush_out_buffer(OUT_BUFFER *ob)
+{
+  write_all(ob, ob->buf, ob->len);
+  ob->len = 0;
+}
+
+void out_bytes(OUT_BUFFER *ob, const void *data, size_t size)
+     /* blocks larger than the buffer go to the file directly */
+{
+  if(ob->len+size > ob->cap)
+    flush_out_buffer(ob);
+  if(size >= ob->cap) {
+    write_all(ob, (const char *) data, size);
+    return;
+  }
+  memcpy(ob->buf+ob->len, data, size);
+  ob->len += size;
+}
+
+void out_char(OUT_BUFFER *ob, char c)
+{
+  if(ob->len == ob->cap)
+    flush_out_buffer(ob);
+  ob->buf[ob->len++] = c;
+}
+
+static void out_digits(OUT_BUFFER *ob, unsigned long long v, int min_width)
+{
+  char tmp[24];
+  int n = 0;
+
+  do {
+    tmp[n++] = (char)('0'+v%10);
+    v /= 10;
+  } while(v);
+  while(n < min_width)
+    tmp[n++] = '0';
+  if(ob->len+n > ob->cap)
+    flush_out_buffer(ob);
+  while(n > 0)
+    ob->buf[ob->len++] = tmp[--n];
+}
+
+void out_long(OUT_BUFFER *ob, long v)
+{
+  if(v < 0) {
+    out_char(ob, '-');
+    out_digits(ob, -(unsigned long long) v, 1);
+  }
+  else {
+    out_digits(ob, (unsigned long long) v, 1);
+  }
+}
+
+void out_fixed(OUT_BUFFER *ob, double v, int digits)
+     /* writes v exactly as printf("%.<digits>f") does, for digits in
+        [0,9]. Values whose rounding cannot be decided from the scaled
+        double, and very large or non-finite ones, go through snprintf. */
+{
+  double scaled, fl, frac;
+  unsigned long long q;
+  char tmp[400];
+  int n;
+
+  scaled = fabs(v)*pow10_d[digits];
+  if(scaled < 4e15) {
+    fl = floor(scaled);
+    frac = scaled-fl;
+    if(fabs(frac-0.5) > 1e-12*(1+scaled)) {
+      q = (unsigned long long) fl+((frac > 0.5) ? 1 : 0);
+      if(signbit(v))
+        out_char(ob, '-');
+      out_digits(ob, q/pow10_u[digits], 1);
+      if(digits > 0) {
+        out_char(ob, '.');
+        out_digits(ob, q%pow10_u[digits], digits);
+      }
+      return;
+    }
+  }
+  n = snprintf(tmp, sizeof(tmp), "%.*f", digits, v);
+  if((n < 0) || (n >= (int) sizeof(tmp)))
+    n = snprintf(tmp, sizeof(tmp), "%.*e", digits, v);
+  out_bytes(ob, tmp, n);
+}
+
+int close_out_buffer(OUT_BUFFER *ob)
+     /* returns non-zero if any part of the output could not be written */
+{
+  int failed;
+
+  flush_out_buffer(ob);
+  failed = ob->failed | (close(ob->fd) != 0);
+  free(ob->buf);
+  free(ob);
+  return(failed);
+}
+
+int write_score_file(char *file, TEST_SCORES *ts)
+     /* one "%0.5f" score per image, in input order */
+{
+  OUT_BUFFER *ob = open_out_buffer(file);
+  long i;
+
+  if(!ob)
+    return(1);
+  for(i = 0; i < ts->n_imgs; i++) {
+    out_fixed(ob, ts->scores[i*ts->n_models], 5);
+    out_char(ob, '\n');
+  }
+  return(close_out_buffer(ob));
+}
+
+static void out_padding(OUT_BUFFER *ob, uint64_t *pos)
+{
+  static const char zeros[8] = {0};
+  uint64_t pad = ALIGN8(*pos)-(*pos);
+  out_bytes(ob, zeros, pad);
+  *pos += pad;
+}
+
+static void write_box_table_binary(OUT_BUFFER *ob, TEST_SCORES *ts)
+{
+  BOX_TABLE_HEADER hdr;
+  uint64_t n = ts->n_imgs, nt = (uint64_t) ts->n_imgs*ts->n_top, pos;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = BOX_TABLE_MAGIC;
+  hdr.version = BOX_TABLE_VERSION;
+  hdr.n_imgs = n;
+  hdr.n_top = ts->n_top;
+  hdr.best_off = ALIGN8(sizeof(hdr));
+  hdr.score_off = ALIGN8(hdr.best_off+n*sizeof(int32_t));
+  hdr.top_box_off = ALIGN8(hdr.score_off+n*sizeof(double));
+  hdr.top_score_off = ALIGN8(hdr.top_box_off+nt*sizeof(int32_t));
+
+  /* int is 32 bits on every platform this code runs on, so the score
+     arrays are written as they are */
+  pos = 0;
+  out_bytes(ob, &hdr, sizeof(hdr));                    pos += sizeof(hdr);
+  out_padding(ob, &pos);
+  out_bytes(ob, ts->best, n*sizeof(int32_t));          pos += n*sizeof(int32_t);
+  out_padding(ob, &pos);
+  out_bytes(ob, ts->scores, n*sizeof(double));         pos += n*sizeof(double);
+  if(nt) {
+    out_padding(ob, &pos);
+    out_bytes(ob, ts->top_box, nt*sizeof(int32_t));    pos += nt*sizeof(int32_t);
+    out_padding(ob, &pos);
+    out_bytes(ob, ts->top_scores, nt*sizeof(double));  pos += nt*sizeof(double);
+  }
+}
+
+static void write_box_table_csv(OUT_BUFFER *ob, TEST_SCORES *ts)
+{
+  static const char header[] = "image,best_box,score";
+  long i, r, k;
+
+  out_bytes(ob, header, sizeof(header)-1);
+  for(r = 1; r <= ts->n_top; r++) {
+    out_bytes(ob, ",box_", 5);
+    out_long(ob, r);
+    out_bytes(ob, ",score_", 7);
+    out_long(ob, r);
+  }
+  out_char(ob, '\n');
+
+  for(i = 0; i < ts->n_imgs; i++) {
+    out_long(ob, i);
+    out_char(ob, ',');
+    out_long(ob, ts->best[i]);
+    out_char(ob, ',');
+    out_fixed(ob, ts->scores[i], 5);
+    for(r = 0; r < ts->n_top; r++) {
+      k = i*ts->n_top+r;
+      out_char(ob, ',');
+      out_long(ob, ts->top_box[k]);
+      out_char(ob, ',');
+      if(ts->top_box[k] >= 0)
+        out_fixed(ob, ts->top_scores[k], 5);
+    }
+    out_char(ob, '\n');
+  }
+}
+
+int write_box_table(char *file, TEST_SCORES *ts, int format)
+     /* writes the chosen box and score of every image, and the n_top
+        best candidate scores if ts has them, as CSV or binary table */
+{
+  OUT_BUFFER *ob = open_out_buffer(file);
+
+  if(!ob)
+    return(1);
+  if(format == BOX_TABLE_BINARY)
+    write_box_table_binary(ob, ts);
+  else
+    write_box_table_csv(ob, ts);
+  return(close_out_buffer(ob));
+}
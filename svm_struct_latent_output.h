@@ -0,0 +1,62 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_output.h                                         */
+/*                                                                      */
+/*   Buffered writers for the classifier output of Latent SVM^struct:   */
+/*   score files and best-box tables in CSV or binary form.             */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_OUTPUT
+#define SVM_STRUCT_LATENT_OUTPUT
+
+#include <stdint.h>
+
+#define BOX_TABLE_MAGIC   0x5842534cU  /* "LSBX" in little endian */
+#define BOX_TABLE_VERSION 1
+
+#define BOX_TABLE_CSV     0
+#define BOX_TABLE_BINARY  1
+
+/* Binary box table. The header is followed by the sections
+     int32_t best[n_imgs]              chosen candidate of every image
+     double  score[n_imgs]             its score
+     int32_t top_box[n_imgs*n_top]     best n_top candidates of every
+     double  top_score[n_imgs*n_top]   image, box -1 past the last one
+   each starting at an 8-byte aligned offset, in host byte order. */
+typedef struct box_table_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t n_imgs;
+  uint32_t n_top;
+  uint32_t reserved;
+  uint64_t best_off;
+  uint64_t score_off;
+  uint64_t top_box_off;
+  uint64_t top_score_off;
+} BOX_TABLE_HEADER;
+
+typedef struct out_buffer {
+  int    fd;
+  char   *buf;
+  size_t len;
+  size_t cap;
+  int    failed;
+} OUT_BUFFER;
+
+OUT_BUFFER *open_out_buffer(char *file);
+void out_bytes(OUT_BUFFER *ob, const void *data, size_t size);
+void out_char(OUT_BUFFER *ob, char c);
+void out_long(OUT_BUFFER *ob, long v);
+void out_fixed(OUT_BUFFER *ob, double v, int digits);
+int  close_out_buffer(OUT_BUFFER *ob);
+
+int write_score_file(char *file, TEST_SCORES *ts);
+int write_box_table(char *file, TEST_SCORES *ts, int format);
+
+#endif
@@ -0,0 +1,82 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_pack.c                                           */
+/*                                                                      */
+/*   Converts a text image manifest into the packed manifest format     */
+/*   that read_struct_examples() maps with a single mmap.               */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "svm_struct_latent_manifest.h"
+
+void read_input_parameters(int argc, char **argv, char *infile, char *outfile, int *with_area_ratios, int *with_norms);
+
+
+int main(int argc, char* argv[]) {
+  char infile[1024];
+  char outfile[1024];
+  int with_area_ratios, with_norms;
+  MANIFEST *mf;
+
+  read_input_parameters(argc,argv,infile,outfile,&with_area_ratios,&with_norms);
+
+  printf("Reading manifest..."); fflush(stdout);
+  mf = read_manifest_text(infile, with_area_ratios);
+  printf("done. %ld images (%ld positive, %ld negative)\n", mf->n_imgs, mf->n_pos, mf->n_neg);
+
+  if(with_norms) {
+    printf("Computing candidate norms..."); fflush(stdout);
+    compute_max_norms(mf);
+    printf("done.\n");
+  }
+
+  printf("Writing packed manifest..."); fflush(stdout);
+  if(write_manifest_packed(outfile, mf)) {
+    printf("\nError: failed to write %s\n", outfile);
+    exit(1);
+  }
+  printf("done.\n");
+
+  free_manifest(mf);
+
+  return(0);
+}
+
+
+void read_input_parameters(int argc, char **argv, char *infile, char *outfile, int *with_area_ratios, int *with_norms) {
+
+  long i;
+
+  /* set default */
+  *with_area_ratios = 1;
+  *with_norms = 0;
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 't': *with_area_ratios = 0; break;
+      case 'n': *with_norms = 1; break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  if (i+1>=argc) {
+    printf("\nNot enough input parameters!\n\n");
+    printf("usage: svm_struct_latent_pack [-t] [-n] manifest packed_manifest\n");
+    printf("       -t  manifest is a test manifest without area ratios\n");
+    printf("       -n  store the largest candidate norm of every image, used\n");
+    printf("           to prune images in top-K retrieval\n\n");
+    exit(0);
+  }
+
+  strcpy(infile, argv[i]);
+  strcpy(outfile, argv[i+1]);
+
+}
@@ -0,0 +1,102 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_parallel.c                                       */
+/*                                                                      */
+/*   Minimal pthread work sharing for Latent SVM^struct. Indices are    */
+/*   handed out one at a time from a shared counter, since the work     */
+/*   per index (reading and scoring one image) is large and uneven.     */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "svm_struct_latent_parallel.h"
+
+typedef struct parallel_job {
+  long          n;
+  long          next;       /* next index to hand out */
+  PARALLEL_BODY body;
+  void          *arg;
+} PARALLEL_JOB;
+
+typedef struct parallel_worker {
+  PARALLEL_JOB *job;
+  int          thread_id;
+} PARALLEL_WORKER;
+
+int resolve_thread_count(int n_threads)
+     /* a non-positive thread count selects one thread per online CPU */
+{
+  long ncpu;
+  if(n_threads > 0)
+    return(n_threads);
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  return((ncpu > 0) ? (int) ncpu : 1);
+}
+
+static void *parallel_worker_main(void *arg)
+{
+  PARALLEL_WORKER *worker = (PARALLEL_WORKER *) arg;
+  PARALLEL_JOB *job = worker->job;
+  long i;
+
+  while((i = __sync_fetch_and_add(&job->next, 1)) < job->n) {
+    job->body(i, worker->thread_id, job->arg);
+  }
+  return(NULL);
+}
+
+void parallel_for(long n, int n_threads, PARALLEL_BODY body, void *arg)
+     /* runs body(i) for all i in [0,n) on n_threads threads, the
+        calling thread being thread 0. Returns when all are done. */
+{
+  PARALLEL_JOB job;
+  PARALLEL_WORKER *workers;
+  pthread_t *threads;
+  int t, started;
+
+  n_threads = resolve_thread_count(n_threads);
+  if(n_threads > n)
+    n_threads = (int) n;
+  if(n_threads <= 1) {
+    long i;
+    for(i = 0; i < n; i++)
+      body(i, 0, arg);
+    return;
+  }
+
+  job.n = n;
+  job.next = 0;
+  job.body = body;
+  job.arg = arg;
+  workers = (PARALLEL_WORKER *) malloc(n_threads*sizeof(PARALLEL_WORKER));
+  threads = (pthread_t *) malloc(n_threads*sizeof(pthread_t));
+  if(!workers || !threads) {
+    perror("Out of memory!\n");
+    exit(1);
+  }
+
+  started = 1;
+  for(t = 0; t < n_threads; t++) {
+    workers[t].job = &job;
+    workers[t].thread_id = t;
+  }
+  for(t = 1; t < n_threads; t++) {
+    if(pthread_create(&threads[t], NULL, parallel_worker_main, &workers[t]))
+      break;  /* run with the threads we have */
+    started++;
+  }
+  parallel_worker_main(&workers[0]);
+  for(t = 1; t < started; t++)
+    pthread_join(threads[t], NULL);
+
+  free(workers);
+  free(threads);
+}
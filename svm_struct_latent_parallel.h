@@ -0,0 +1,24 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_parallel.h                                       */
+/*                                                                      */
+/*   Minimal pthread work sharing for Latent SVM^struct.                */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_PARALLEL
+#define SVM_STRUCT_LATENT_PARALLEL
+
+/* body of a parallel loop: called once for every index i in [0,n) by
+   the thread with the given id in [0,n_threads) */
+typedef void (*PARALLEL_BODY)(long i, int thread_id, void *arg);
+
+int  resolve_thread_count(int n_threads);
+void parallel_for(long n, int n_threads, PARALLEL_BODY body, void *arg);
+
+#endif
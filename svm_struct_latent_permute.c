@@ -0,0 +1,450 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_permute.c                                        */
+/*                                                                      */
+/*   Computes a feature permutation from the candidates of a training   */
+/*   manifest, for use with --P. Frequent features are moved to the    */
+/*   front of w, and the most frequent ones are packed into cache lines */
+/*   by co-occurrence, so that scoring a candidate touches fewer lines  */
+/*   of w. Optionally reports the lines touched and the cache misses    */
+/*   counted while scoring before and after the permutation.            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "svm_struct_latent_manifest.h"
+#include "svm_struct_latent_soa.h"
+#include "svm_struct_latent_kernels.h"
+
+#define LINE_FEATURES  8         /* doubles of w in a 64-byte cache line */
+#define COOC_CANDIDATES 2048     /* candidates sampled for co-occurrence */
+#define REPORT_ENTRIES 4000000L  /* feature entries kept for the report */
+#define REPORT_PASSES  20        /* scoring passes per measurement */
+#define REPORT_ROUNDS  5
+
+typedef struct permute_parm {
+  long feature_size;
+  int  with_area_ratios;
+  int  stride;          /* use every stride-th image */
+  long n_hot;           /* features placed by co-occurrence */
+  int  report;
+} PERMUTE_PARM;
+
+void read_input_parameters(int argc, char **argv, char *infile, char *outfile, PERMUTE_PARM *pp);
+
+static long   *freq;    /* candidates containing each feature, for the sort */
+
+static SOA_BLOCK *read_image(MANIFEST *mf, long i)
+{
+  SOA_BLOCK *b = read_feature_block(mf->pool+mf->name_offsets[i], mf->n_candidates[i]);
+
+  if(b == NULL) {
+    printf("\nError: Cannot read %d candidates from %s\n", mf->n_candidates[i], mf->pool+mf->name_offsets[i]);
+    exit(1);
+  }
+  return(b);
+}
+
+static int compare_frequency(const void *a, const void *b)
+     /* descending frequency, then ascending feature number */
+{
+  int32_t fa = *(const int32_t *) a, fb = *(const int32_t *) b;
+
+  if(freq[fa] != freq[fb])
+    return((freq[fa] < freq[fb]) ? 1 : -1);
+  return((fa > fb)-(fa < fb));
+}
+
+static long count_frequencies(MANIFEST *mf, PERMUTE_PARM *pp)
+     /* fills freq[1..feature_size] and returns the number of candidates */
+{
+  SOA_BLOCK *b;
+  long i, k, n_cands = 0;
+  int j;
+
+  for(i = 0; i < mf->n_imgs; i += pp->stride) {
+    b = read_image(mf, i);
+    for(j = 0; j < b->n_vecs; j++) {
+      for(k = 0; k < b->vecs[j].n; k++) {
+        if((b->vecs[j].wnum[k] > 0) && (b->vecs[j].wnum[k] <= pp->feature_size))
+          freq[b->vecs[j].wnum[k]]++;
+      }
+    }
+    n_cands += b->n_vecs;
+    free_soa_block(b);
+  }
+  return(n_cands);
+}
+
+static uint32_t *count_cooccurrences(MANIFEST *mf, PERMUTE_PARM *pp, long *hot_rank, long n_hot, long n_cands)
+     /* n_hot x n_hot matrix of how many sampled candidates contain both
+        of two hot features */
+{
+  uint32_t *co = (uint32_t *) my_malloc(n_hot*n_hot*sizeof(uint32_t));
+  long *present = (long *) my_malloc((n_hot > 0 ? n_hot : 1)*sizeof(long));
+  long cand_stride = (n_cands+COOC_CANDIDATES-1)/COOC_CANDIDATES;
+  long i, k, m, a, c = 0, f;
+  SOA_BLOCK *b;
+  int j;
+
+  memset(co, 0, n_hot*n_hot*sizeof(uint32_t));
+  if(cand_stride < 1)
+    cand_stride = 1;
+  for(i = 0; i < mf->n_imgs; i += pp->stride) {
+    b = read_image(mf, i);
+    for(j = 0; j < b->n_vecs; j++, c++) {
+      if(c % cand_stride)
+        continue;
+      for(m = 0, k = 0; k < b->vecs[j].n; k++) {
+        f = b->vecs[j].wnum[k];
+        if((f > 0) && (f <= pp->feature_size) && (hot_rank[f] >= 0))
+          present[m++] = hot_rank[f];
+      }
+      for(a = 0; a < m; a++) {
+        for(k = 0; k < m; k++)
+          co[present[a]*n_hot+present[k]]++;
+      }
+    }
+    free_soa_block(b);
+  }
+  free(present);
+  return(co);
+}
+
+static void pack_hot_lines(int32_t *order, long n_hot, uint32_t *co)
+     /* reorders the hot features order[0..n_hot) greedily: every cache
+        line is started with the most frequent feature left and filled
+        with the features that co-occur most often with those already
+        in the line */
+{
+  int32_t *packed = (int32_t *) my_malloc((n_hot > 0 ? n_hot : 1)*sizeof(int32_t));
+  double *affinity = (double *) my_malloc((n_hot > 0 ? n_hot : 1)*sizeof(double));
+  char *placed = (char *) my_malloc(n_hot > 0 ? n_hot : 1);
+  long next = 0, seed = 0, pos, r, best;
+  int slot;
+
+  memset(placed, 0, n_hot > 0 ? n_hot : 1);
+  while(next < n_hot) {
+    while(placed[seed])
+      seed++;
+    for(r = 0; r < n_hot; r++)
+      affinity[r] = 0;
+    best = seed;
+    /* the first line starts at w[1], as w[0] is never used */
+    for(slot = (next == 0) ? 1 : 0; (slot < LINE_FEATURES) && (next < n_hot); slot++) {
+      placed[best] = 1;
+      packed[next++] = order[best];
+      for(r = 0; r < n_hot; r++)
+        affinity[r] += co[best*n_hot+r]/(double) (co[r*n_hot+r]+1);
+      for(best = -1, r = seed; r < n_hot; r++) {
+        if(!placed[r] && ((best < 0) || (affinity[r] > affinity[best])))
+          best = r;
+      }
+      if(best < 0)
+        break;
+    }
+  }
+  for(pos = 0; pos < n_hot; pos++)
+    order[pos] = packed[pos];
+  free(packed);
+  free(affinity);
+  free(placed);
+}
+
+static int32_t *compute_permutation(MANIFEST *mf, PERMUTE_PARM *pp)
+{
+  long n = pp->feature_size, f, n_cands, n_hot, n_seen;
+  int32_t *order = (int32_t *) my_malloc(n*sizeof(int32_t));
+  int32_t *perm = (int32_t *) my_malloc((n+1)*sizeof(int32_t));
+  long *hot_rank = (long *) my_malloc((n+1)*sizeof(long));
+  uint32_t *co;
+
+  freq = (long *) my_malloc((n+1)*sizeof(long));
+  memset(freq, 0, (n+1)*sizeof(long));
+  printf("Counting feature frequencies..."); fflush(stdout);
+  n_cands = count_frequencies(mf, pp);
+  for(f = 1, n_seen = 0; f <= n; f++)
+    n_seen += (freq[f] > 0);
+  printf("done. %ld candidates, %ld of %ld features used\n", n_cands, n_seen, n);
+
+  for(f = 0; f < n; f++)
+    order[f] = f+1;
+  qsort(order, n, sizeof(int32_t), compare_frequency);
+
+  n_hot = (pp->n_hot < n_seen) ? pp->n_hot : n_seen;
+  for(f = 0; f <= n; f++)
+    hot_rank[f] = -1;
+  for(f = 0; f < n_hot; f++)
+    hot_rank[order[f]] = f;
+  printf("Counting co-occurrences of %ld features...", n_hot); fflush(stdout);
+  co = count_cooccurrences(mf, pp, hot_rank, n_hot, n_cands);
+  pack_hot_lines(order, n_hot, co);
+  printf("done.\n");
+
+  perm[0] = 0;
+  for(f = 0; f < n; f++)
+    perm[order[f]] = f+1;
+
+  free(co);
+  free(hot_rank);
+  free(order);
+  free(freq);
+  return(perm);
+}
+
+static void count_lines(SOA_BLOCK **blocks, long n_blocks, long n, double *per_cand, double *per_img)
+     /* average number of distinct cache lines of w touched by one
+        candidate and by all candidates of one image */
+{
+  long *cand_stamp = (long *) my_malloc((n/LINE_FEATURES+2)*sizeof(long));
+  long *img_stamp = (long *) my_malloc((n/LINE_FEATURES+2)*sizeof(long));
+  long i, k, line, c = 0, cand_lines = 0, img_lines = 0, n_cands = 0;
+  int j;
+
+  for(line = 0; line < n/LINE_FEATURES+2; line++)
+    cand_stamp[line] = img_stamp[line] = -1;
+  for(i = 0; i < n_blocks; i++) {
+    for(j = 0; j < blocks[i]->n_vecs; j++, c++) {
+      for(k = 0; k < blocks[i]->vecs[j].n; k++) {
+        if((blocks[i]->vecs[j].wnum[k] < 0) || (blocks[i]->vecs[j].wnum[k] > n))
+          continue;
+        line = blocks[i]->vecs[j].wnum[k]/LINE_FEATURES;
+        if(cand_stamp[line] != c) {
+          cand_stamp[line] = c;
+          cand_lines++;
+        }
+        if(img_stamp[line] != i) {
+          img_stamp[line] = i;
+          img_lines++;
+        }
+      }
+    }
+    n_cands += blocks[i]->n_vecs;
+  }
+  *per_cand = n_cands ? (double) cand_lines/n_cands : 0;
+  *per_img = n_blocks ? (double) img_lines/n_blocks : 0;
+  free(cand_stamp);
+  free(img_stamp);
+}
+
+static int open_counter(uint32_t type, uint64_t config)
+     /* a counter of this thread in user space, -1 if not available */
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return((int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+#define N_COUNTERS 3
+
+static const char *counter_names[N_COUNTERS] = { "L1D read misses", "LLC misses", "cycles" };
+
+static void score_all(SOA_BLOCK **blocks, long n_blocks, double *w, int *fd, long long *counts, double *seconds)
+     /* scores every candidate REPORT_PASSES times under the counters */
+{
+  struct timespec t0, t1;
+  volatile double sink = 0;
+  long long v;
+  long i, r;
+  int j, c;
+
+  for(c = 0; c < N_COUNTERS; c++) {
+    if(fd[c] >= 0) {
+      ioctl(fd[c], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(r = 0; r < REPORT_PASSES; r++) {
+    for(i = 0; i < n_blocks; i++) {
+      for(j = 0; j < blocks[i]->n_vecs; j++)
+        sink += sprod_ns_soa(w, &blocks[i]->vecs[j]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  for(c = 0; c < N_COUNTERS; c++) {
+    counts[c] = -1;
+    if(fd[c] >= 0) {
+      ioctl(fd[c], PERF_EVENT_IOC_DISABLE, 0);
+      if(read(fd[c], &v, sizeof(v)) == sizeof(v))
+        counts[c] = v;
+    }
+  }
+  *seconds = (t1.tv_sec-t0.tv_sec)+1e-9*(t1.tv_nsec-t0.tv_nsec);
+}
+
+static void report(MANIFEST *mf, PERMUTE_PARM *pp, int32_t *perm)
+     /* scores the candidates of the sampled images, as many as fit in
+        REPORT_ENTRIES, against a random w in both feature orders */
+{
+  long n = pp->feature_size, n_blocks = 0, entries = 0, i, f;
+  SOA_BLOCK **orig = (SOA_BLOCK **) my_malloc((mf->n_imgs+1)*sizeof(SOA_BLOCK *));
+  SOA_BLOCK **perm_blocks = (SOA_BLOCK **) my_malloc((mf->n_imgs+1)*sizeof(SOA_BLOCK *));
+  double *w = create_dense_vector(n), *wp = create_dense_vector(n);
+  double lines_cand[2], lines_img[2], seconds[2], t;
+  long long counts[2][N_COUNTERS], round_counts[N_COUNTERS];
+  int fd[N_COUNTERS];
+  int j, c, r, o;
+
+  for(i = 0; (i < mf->n_imgs) && (entries < REPORT_ENTRIES); i += pp->stride) {
+    orig[n_blocks] = read_image(mf, i);
+    set_feature_permutation(perm, n);
+    perm_blocks[n_blocks] = read_image(mf, i);
+    set_feature_permutation(NULL, 0);
+    for(j = 0; j < orig[n_blocks]->n_vecs; j++)
+      entries += orig[n_blocks]->vecs[j].n_pad;
+    n_blocks++;
+  }
+  srand(1);
+  for(f = 1; f <= n; f++)
+    w[f] = rand()/(double) RAND_MAX-0.5;
+  for(f = 1; f <= n; f++)
+    wp[perm[f]] = w[f];
+
+  count_lines(orig, n_blocks, n, &lines_cand[0], &lines_img[0]);
+  count_lines(perm_blocks, n_blocks, n, &lines_cand[1], &lines_img[1]);
+
+  fd[0] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  fd[1] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  fd[2] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  /* alternate between the orders, keep the fastest round and sum up
+     the counters; the first round only warms up */
+  memset(counts, 0, sizeof(counts));
+  for(r = 0; r <= REPORT_ROUNDS; r++) {
+    for(o = 0; o < 2; o++) {
+      score_all(o ? perm_blocks : orig, n_blocks, o ? wp : w, fd, round_counts, &t);
+      if(r == 0)
+        continue;
+      if((r == 1) || (t < seconds[o]))
+        seconds[o] = t;
+      for(c = 0; c < N_COUNTERS; c++)
+        counts[o][c] = ((counts[o][c] < 0) || (round_counts[c] < 0)) ? -1 : counts[o][c]+round_counts[c];
+    }
+  }
+
+  printf("\nReport on %ld images, %ld feature entries, %d rounds of %d scoring passes\n",
+         n_blocks, entries, REPORT_ROUNDS, REPORT_PASSES);
+  printf("%-24s %14s %14s %8s\n", "", "original", "permuted", "ratio");
+  printf("%-24s %14.1f %14.1f %8.3f\n", "w lines per candidate", lines_cand[0], lines_cand[1],
+         lines_cand[0] > 0 ? lines_cand[1]/lines_cand[0] : 0);
+  printf("%-24s %14.1f %14.1f %8.3f\n", "w lines per image", lines_img[0], lines_img[1],
+         lines_img[0] > 0 ? lines_img[1]/lines_img[0] : 0);
+  for(c = 0; c < N_COUNTERS; c++) {
+    if((counts[0][c] < 0) || (counts[1][c] < 0))
+      printf("%-24s %14s %14s %8s\n", counter_names[c], "n/a", "n/a", "");
+    else
+      printf("%-24s %14lld %14lld %8.3f\n", counter_names[c], counts[0][c], counts[1][c],
+             counts[0][c] > 0 ? (double) counts[1][c]/counts[0][c] : 0);
+  }
+  printf("%-24s %14.4f %14.4f %8.3f\n", "seconds per round", seconds[0], seconds[1],
+         seconds[0] > 0 ? seconds[1]/seconds[0] : 0);
+
+  for(c = 0; c < N_COUNTERS; c++) {
+    if(fd[c] >= 0)
+      close(fd[c]);
+  }
+  for(i = 0; i < n_blocks; i++) {
+    free_soa_block(orig[i]);
+    free_soa_block(perm_blocks[i]);
+  }
+  free(orig);
+  free(perm_blocks);
+  free(w);
+  free(wp);
+}
+
+
+int main(int argc, char* argv[]) {
+  char infile[1024];
+  char outfile[1024];
+  PERMUTE_PARM pp;
+  MANIFEST *mf;
+  int32_t *perm;
+
+  read_input_parameters(argc,argv,infile,outfile,&pp);
+
+  printf("Reading manifest..."); fflush(stdout);
+  mf = read_manifest(infile, pp.with_area_ratios);
+  printf("done. %ld images, using every %d-th\n", mf->n_imgs, pp.stride);
+
+  perm = compute_permutation(mf, &pp);
+
+  printf("Writing feature permutation..."); fflush(stdout);
+  if(write_feature_permutation(outfile, perm, pp.feature_size)) {
+    printf("\nError: failed to write %s\n", outfile);
+    exit(1);
+  }
+  printf("done.\n");
+
+  if(pp.report)
+    report(mf, &pp, perm);
+
+  free(perm);
+  free_manifest(mf);
+
+  return(0);
+}
+
+
+void read_input_parameters(int argc, char **argv, char *infile, char *outfile, PERMUTE_PARM *pp) {
+
+  long i;
+
+  /* set default */
+  pp->feature_size = 90112;
+  pp->with_area_ratios = 1;
+  pp->stride = 1;
+  pp->n_hot = 1024;
+  pp->report = 0;
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 'f': i++; pp->feature_size = atol(argv[i]); break;
+      case 't': pp->with_area_ratios = 0; break;
+      case 's': i++; pp->stride = atoi(argv[i]); break;
+      case 'h': i++; pp->n_hot = atol(argv[i]); break;
+      case 'r': pp->report = 1; break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  if ((i+1>=argc) || (pp->feature_size < 1) || (pp->stride < 1) || (pp->n_hot < 0)) {
+    printf("\nNot enough input parameters!\n\n");
+    printf("usage: svm_struct_latent_permute [options] manifest permutation\n");
+    printf("       -f n  number of features, as given with --f (default 90112)\n");
+    printf("       -t    manifest is a test manifest without area ratios\n");
+    printf("       -s k  collect statistics from every k-th image only (default 1)\n");
+    printf("       -h n  pack the n most frequent features into cache lines by\n");
+    printf("             co-occurrence (default 1024); the others follow by frequency\n");
+    printf("       -r    report lines of w touched, cache misses and time for\n");
+    printf("             scoring the candidates before and after the permutation\n\n");
+    printf("The permutation is used with --P in training and classification.\n");
+    printf("Checkpoints hold permuted vectors and must be resumed with the same\n");
+    printf("permutation; model files are always in the original feature order.\n\n");
+    exit(0);
+  }
+
+  strcpy(infile, argv[i]);
+  strcpy(outfile, argv[i+1]);
+
+}
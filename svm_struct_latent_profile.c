@@ -0,0 +1,373 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_profile.c                                        */
+/*                                                                      */
+/*   Hierarchical phase timers and event counters for the Latent        */
+/*   SVM^struct trainer. Timers form a tree that grows as phases are    */
+/*   entered, and only the thread that enabled profiling times phases;  */
+/*   counters and background times may come from any thread. Every      */
+/*   report prints the time spent in each phase since the last report   */
+/*   of its level, the summary prints the whole tree.                   */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "svm_struct_latent_profile.h"
+
+#define PROF_MAX_DEPTH 16
+#define PROF_ROOT      0
+
+typedef struct prof_node {
+  int    phase;          /* -1 for the root */
+  int    parent;
+  int    first_child;
+  int    next_sibling;
+  double seconds;        /* including the children */
+  long   calls;
+} PROF_NODE;
+
+static const char *phase_names[PROF_N_PHASES] = {
+  "ACS", "example selection", "cutting plane", "negative mining",
+  "positive imputation", "feature I/O", "parsing", "constraint",
+  "loss-augmented inference", "psi construction", "Gram update",
+  "QP solve", "cleanup", "objective", "snapshot writes", "checkpoint writes"
+};
+
+static const char *counter_names[PROF_N_COUNTERS] = {
+  "images", "candidates", "bytes read", "constraints"
+};
+
+/* the same names for machine-readable output */
+static const char *phase_keys[PROF_N_PHASES] = {
+  "acs", "selection", "cutting_plane", "neg_mining", "pos_imputation",
+  "feature_io", "parse", "constraint", "loss_aug", "psi", "gram", "qp",
+  "cleanup", "objective", "snapshot", "checkpoint"
+};
+
+static const char *counter_keys[PROF_N_COUNTERS] = {
+  "images", "candidates", "bytes_read", "constraints"
+};
+
+static const char *level_names[PROF_N_LEVELS] = {
+  "cutting plane", "ACS", "outer"
+};
+
+static int        enabled = 0;
+static pthread_t  owner;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static double     t_start;
+
+static PROF_NODE  nodes[PROF_MAX_NODES];
+static int        n_nodes = 0;
+static int        stack[PROF_MAX_DEPTH];
+static int        phases[PROF_MAX_DEPTH];
+static double     entered[PROF_MAX_DEPTH];
+static int        depth = 0;
+static int        paused = 0;  /* prof_begin() and prof_end() are ignored */
+static long       counts[PROF_N_COUNTERS];
+
+/* state at the last report of each level */
+static PROF_MARK  marks[PROF_N_LEVELS];
+
+double prof_now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return(t.tv_sec+1e-9*t.tv_nsec);
+}
+
+static int new_node(int parent, int phase)
+     /* returns -1 if the tree is full; children are kept in the order
+        they are first entered. Called with the lock held, as
+        prof_add_time() adds nodes from other threads */
+{
+  int k, *c;
+
+  if(n_nodes == PROF_MAX_NODES)
+    return(-1);
+  k = n_nodes;
+  nodes[k].phase = phase;
+  nodes[k].parent = parent;
+  nodes[k].first_child = -1;
+  nodes[k].next_sibling = -1;
+  nodes[k].seconds = 0;
+  nodes[k].calls = 0;
+  n_nodes = k+1;
+  if(parent >= 0) {
+    c = &nodes[parent].first_child;
+    while(*c >= 0)
+      c = &nodes[*c].next_sibling;
+    *c = k;
+  }
+  return(k);
+}
+
+static int child_node(int parent, int phase)
+{
+  int k;
+
+  for(k = nodes[parent].first_child; k >= 0; k = nodes[k].next_sibling) {
+    if(nodes[k].phase == phase)
+      return(k);
+  }
+  return(new_node(parent, phase));
+}
+
+void profile_enable(void)
+{
+  int l;
+
+  owner = pthread_self();
+  n_nodes = 0;
+  new_node(-1, -1);
+  stack[0] = PROF_ROOT;
+  depth = 1;
+  memset(counts, 0, sizeof(counts));
+  t_start = prof_now();
+  enabled = 1;
+  for(l = 0; l < PROF_N_LEVELS; l++)
+    prof_mark(&marks[l]);
+}
+
+int profile_enabled(void)
+{
+  return(enabled);
+}
+
+void prof_begin(PROF_PHASE p)
+     /* a full tree or stack times the phase as part of its parent */
+{
+  int k;
+
+  if(!enabled || paused || !pthread_equal(pthread_self(), owner))
+    return;
+  if(depth >= PROF_MAX_DEPTH) {
+    depth++;
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  k = (stack[depth-1] >= 0) ? child_node(stack[depth-1], p) : -1;
+  pthread_mutex_unlock(&lock);
+  stack[depth] = k;
+  phases[depth] = p;
+  entered[depth] = prof_now();
+  depth++;
+}
+
+void prof_end(PROF_PHASE p)
+{
+  int k;
+
+  if(!enabled || paused || !pthread_equal(pthread_self(), owner) || (depth <= 1))
+    return;
+  depth--;
+  if(depth >= PROF_MAX_DEPTH)
+    return;
+  k = stack[depth];
+  if(k >= 0) {
+    nodes[k].seconds += prof_now()-entered[depth];
+    nodes[k].calls++;
+  }
+}
+
+void prof_pause(void)
+     /* for a region whose work is shared by several threads: the phases
+        inside it would only be timed for the share of this thread, so
+        the caller times the whole region as one phase instead */
+{
+  if(enabled && pthread_equal(pthread_self(), owner))
+    paused++;
+}
+
+void prof_resume(void)
+{
+  if(enabled && pthread_equal(pthread_self(), owner) && (paused > 0))
+    paused--;
+}
+
+int prof_current_phase(void)
+     /* the innermost running phase, -1 outside all phases or if timing
+        is off, PROF_N_PHASES on other threads than the timed one */
+{
+  int d;
+
+  if(!enabled)
+    return(-1);
+  if(!pthread_equal(pthread_self(), owner))
+    return(PROF_N_PHASES);
+  d = (depth > PROF_MAX_DEPTH) ? PROF_MAX_DEPTH : depth;
+  return((d > 1) ? phases[d-1] : -1);
+}
+
+void prof_add_time(PROF_PHASE p, double seconds)
+     /* time of a phase that ran on another thread, e.g. a background
+        snapshot write; it is counted directly below the root */
+{
+  int k;
+
+  if(!enabled)
+    return;
+  pthread_mutex_lock(&lock);
+  k = child_node(PROF_ROOT, p);
+  if(k >= 0) {
+    nodes[k].seconds += seconds;
+    nodes[k].calls++;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void prof_count(PROF_COUNTER c, long n)
+{
+  if(enabled)
+    __sync_fetch_and_add(&counts[c], n);
+}
+
+void prof_set(PROF_COUNTER c, long n)
+{
+  if(enabled)
+    counts[c] = n;
+}
+
+static void current_seconds(double *seconds, double now)
+     /* inclusive times with the phases that are running counted up to
+        now */
+{
+  int k, d;
+
+  for(k = 0; k < n_nodes; k++)
+    seconds[k] = nodes[k].seconds;
+  for(d = 1; (d < depth) && (d < PROF_MAX_DEPTH); d++) {
+    if(stack[d] >= 0)
+      seconds[stack[d]] += now-entered[d];
+  }
+}
+
+static double self_seconds(int k, double *seconds)
+{
+  double s = seconds[k];
+  int c;
+
+  for(c = nodes[k].first_child; c >= 0; c = nodes[c].next_sibling)
+    s -= seconds[c];
+  return(s);
+}
+
+void prof_mark(PROF_MARK *mark)
+     /* the nodes that do not exist yet have no time */
+{
+  int c;
+
+  memset(mark, 0, sizeof(PROF_MARK));
+  mark->time = prof_now();
+  if(!enabled)
+    return;
+  pthread_mutex_lock(&lock);
+  current_seconds(mark->seconds, mark->time);
+  pthread_mutex_unlock(&lock);
+  for(c = 0; c < PROF_N_COUNTERS; c++)
+    mark->counts[c] = counts[c];
+}
+
+void prof_interval(PROF_MARK *mark, double *phase_seconds, long *count_delta, double *elapsed)
+     /* time spent in each phase itself, without its children, and
+        counter increments since mark, which is then moved to now; the
+        constraints gauge is returned as is */
+{
+  double seconds[PROF_MAX_NODES], delta[PROF_MAX_NODES], now = prof_now();
+  int k, c;
+
+  pthread_mutex_lock(&lock);
+  current_seconds(seconds, now);
+  for(k = 0; k < n_nodes; k++) {
+    delta[k] = seconds[k]-mark->seconds[k];
+    mark->seconds[k] = seconds[k];
+  }
+  for(k = 0; k < PROF_N_PHASES; k++)
+    phase_seconds[k] = 0;
+  for(k = 1; k < n_nodes; k++)
+    phase_seconds[nodes[k].phase] += self_seconds(k, delta);
+  pthread_mutex_unlock(&lock);
+  for(c = 0; c < PROF_N_COUNTERS; c++) {
+    count_delta[c] = (c == PROF_CONSTRAINTS) ? counts[c] : counts[c]-mark->counts[c];
+    mark->counts[c] = counts[c];
+  }
+  *elapsed = now-mark->time;
+  mark->time = now;
+}
+
+const char *prof_phase_key(PROF_PHASE p)
+{
+  return(phase_keys[p]);
+}
+
+const char *prof_counter_key(PROF_COUNTER c)
+{
+  return(counter_keys[c]);
+}
+
+void prof_report(PROF_LEVEL level, const char *what, long iter)
+     /* one line with the phases that took time since the last report
+        of this level */
+{
+  double phase_seconds[PROF_N_PHASES], elapsed;
+  long count_delta[PROF_N_COUNTERS];
+  int k, c;
+
+  if(!enabled)
+    return;
+  prof_interval(&marks[level], phase_seconds, count_delta, &elapsed);
+  printf("PROFILE %s %ld: %.3fs", what ? what : level_names[level], iter, elapsed);
+  for(k = 0; k < PROF_N_PHASES; k++) {
+    if(phase_seconds[k] >= 0.0005)
+      printf(", %s %.3fs", phase_names[k], phase_seconds[k]);
+  }
+  for(c = 0; c < PROF_N_COUNTERS; c++) {
+    if(count_delta[c])
+      printf(", %s %ld", counter_names[c], count_delta[c]);
+  }
+  printf("\n"); fflush(stdout);
+}
+
+static void print_node(int k, int indent, double *seconds, double total)
+{
+  int c;
+
+  printf("  %*s%-*s %10.3fs %6.1f%% %10ld\n", 2*indent, "", 36-2*indent, phase_names[nodes[k].phase],
+         seconds[k], total > 0 ? 100*seconds[k]/total : 0, nodes[k].calls);
+  for(c = nodes[k].first_child; c >= 0; c = nodes[c].next_sibling)
+    print_node(c, indent+1, seconds, total);
+}
+
+void prof_summary(void)
+     /* the whole tree with inclusive times */
+{
+  double seconds[PROF_MAX_NODES], now, total, tracked = 0;
+  int k, c;
+
+  if(!enabled)
+    return;
+  now = prof_now();
+  total = now-t_start;
+  pthread_mutex_lock(&lock);
+  current_seconds(seconds, now);
+  printf("PROFILE SUMMARY\n");
+  printf("  %-36s %11s %7s %10s\n", "phase", "time", "share", "calls");
+  for(k = nodes[PROF_ROOT].first_child; k >= 0; k = nodes[k].next_sibling) {
+    print_node(k, 0, seconds, total);
+    tracked += seconds[k];
+  }
+  pthread_mutex_unlock(&lock);
+  printf("  %-36s %10.3fs %6.1f%%\n", "other", total-tracked, total > 0 ? 100*(total-tracked)/total : 0);
+  printf("  %-36s %10.3fs\n", "total", total);
+  for(c = 0; c < PROF_N_COUNTERS; c++)
+    printf("  %-36s %11ld\n", counter_names[c], counts[c]);
+  fflush(stdout);
+}
@@ -0,0 +1,84 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_profile.h                                        */
+/*                                                                      */
+/*   Hierarchical phase timers and event counters for the Latent        */
+/*   SVM^struct trainer.                                                */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_PROFILE
+#define SVM_STRUCT_LATENT_PROFILE
+
+/* Timed phases. A phase entered while another one is running is timed
+   as its child, so the same phase can appear under several parents,
+   e.g. feature I/O under negative mining and positive imputation. */
+typedef enum prof_phase {
+  PROF_ACS,             /* one alternate convex search */
+  PROF_SELECTION,       /* self-paced selection of examples */
+  PROF_CUTTING_PLANE,   /* one run of the cutting-plane solver */
+  PROF_NEG_MINING,      /* latent boxes of the negative images */
+  PROF_POS_IMPUTATION,  /* latent boxes of the positive images */
+  PROF_FEATURE_IO,      /* reading feature files */
+  PROF_PARSE,           /* parsing feature files */
+  PROF_CONSTRAINT,      /* building one cutting plane */
+  PROF_LOSS_AUG,        /* loss-augmented inference */
+  PROF_PSI,             /* psi construction */
+  PROF_GRAM,            /* Gram matrix update */
+  PROF_QP,              /* QP solve */
+  PROF_CLEANUP,         /* removing idle constraints */
+  PROF_OBJECTIVE,       /* primal objective */
+  PROF_SNAPSHOT,        /* model snapshot writes, also in the background */
+  PROF_CHECKPOINT,      /* checkpoint writes */
+  PROF_N_PHASES
+} PROF_PHASE;
+
+typedef enum prof_counter {
+  PROF_IMAGES,          /* images whose candidates were scored */
+  PROF_CANDIDATES,      /* candidates scored */
+  PROF_BYTES_READ,      /* bytes of feature files read */
+  PROF_CONSTRAINTS,     /* constraints in the working set, a gauge */
+  PROF_N_COUNTERS
+} PROF_COUNTER;
+
+/* iteration levels that are reported separately */
+typedef enum prof_level {
+  PROF_LEVEL_CUTTING_PLANE,
+  PROF_LEVEL_ACS,
+  PROF_LEVEL_OUTER,
+  PROF_N_LEVELS
+} PROF_LEVEL;
+
+#define PROF_MAX_NODES 128
+
+/* timers and counters at some point, to report what happened since */
+typedef struct prof_mark {
+  double seconds[PROF_MAX_NODES];
+  long   counts[PROF_N_COUNTERS];
+  double time;
+} PROF_MARK;
+
+void profile_enable(void);
+int  profile_enabled(void);
+void prof_begin(PROF_PHASE p);
+void prof_end(PROF_PHASE p);
+void prof_pause(void);
+void prof_resume(void);
+int  prof_current_phase(void);
+void prof_add_time(PROF_PHASE p, double seconds);
+void prof_count(PROF_COUNTER c, long n);
+void prof_set(PROF_COUNTER c, long n);
+void prof_mark(PROF_MARK *mark);
+void prof_interval(PROF_MARK *mark, double *self_seconds, long *counts, double *elapsed);
+void prof_report(PROF_LEVEL level, const char *what, long iter);
+const char *prof_phase_key(PROF_PHASE p);
+const char *prof_counter_key(PROF_COUNTER c);
+void prof_summary(void);
+double prof_now(void);
+
+#endif
@@ -0,0 +1,481 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_score.c                                          */
+/*                                                                      */
+/*   Parallel test-time scoring engine for Latent SVM^struct. Every     */
+/*   image is read, its latent box inferred and its final score taken   */
+/*   in one pass, with images distributed over worker threads.          */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_parallel.h"
+#include "svm_struct_latent_eval.h"
+#include "svm_struct_latent_score.h"
+
+#define PROGRESS_INTERVAL 1000
+#define MODEL_TILE        8     /* models accumulated together in registers */
+#define BOUND_SLACK       1e-9  /* relative margin on score bounds for rounding */
+
+typedef struct score_job {
+  PATTERN     *x;
+  STRUCTMODEL *sm;
+  MODEL_BANK  *bank;
+  TEST_SCORES *ts;
+  long        done;
+} SCORE_JOB;
+
+static void report_progress(SCORE_JOB *job)
+{
+  long done = __sync_add_and_fetch(&job->done, 1);
+  if((done % PROGRESS_INTERVAL) == 0) {
+    printf("%ld images scored\n", done); fflush(stdout);
+  }
+}
+
+static void select_top_boxes(double *cand, int n_candidates, int n_top, int *top_box, double *top_scores)
+     /* the n_top highest candidate scores by decreasing score, ties by
+        increasing box index; missing entries are box -1 */
+{
+  int j, r;
+
+  for(r = 0; r < n_top; r++) {
+    top_box[r] = -1;
+    top_scores[r] = 0;
+  }
+  for(j = 0; j < n_candidates; j++) {
+    r = (j < n_top) ? j : n_top;
+    if((r == n_top) && !(cand[j] > top_scores[n_top-1]))
+      continue;
+    if(r == n_top)
+      r--;
+    while((r > 0) && (cand[j] > top_scores[r-1])) {
+      top_box[r] = top_box[r-1];
+      top_scores[r] = top_scores[r-1];
+      r--;
+    }
+    top_box[r] = j;
+    top_scores[r] = cand[j];
+  }
+}
+
+static void score_image_body(long i, int thread_id, void *arg)
+{
+  SCORE_JOB *job = (SCORE_JOB *) arg;
+  TEST_SCORES *ts = job->ts;
+  SUB_PATTERN *x_i = &job->x->x_is[i];
+  double *cand;
+
+  if(ts->n_top == 0) {
+    ts->scores[i] = score_test_image(x_i, job->sm, &ts->best[i], NULL);
+  }
+  else {
+    cand = (double *) my_malloc(x_i->n_candidates*sizeof(double));
+    ts->scores[i] = score_test_image(x_i, job->sm, &ts->best[i], cand);
+    select_top_boxes(cand, x_i->n_candidates, ts->n_top, ts->top_box+i*ts->n_top, ts->top_scores+i*ts->n_top);
+    free(cand);
+  }
+  report_progress(job);
+}
+
+static TEST_SCORES *create_test_scores(long n_imgs, long n_models)
+{
+  TEST_SCORES *ts = (TEST_SCORES *) my_malloc(sizeof(TEST_SCORES));
+
+  ts->n_imgs = n_imgs;
+  ts->n_models = n_models;
+  ts->best = (int *) my_malloc(n_imgs*n_models*sizeof(int));
+  ts->scores = (double *) my_malloc(n_imgs*n_models*sizeof(double));
+  ts->n_top = 0;
+  ts->top_box = NULL;
+  ts->top_scores = NULL;
+  return(ts);
+}
+
+static void bank_sprod(MODEL_BANK *bank, SVECTOR_SOA *f, double *out)
+     /* out[k] = <w_k,f> for every model k of the bank. Within a tile
+        of MODEL_TILE models, every model has the SOA_WIDTH partial
+        sums of sprod_ns_soa(), filled and added up in the same order,
+        so each score is exactly the one of a single model. */
+{
+  long M = bank->n_models;
+  long m, t, tile, i;
+  double acc[SOA_WIDTH][MODEL_TILE];
+  const double *row;
+  double weight;
+  int k;
+
+  for(m = 0; m < M; m += MODEL_TILE) {
+    tile = (M-m < MODEL_TILE) ? M-m : MODEL_TILE;
+    memset(acc, 0, sizeof(acc));
+    for(i = 0; i < f->n_pad; i += SOA_WIDTH) {
+      for(k = 0; k < SOA_WIDTH; k++) {
+        if(f->wnum[i+k] > bank->sizePsi) continue;
+        row = bank->W+f->wnum[i+k]*M+m;
+        weight = f->weight[i+k];
+        if(tile == MODEL_TILE) {
+          for(t = 0; t < MODEL_TILE; t++)
+            acc[k][t] += row[t]*weight;
+        }
+        else {
+          for(t = 0; t < tile; t++)
+            acc[k][t] += row[t]*weight;
+        }
+      }
+    }
+    for(t = 0; t < tile; t++)
+      out[m+t] = ((acc[0][t]+acc[4][t])+(acc[1][t]+acc[5][t]))
+                +((acc[2][t]+acc[6][t])+(acc[3][t]+acc[7][t]));
+  }
+}
+
+static void score_image_bank_body(long i, int thread_id, void *arg)
+     /* reads the candidates of image i once and picks the best one for
+        every model, with the same rules as score_test_image() */
+{
+  SCORE_JOB *job = (SCORE_JOB *) arg;
+  SUB_PATTERN *x_i = &job->x->x_is[i];
+  long M = job->bank->n_models;
+  int *best = job->ts->best+i*M;
+  double *maxScore = job->ts->scores+i*M;
+  double *cand = (double *) my_malloc(M*sizeof(double));
+  SOA_BLOCK *cands = readFeatureBlock(x_i->file_name, x_i->n_candidates);
+  long k;
+  int j;
+
+  for(k = 0; k < M; k++) {
+    best[k] = -1;
+    maxScore[k] = -DBL_MAX;
+  }
+  for(j = 0; j < x_i->n_candidates; j++) {
+    bank_sprod(job->bank, &cands->vecs[j], cand);
+    for(k = 0; k < M; k++) {
+      if((cand[k] != 0) && (cand[k] > maxScore[k])) {
+        maxScore[k] = cand[k];
+        best[k] = j;
+      }
+    }
+  }
+  for(k = 0; k < M; k++) {
+    if(best[k] < 0) {
+      best[k] = 0;
+      maxScore[k] = 0;
+    }
+  }
+  free_soa_block(cands);
+  free(cand);
+  report_progress(job);
+}
+
+TEST_SCORES *score_test_images(PATTERN *x, STRUCTMODEL *sm, int n_top, int n_threads)
+     /* scores every image of x with the model in sm, keeping the n_top
+        best candidate scores of each image if n_top > 0. Each slot of
+        the result is written by exactly one thread, so the output is
+        in input order regardless of the number of threads. */
+{
+  SCORE_JOB job;
+  TEST_SCORES *ts = create_test_scores(x->n_pos+x->n_neg, 1);
+
+  if(n_top > 0) {
+    ts->n_top = n_top;
+    ts->top_box = (int *) my_malloc(ts->n_imgs*n_top*sizeof(int));
+    ts->top_scores = (double *) my_malloc(ts->n_imgs*n_top*sizeof(double));
+  }
+
+  job.x = x;
+  job.sm = sm;
+  job.bank = NULL;
+  job.ts = ts;
+  job.done = 0;
+  parallel_for(ts->n_imgs, n_threads, score_image_body, &job);
+
+  return(ts);
+}
+
+TEST_SCORES *score_test_images_bank(PATTERN *x, MODEL_BANK *bank, int n_threads)
+     /* scores every image of x under all models of the bank, reading
+        each feature file only once */
+{
+  SCORE_JOB job;
+  TEST_SCORES *ts = create_test_scores(x->n_pos+x->n_neg, bank->n_models);
+
+  job.x = x;
+  job.sm = NULL;
+  job.bank = bank;
+  job.ts = ts;
+  job.done = 0;
+  parallel_for(ts->n_imgs, n_threads, score_image_bank_body, &job);
+
+  return(ts);
+}
+
+MODEL_BANK *read_model_bank(char *listfile, long sizePsi, STRUCT_LEARN_PARM *sparm)
+     /* reads the models named in listfile, one file name per line, into
+        a feature major weight matrix with sizePsi features */
+{
+  MODEL_BANK *bank;
+  STRUCTMODEL sm;
+  FILE *fp;
+  char line[1024];
+  long k, f, cap, len;
+
+  fp = fopen(listfile, "r");
+  if(fp == NULL) {
+    printf("Cannot open model list %s for input!", listfile);
+    exit(1);
+  }
+  bank = (MODEL_BANK *) my_malloc(sizeof(MODEL_BANK));
+  bank->n_models = 0;
+  bank->sizePsi = sizePsi;
+  cap = 16;
+  bank->files = (char **) my_malloc(cap*sizeof(char *));
+  while(fgets(line, sizeof(line), fp)) {
+    len = strlen(line);
+    while((len > 0) && isspace((unsigned char) line[len-1]))
+      line[--len] = '\0';
+    if(len == 0)
+      continue;
+    if(bank->n_models == cap) {
+      cap *= 2;
+      bank->files = (char **) realloc(bank->files, cap*sizeof(char *));
+      if(!bank->files) {
+        perror("Out of memory!\n");
+        exit(1);
+      }
+    }
+    bank->files[bank->n_models] = (char *) my_malloc(len+1);
+    strcpy(bank->files[bank->n_models], line);
+    bank->n_models++;
+  }
+  fclose(fp);
+  if(bank->n_models == 0) {
+    printf("Model list %s is empty!\n", listfile);
+    exit(1);
+  }
+
+  bank->W = (double *) my_malloc((sizePsi+1)*bank->n_models*sizeof(double));
+  memset(bank->W, 0, (sizePsi+1)*bank->n_models*sizeof(double));
+  for(k = 0; k < bank->n_models; k++) {
+    sm = read_struct_model(bank->files[k], sparm);
+    for(f = 1; (f <= sm.sizePsi) && (f <= sizePsi); f++)
+      bank->W[f*bank->n_models+k] = sm.w[f];
+    free_struct_model(sm, sparm);
+  }
+  return(bank);
+}
+
+void free_model_bank(MODEL_BANK *bank)
+{
+  long k;
+  if(!bank)
+    return;
+  for(k = 0; k < bank->n_models; k++)
+    free(bank->files[k]);
+  free(bank->files);
+  free(bank->W);
+  free(bank);
+}
+
+void free_test_scores(TEST_SCORES *ts)
+{
+  if(!ts)
+    return;
+  free(ts->best);
+  free(ts->scores);
+  free(ts->top_box);
+  free(ts->top_scores);
+  free(ts);
+}
+
+typedef struct heap_item {
+  double score;
+  long   img;
+  int    best;
+} HEAP_ITEM;
+
+typedef struct top_k_job {
+  PATTERN     *x;
+  STRUCTMODEL *sm;
+  double      *bound;       /* upper bound on the score of every image */
+  long        *order;       /* images by decreasing bound */
+  long        k;
+  HEAP_ITEM   **heaps;      /* one bounded min-heap per thread */
+  long        *heap_n;
+  double      threshold;    /* largest k-th best score of any thread */
+  pthread_mutex_t lock;
+  long        n_scored;
+  long        n_pruned;
+} TOP_K_JOB;
+
+static int ranks_below(HEAP_ITEM *a, HEAP_ITEM *b)
+     /* images rank by decreasing score, ties by increasing index */
+{
+  return((a->score < b->score) || ((a->score == b->score) && (a->img > b->img)));
+}
+
+static void heap_offer(HEAP_ITEM *h, long *n, long k, HEAP_ITEM *it)
+     /* keeps the k best items offered so far, the worst at the root */
+{
+  HEAP_ITEM tmp;
+  long i, c;
+
+  if(*n < k) {
+    i = (*n)++;
+    h[i] = *it;
+    while((i > 0) && ranks_below(&h[i], &h[(i-1)/2])) {
+      tmp = h[i]; h[i] = h[(i-1)/2]; h[(i-1)/2] = tmp;
+      i = (i-1)/2;
+    }
+    return;
+  }
+  if(!ranks_below(&h[0], it))
+    return;
+  h[0] = *it;
+  i = 0;
+  while((c = 2*i+1) < k) {
+    if((c+1 < k) && ranks_below(&h[c+1], &h[c]))
+      c++;
+    if(!ranks_below(&h[c], &h[i]))
+      break;
+    tmp = h[i]; h[i] = h[c]; h[c] = tmp;
+    i = c;
+  }
+}
+
+static void top_k_body(long r, int thread_id, void *arg)
+{
+  TOP_K_JOB *job = (TOP_K_JOB *) arg;
+  long i = job->order[r];
+  HEAP_ITEM it, *h = job->heaps[thread_id];
+  double threshold;
+
+  __atomic_load(&job->threshold, &threshold, __ATOMIC_RELAXED);
+  if(job->bound[i] < threshold) {
+    __sync_add_and_fetch(&job->n_pruned, 1);
+    return;
+  }
+
+  it.img = i;
+  it.score = score_test_image(&job->x->x_is[i], job->sm, &it.best, NULL);
+  __sync_add_and_fetch(&job->n_scored, 1);
+  heap_offer(h, &job->heap_n[thread_id], job->k, &it);
+
+  /* a full heap of any thread bounds the global k-th best score */
+  if((job->heap_n[thread_id] == job->k) && (h[0].score > threshold)) {
+    pthread_mutex_lock(&job->lock);
+    if(h[0].score > job->threshold)
+      __atomic_store(&job->threshold, &h[0].score, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&job->lock);
+  }
+}
+
+static int compare_heap_items(const void *a, const void *b)
+{
+  if(ranks_below((HEAP_ITEM *) a, (HEAP_ITEM *) b)) return(1);
+  if(ranks_below((HEAP_ITEM *) b, (HEAP_ITEM *) a)) return(-1);
+  return(0);
+}
+
+TOP_K *score_top_k(PATTERN *x, STRUCTMODEL *sm, double *max_norms, long k, int n_threads)
+     /* returns the k best scoring images of x. With the largest
+        candidate norm of every image, images are visited in decreasing
+        order of the bound |w| max_norm on their score and skipped
+        unread once the bound falls below the k-th best score found so
+        far. The result is the same as ranking all scores. */
+{
+  TOP_K_JOB job;
+  TOP_K *tk;
+  HEAP_ITEM *all;
+  double wnorm = 0;
+  long n = x->n_pos+x->n_neg;
+  long i, t, m;
+
+  n_threads = resolve_thread_count(n_threads);
+  if(k > n) k = n;
+  if(k < 1) k = 1;
+
+  job.x = x;
+  job.sm = sm;
+  job.k = k;
+  job.threshold = -DBL_MAX;
+  job.n_scored = 0;
+  job.n_pruned = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  job.bound = (double *) my_malloc(n*sizeof(double));
+  job.order = (long *) my_malloc(n*sizeof(long));
+  if(max_norms) {
+    /* the norm of the weights the candidates are scored with */
+    for(i = 1; i <= sm->sizePsi; i++)
+      wnorm += sm->w_float ? (double) sm->w_float[i]*sm->w_float[i] : sm->w[i]*sm->w[i];
+    wnorm = sqrt(wnorm);
+    for(i = 0; i < n; i++)
+      job.bound[i] = wnorm*max_norms[i]*(1+BOUND_SLACK);
+    rank_by_score(job.bound, n, job.order);
+  }
+  else {
+    for(i = 0; i < n; i++) {
+      job.bound[i] = DBL_MAX;
+      job.order[i] = i;
+    }
+  }
+  job.heaps = (HEAP_ITEM **) my_malloc(n_threads*sizeof(HEAP_ITEM *));
+  job.heap_n = (long *) my_malloc(n_threads*sizeof(long));
+  for(t = 0; t < n_threads; t++) {
+    job.heaps[t] = (HEAP_ITEM *) my_malloc(k*sizeof(HEAP_ITEM));
+    job.heap_n[t] = 0;
+  }
+
+  parallel_for(n, n_threads, top_k_body, &job);
+
+  /* the k best of all images are among the k best of every thread */
+  all = (HEAP_ITEM *) my_malloc(n_threads*k*sizeof(HEAP_ITEM));
+  m = 0;
+  for(t = 0; t < n_threads; t++) {
+    for(i = 0; i < job.heap_n[t]; i++)
+      all[m++] = job.heaps[t][i];
+    free(job.heaps[t]);
+  }
+  qsort(all, m, sizeof(HEAP_ITEM), compare_heap_items);
+
+  tk = (TOP_K *) my_malloc(sizeof(TOP_K));
+  tk->k = (m < k) ? m : k;
+  tk->img = (long *) my_malloc(k*sizeof(long));
+  tk->best = (int *) my_malloc(k*sizeof(int));
+  tk->scores = (double *) my_malloc(k*sizeof(double));
+  for(i = 0; i < tk->k; i++) {
+    tk->img[i] = all[i].img;
+    tk->best[i] = all[i].best;
+    tk->scores[i] = all[i].score;
+  }
+  tk->n_scored = job.n_scored;
+  tk->n_pruned = job.n_pruned;
+
+  free(all);
+  free(job.heaps);
+  free(job.heap_n);
+  free(job.bound);
+  free(job.order);
+  pthread_mutex_destroy(&job.lock);
+  return(tk);
+}
+
+void free_top_k(TOP_K *tk)
+{
+  if(!tk)
+    return;
+  free(tk->img);
+  free(tk->best);
+  free(tk->scores);
+  free(tk);
+}
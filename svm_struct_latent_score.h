@@ -0,0 +1,58 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_score.h                                          */
+/*                                                                      */
+/*   Parallel test-time scoring engine for Latent SVM^struct.           */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_SCORE
+#define SVM_STRUCT_LATENT_SCORE
+
+typedef struct test_scores {
+  long   n_imgs;
+  long   n_models;
+  int    *best;      /* index of the best candidate box, best[i*n_models+k]
+                        for image i under model k */
+  double *scores;    /* score of that candidate, in input order */
+  int    n_top;      /* candidates kept per image, 0 if none */
+  int    *top_box;   /* top_box[i*n_top+r]: candidate of rank r in image i,
+                        -1 past the last candidate */
+  double *top_scores;
+} TEST_SCORES;
+
+/* A bank of models scored together. The weights are stored feature
+   major, W[f*n_models+k] being weight f of model k, so that one
+   feature of a candidate updates the scores of all models from a
+   single contiguous row. */
+typedef struct model_bank {
+  long   n_models;
+  long   sizePsi;
+  double *W;
+  char   **files;
+} MODEL_BANK;
+
+/* The K best scoring images, by decreasing score. */
+typedef struct top_k {
+  long   k;          /* images returned */
+  long   *img;       /* image indices */
+  int    *best;      /* best candidate box of each */
+  double *scores;
+  long   n_scored;   /* images whose features were read */
+  long   n_pruned;   /* images skipped by their score bound */
+} TOP_K;
+
+TEST_SCORES *score_test_images(PATTERN *x, STRUCTMODEL *sm, int n_top, int n_threads);
+TEST_SCORES *score_test_images_bank(PATTERN *x, MODEL_BANK *bank, int n_threads);
+void        free_test_scores(TEST_SCORES *ts);
+MODEL_BANK  *read_model_bank(char *listfile, long sizePsi, STRUCT_LEARN_PARM *sparm);
+void        free_model_bank(MODEL_BANK *bank);
+TOP_K       *score_top_k(PATTERN *x, STRUCTMODEL *sm, double *max_norms, long k, int n_threads);
+void        free_top_k(TOP_K *tk);
+
+#endif
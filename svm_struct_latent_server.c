@@ -0,0 +1,905 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_server.c                                         */
+/*                                                                      */
+/*   Resident scoring server for Latent SVM^struct. The model stays     */
+/*   loaded, a dispatcher polls the connections on a Unix domain socket */
+/*   and hands those with pending requests to a pool of workers, which  */
+/*   answer them, optionally from an LRU cache of parsed feature files. */
+/*   Request latencies are kept in log2 histograms that clients can     */
+/*   query.                                                             */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_parallel.h"
+#include "svm_struct_latent_server.h"
+
+#define CONN_BUFFER      65536
+#define MAX_LINE         (64L*1024*1024)  /* longest request line accepted */
+#define MAX_CANDIDATES   65536            /* most candidates per request */
+#define MAX_INLINE_BYTES (256L*1024*1024) /* largest INLINE feature block */
+#define REQUEST_TIMEOUT  30               /* seconds a request may take to
+                                             arrive and its reply to leave */
+#define REQUESTS_PER_TURN 64              /* answered before other
+                                             connections get a worker */
+#define LATENCY_BUCKETS  32
+
+#define REQUEST_SCORE    0
+#define REQUEST_INLINE   1
+#define N_REQUEST_TYPES  2
+
+static const char *request_names[N_REQUEST_TYPES] = { "score", "inline" };
+
+/* bucket 0 counts requests under 1us, bucket b>0 those in [2^(b-1),2^b)us;
+   buckets are reported by their upper bound */
+typedef struct latency_hist {
+  long count;
+  long total_us;
+  long max_us;
+  long bucket[LATENCY_BUCKETS];
+} LATENCY_HIST;
+
+typedef struct cache_entry {
+  char     *path;
+  int      n_candidates;
+  SOA_BLOCK *cands;
+  int      refs;          /* requests currently scoring with cands */
+  int      evicted;       /* no longer in the cache, freed at refs==0 */
+  unsigned long hash;
+  struct cache_entry *hnext, *prev, *next;
+} CACHE_ENTRY;
+
+typedef struct feature_cache {
+  long        capacity;
+  long        size;
+  long        n_buckets;
+  CACHE_ENTRY **table;
+  CACHE_ENTRY *head, *tail;   /* most and least recently used */
+  long        hits, misses;
+  pthread_mutex_t lock;
+} FEATURE_CACHE;
+
+typedef struct connection {
+  int    fd;
+  char   in[CONN_BUFFER];
+  size_t in_pos, in_len;
+  char   *line;
+  size_t line_cap;
+  char   out[CONN_BUFFER];
+  size_t out_len;
+  int    failed;              /* the peer went away while writing */
+  int    closed;              /* done, to be freed by the dispatcher */
+  int    shutdown;            /* the client sent SHUTDOWN */
+  long   deadline;            /* of the current request, in ms of
+                                 monotonic_ms() */
+  struct connection *next;    /* in the ready queue */
+} CONNECTION;
+
+typedef struct score_server {
+  STRUCTMODEL   *sm;
+  int           listen_fd;
+  int           stop;         /* a client sent SHUTDOWN; only the
+                                 dispatcher sees this */
+  FEATURE_CACHE *cache;
+  LATENCY_HIST  hist[N_REQUEST_TYPES];
+  /* connections with pending requests, waiting for a worker */
+  CONNECTION    *ready_head, *ready_tail;
+  int           quit;         /* the workers exit once the queue is empty */
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  int           wake[2];      /* workers hand connections back to the
+                                 dispatcher through this pipe */
+} SCORE_SERVER;
+
+/************************************************************************/
+/*   latency histograms                                                 */
+/************************************************************************/
+
+static long monotonic_ms(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return(t.tv_sec*1000L+t.tv_nsec/1000000);
+}
+
+static long elapsed_us(struct timespec *t0)
+{
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return((t1.tv_sec-t0->tv_sec)*1000000L+(t1.tv_nsec-t0->tv_nsec)/1000);
+}
+
+static void record_latency(LATENCY_HIST *h, long us)
+{
+  int b = 0;
+  long m;
+
+  while((b < LATENCY_BUCKETS-1) && (us >= (1L<<b)))
+    b++;
+  __sync_add_and_fetch(&h->bucket[b], 1);
+  __sync_add_and_fetch(&h->count, 1);
+  __sync_add_and_fetch(&h->total_us, us);
+  while(us > (m = __sync_fetch_and_add(&h->max_us, 0))) {
+    if(__sync_bool_compare_and_swap(&h->max_us, m, us))
+      break;
+  }
+}
+
+static long latency_quantile(LATENCY_HIST *h, long *bucket, long count, double q)
+     /* upper bound of the bucket holding the q-quantile, at most the
+        largest latency seen */
+{
+  long seen = 0, target = (long)(q*count+0.5);
+  int b;
+
+  if(target < 1) target = 1;
+  for(b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += bucket[b];
+    if(seen >= target)
+      return(((1L<<b) < h->max_us) ? (1L<<b) : h->max_us);
+  }
+  return(h->max_us);
+}
+
+/************************************************************************/
+/*   feature cache                                                      */
+/************************************************************************/
+
+static unsigned long path_hash(const char *s)
+{
+  unsigned long h = 14695981039346656037UL;
+  while(*s) {
+    h ^= (unsigned char) *s++;
+    h *= 1099511628211UL;
+  }
+  return(h);
+}
+
+static FEATURE_CACHE *create_feature_cache(long capacity)
+{
+  FEATURE_CACHE *c = (FEATURE_CACHE *) my_malloc(sizeof(FEATURE_CACHE));
+
+  c->capacity = capacity;
+  c->size = 0;
+  c->n_buckets = 1;
+  while(c->n_buckets < 2*capacity)
+    c->n_buckets *= 2;
+  c->table = (CACHE_ENTRY **) my_malloc(c->n_buckets*sizeof(CACHE_ENTRY *));
+  memset(c->table, 0, c->n_buckets*sizeof(CACHE_ENTRY *));
+  c->head = c->tail = NULL;
+  c->hits = c->misses = 0;
+  pthread_mutex_init(&c->lock, NULL);
+  return(c);
+}
+
+static void lru_unlink(FEATURE_CACHE *c, CACHE_ENTRY *e)
+{
+  if(e->prev) e->prev->next = e->next; else c->head = e->next;
+  if(e->next) e->next->prev = e->prev; else c->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void lru_push_front(FEATURE_CACHE *c, CACHE_ENTRY *e)
+{
+  e->prev = NULL;
+  e->next = c->head;
+  if(c->head) c->head->prev = e;
+  c->head = e;
+  if(!c->tail) c->tail = e;
+}
+
+static void free_cache_entry(CACHE_ENTRY *e)
+{
+  free_soa_block(e->cands);
+  free(e->path);
+  free(e);
+}
+
+static void cache_remove(FEATURE_CACHE *c, CACHE_ENTRY *e)
+     /* takes e out of the cache; it is freed once no request uses it */
+{
+  CACHE_ENTRY **p = &c->table[e->hash & (c->n_buckets-1)];
+
+  while(*p != e)
+    p = &(*p)->hnext;
+  *p = e->hnext;
+  lru_unlink(c, e);
+  c->size--;
+  e->evicted = 1;
+  if(e->refs == 0)
+    free_cache_entry(e);
+}
+
+static CACHE_ENTRY *cache_find(FEATURE_CACHE *c, const char *path, unsigned long hash)
+{
+  CACHE_ENTRY *e;
+  for(e = c->table[hash & (c->n_buckets-1)]; e; e = e->hnext) {
+    if((e->hash == hash) && !strcmp(e->path, path))
+      return(e);
+  }
+  return(NULL);
+}
+
+static CACHE_ENTRY *cache_acquire(FEATURE_CACHE *c, const char *path, int n_candidates)
+     /* returns the cached entry for path with one more reference, or
+        NULL on a miss */
+{
+  unsigned long hash = path_hash(path);
+  CACHE_ENTRY *e;
+
+  pthread_mutex_lock(&c->lock);
+  e = cache_find(c, path, hash);
+  if(e && (e->n_candidates != n_candidates)) {
+    cache_remove(c, e);
+    e = NULL;
+  }
+  if(e) {
+    e->refs++;
+    lru_unlink(c, e);
+    lru_push_front(c, e);
+    c->hits++;
+  }
+  else {
+    c->misses++;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return(e);
+}
+
+static CACHE_ENTRY *cache_insert(FEATURE_CACHE *c, const char *path, int n_candidates, SOA_BLOCK *cands)
+     /* adds freshly read feature vectors and returns their entry with
+        one reference. If another request cached the same file in the
+        meantime, cands is freed and that entry is returned instead. */
+{
+  unsigned long hash = path_hash(path);
+  CACHE_ENTRY *e;
+
+  pthread_mutex_lock(&c->lock);
+  e = cache_find(c, path, hash);
+  if(e && (e->n_candidates == n_candidates)) {
+    e->refs++;
+    pthread_mutex_unlock(&c->lock);
+    free_soa_block(cands);
+    return(e);
+  }
+  if(e)
+    cache_remove(c, e);
+
+  e = (CACHE_ENTRY *) my_malloc(sizeof(CACHE_ENTRY));
+  e->path = (char *) my_malloc(strlen(path)+1);
+  strcpy(e->path, path);
+  e->n_candidates = n_candidates;
+  e->cands = cands;
+  e->refs = 1;
+  e->evicted = 0;
+  e->hash = hash;
+  e->hnext = c->table[hash & (c->n_buckets-1)];
+  c->table[hash & (c->n_buckets-1)] = e;
+  lru_push_front(c, e);
+  c->size++;
+  while((c->size > c->capacity) && (c->tail != e))
+    cache_remove(c, c->tail);
+  pthread_mutex_unlock(&c->lock);
+  return(e);
+}
+
+static void cache_release(FEATURE_CACHE *c, CACHE_ENTRY *e)
+{
+  pthread_mutex_lock(&c->lock);
+  e->refs--;
+  if(e->evicted && (e->refs == 0))
+    free_cache_entry(e);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static void free_feature_cache(FEATURE_CACHE *c)
+{
+  while(c->tail)
+    cache_remove(c, c->tail);
+  pthread_mutex_destroy(&c->lock);
+  free(c->table);
+  free(c);
+}
+
+/************************************************************************/
+/*   buffered connection I/O                                            */
+/************************************************************************/
+
+static int conn_wait(CONNECTION *c, short events)
+     /* waits until c is ready for events, at most until the deadline of
+        its request; after the deadline only a ready connection counts */
+{
+  struct pollfd p;
+  long left;
+  int r;
+
+  p.fd = c->fd;
+  p.events = events;
+  do {
+    left = c->deadline-monotonic_ms();
+    r = poll(&p, 1, (left > 0) ? (int) left : 0);
+  } while((r < 0) && (errno == EINTR));
+  return(r > 0);
+}
+
+static void conn_flush(CONNECTION *c)
+     /* a client that does not take its replies by the deadline fails */
+{
+  size_t off = 0;
+  ssize_t n;
+
+  while((off < c->out_len) && !c->failed) {
+    if(!conn_wait(c, POLLOUT)) {
+      c->failed = 1;
+      break;
+    }
+    n = send(c->fd, c->out+off, c->out_len-off, MSG_NOSIGNAL|MSG_DONTWAIT);
+    if(n < 0) {
+      if((errno == EINTR) || (errno == EAGAIN)) continue;
+      c->failed = 1;
+      break;
+    }
+    off += n;
+  }
+  c->out_len = 0;
+}
+
+static void conn_printf(CONNECTION *c, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  if(c->out_len+1024 > CONN_BUFFER)
+    conn_flush(c);
+  va_start(ap, fmt);
+  n = vsnprintf(c->out+c->out_len, CONN_BUFFER-c->out_len, fmt, ap);
+  va_end(ap);
+  if(n > 0)
+    c->out_len += ((size_t) n < CONN_BUFFER-c->out_len) ? (size_t) n : CONN_BUFFER-c->out_len-1;
+}
+
+static int conn_fill(CONNECTION *c)
+{
+  ssize_t n;
+
+  if(c->in_pos == c->in_len)
+    conn_flush(c);   /* the client waits for replies before sending more */
+  if(c->failed)
+    return(0);
+  do {
+    if(!conn_wait(c, POLLIN))
+      return(0);
+    n = recv(c->fd, c->in, CONN_BUFFER, MSG_DONTWAIT);
+  } while((n < 0) && ((errno == EINTR) || (errno == EAGAIN)));
+  if(n <= 0)
+    return(0);
+  c->in_pos = 0;
+  c->in_len = n;
+  return(1);
+}
+
+static long conn_read_line(CONNECTION *c)
+     /* reads the next line without its terminator into c->line and
+        returns its length, or -1 at the end of input, after
+        past the deadline of the request, on a line longer than MAX_LINE or
+        without memory for it */
+{
+  size_t len = 0;
+  char ch, *line;
+
+  for(;;) {
+    if((c->in_pos == c->in_len) && !conn_fill(c))
+      return(-1);
+    ch = c->in[c->in_pos++];
+    if(ch == '\n')
+      break;
+    if(len+1 >= c->line_cap) {
+      if(c->line_cap >= MAX_LINE)
+        return(-1);
+      line = (char *) realloc(c->line, 2*c->line_cap);
+      if(!line)
+        return(-1);
+      c->line = line;
+      c->line_cap *= 2;
+    }
+    c->line[len++] = ch;
+  }
+  if((len > 0) && (c->line[len-1] == '\r'))
+    len--;
+  c->line[len] = '\0';
+  return(len);
+}
+
+static int conn_pending(CONNECTION *c)
+     /* whether more input, or the end of it, can be read without
+        waiting */
+{
+  char ch;
+  ssize_t n;
+
+  if(c->in_pos < c->in_len)
+    return(1);
+  do {
+    n = recv(c->fd, &ch, 1, MSG_PEEK|MSG_DONTWAIT);
+  } while((n < 0) && (errno == EINTR));
+  return(n >= 0);
+}
+
+/************************************************************************/
+/*   requests                                                           */
+/************************************************************************/
+
+static int features_in_range(SOA_BLOCK *cands, long sizePsi)
+     /* client data must not index outside of w */
+{
+  long max = max_wnum_soa(cands);
+  return((max >= 0) && (max <= sizePsi));
+}
+
+static void answer_score(SCORE_SERVER *srv, CONNECTION *c, int n_candidates, char *path)
+{
+  CACHE_ENTRY *e = NULL;
+  SOA_BLOCK *cands;
+  double score;
+  int best;
+
+  if(srv->cache)
+    e = cache_acquire(srv->cache, path, n_candidates);
+  if(e) {
+    cands = e->cands;
+  }
+  else {
+    cands = read_feature_block(path, n_candidates);
+    if(cands == NULL) {
+      conn_printf(c, "ERR cannot read %d candidates from %s\n", n_candidates, path);
+      return;
+    }
+    if(!features_in_range(cands, srv->sm->sizePsi)) {
+      free_soa_block(cands);
+      conn_printf(c, "ERR feature index out of range in %s\n", path);
+      return;
+    }
+    if(srv->cache)
+      e = cache_insert(srv->cache, path, n_candidates, cands);
+    if(e)
+      cands = e->cands;
+  }
+
+  score = score_candidates(cands, srv->sm, &best, NULL);
+  conn_printf(c, "OK %d %0.5f\n", best, score);
+
+  if(e)
+    cache_release(srv->cache, e);
+  else
+    free_soa_block(cands);
+}
+
+static int answer_inline(SCORE_SERVER *srv, CONNECTION *c, int n_candidates)
+     /* returns 0 if the connection ended inside the feature block or the
+        block is larger than MAX_INLINE_BYTES, after which the stream
+        cannot be followed any further. The lines are parsed as they
+        arrive, and without memory for them the rest of the block is
+        only read. */
+{
+  SOA_BLOCK *cands = begin_feature_block(n_candidates);
+  double score;
+  long len, bytes = 0, used = 0;
+  int j, best;
+
+  for(j = 0; j < n_candidates; j++) {
+    if(((len = conn_read_line(c)) < 0) || ((bytes += len+1) > MAX_INLINE_BYTES)) {
+      if(len >= 0)
+        conn_printf(c, "ERR feature block larger than %ld bytes\n", MAX_INLINE_BYTES);
+      free_soa_block(cands);
+      return(0);
+    }
+    if(cands && ((used = add_feature_line(cands, used, c->line)) < 0)) {
+      free_soa_block(cands);
+      cands = NULL;
+    }
+  }
+  if(!cands) {
+    conn_printf(c, "ERR out of memory for %d candidates\n", n_candidates);
+    return(1);
+  }
+  end_feature_block(cands);
+  if(!features_in_range(cands, srv->sm->sizePsi)) {
+    conn_printf(c, "ERR feature index out of range\n");
+  }
+  else {
+    score = score_candidates(cands, srv->sm, &best, NULL);
+    conn_printf(c, "OK %d %0.5f\n", best, score);
+  }
+  free_soa_block(cands);
+  return(1);
+}
+
+static void answer_stats(SCORE_SERVER *srv, CONNECTION *c)
+{
+  LATENCY_HIST *h;
+  long bucket[LATENCY_BUCKETS], count;
+  int t, b;
+
+  for(t = 0; t < N_REQUEST_TYPES; t++) {
+    h = &srv->hist[t];
+    count = 0;
+    for(b = 0; b < LATENCY_BUCKETS; b++) {
+      bucket[b] = h->bucket[b];
+      count += bucket[b];
+    }
+    if(count == 0) {
+      conn_printf(c, "LATENCY %s count 0\n", request_names[t]);
+      continue;
+    }
+    conn_printf(c, "LATENCY %s count %ld mean_us %.1f p50_us %ld p90_us %ld p99_us %ld max_us %ld\n",
+                request_names[t], count, (double) h->total_us/h->count,
+                latency_quantile(h, bucket, count, 0.5), latency_quantile(h, bucket, count, 0.9),
+                latency_quantile(h, bucket, count, 0.99), h->max_us);
+    for(b = 0; b < LATENCY_BUCKETS; b++) {
+      if(bucket[b])
+        conn_printf(c, "BUCKET %s %ld %ld\n", request_names[t], 1L<<b, bucket[b]);
+    }
+  }
+  if(srv->cache) {
+    pthread_mutex_lock(&srv->cache->lock);
+    conn_printf(c, "CACHE entries %ld capacity %ld hits %ld misses %ld\n", srv->cache->size,
+                srv->cache->capacity, srv->cache->hits, srv->cache->misses);
+    pthread_mutex_unlock(&srv->cache->lock);
+  }
+  conn_printf(c, "END\n");
+}
+
+static int read_candidate_count(char *s, int *n_candidates, int *offset)
+     /* the candidate count at the start of s, with the offset of what
+        follows it; 0 if it is missing or out of range */
+{
+  long n;
+
+  if((sscanf(s, "%ld %n", &n, offset) < 1) || (n < 1) || (n > MAX_CANDIDATES))
+    return(0);
+  *n_candidates = (int) n;
+  return(1);
+}
+
+static int serve_requests(SCORE_SERVER *srv, CONNECTION *c)
+     /* answers the requests of c until no further input is pending or
+        REQUESTS_PER_TURN have been answered; returns 0 once the
+        connection is to be closed. Every request, from its first byte
+        to its reply, must be done within REQUEST_TIMEOUT, so that a
+        client that stalls, trickles a request or does not read its
+        replies loses its worker. */
+{
+  struct timespec t0;
+  int n_candidates, offset, n = 0;
+  char *line;
+
+  do {
+    c->deadline = monotonic_ms()+1000L*REQUEST_TIMEOUT;
+    if(c->failed || (conn_read_line(c) < 0))
+      return(0);
+    line = c->line;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(!strncmp(line, "SCORE ", 6)) {
+      if(!read_candidate_count(line+6, &n_candidates, &offset) || (line[6+offset] == '\0')) {
+        conn_printf(c, "ERR usage: SCORE <n_candidates> <feature file>, at most %d candidates\n", MAX_CANDIDATES);
+        continue;
+      }
+      answer_score(srv, c, n_candidates, line+6+offset);
+      record_latency(&srv->hist[REQUEST_SCORE], elapsed_us(&t0));
+    }
+    else if(!strncmp(line, "INLINE ", 7)) {
+      if(!read_candidate_count(line+7, &n_candidates, &offset)) {
+        /* the block that may follow cannot be told from requests */
+        conn_printf(c, "ERR usage: INLINE <n_candidates>, at most %d candidates\n", MAX_CANDIDATES);
+        return(0);
+      }
+      if(!answer_inline(srv, c, n_candidates))
+        return(0);
+      record_latency(&srv->hist[REQUEST_INLINE], elapsed_us(&t0));
+    }
+    else if(!strcmp(line, "STATS")) {
+      answer_stats(srv, c);
+    }
+    else if(!strcmp(line, "QUIT")) {
+      return(0);
+    }
+    else if(!strcmp(line, "SHUTDOWN")) {
+      conn_printf(c, "OK\n");
+      c->shutdown = 1;
+      return(0);
+    }
+    else if(line[0] != '\0') {
+      conn_printf(c, "ERR unknown request\n");
+    }
+  } while((++n < REQUESTS_PER_TURN) && conn_pending(c));
+  conn_flush(c);
+  return(!c->failed);
+}
+
+static CONNECTION *open_connection(int fd)
+     /* NULL if there is no memory for another connection */
+{
+  CONNECTION *c = (CONNECTION *) malloc(sizeof(CONNECTION));
+
+  if(c)
+    c->line = (char *) malloc(4096);
+  if(!c || !c->line) {
+    free(c);
+    return(NULL);
+  }
+  c->fd = fd;
+  c->in_pos = c->in_len = 0;
+  c->out_len = 0;
+  c->failed = 0;
+  c->closed = 0;
+  c->shutdown = 0;
+  c->deadline = 0;
+  c->next = NULL;
+  c->line_cap = 4096;
+  return(c);
+}
+
+static void close_connection(CONNECTION *c)
+     /* the worker has flushed the replies */
+{
+  close(c->fd);
+  free(c->line);
+  free(c);
+}
+
+static void queue_ready(SCORE_SERVER *srv, CONNECTION *c)
+{
+  c->next = NULL;
+  pthread_mutex_lock(&srv->lock);
+  if(srv->ready_tail)
+    srv->ready_tail->next = c;
+  else
+    srv->ready_head = c;
+  srv->ready_tail = c;
+  pthread_cond_signal(&srv->cond);
+  pthread_mutex_unlock(&srv->lock);
+}
+
+static void *server_worker(void *arg)
+     /* answers the pending requests of one ready connection at a time
+        and hands it back to the dispatcher */
+{
+  SCORE_SERVER *srv = (SCORE_SERVER *) arg;
+  CONNECTION *c;
+
+  for(;;) {
+    pthread_mutex_lock(&srv->lock);
+    while(!srv->ready_head && !srv->quit)
+      pthread_cond_wait(&srv->cond, &srv->lock);
+    c = srv->ready_head;
+    if(c) {
+      srv->ready_head = c->next;
+      if(!srv->ready_head)
+        srv->ready_tail = NULL;
+    }
+    pthread_mutex_unlock(&srv->lock);
+    if(!c)
+      break;
+
+    c->closed = !serve_requests(srv, c);
+    conn_flush(c);
+    /* input that is already buffered does not wake the dispatcher */
+    if(!c->closed && (c->in_pos < c->in_len))
+      queue_ready(srv, c);
+    else
+      while((write(srv->wake[1], &c, sizeof(c)) < 0) && (errno == EINTR));
+  }
+  return(NULL);
+}
+
+static int grow_poll_set(CONNECTION ***idle, struct pollfd **fds, long *cap, long n_open)
+     /* room for n_open idle connections besides the pipe and the
+        listening socket; 0 if there is no memory for it */
+{
+  void *p;
+  long k;
+
+  if(*cap >= n_open+2)
+    return(1);
+  k = 2*(n_open+2);
+  if(!(p = realloc(*idle, k*sizeof(CONNECTION *))))
+    return(0);
+  *idle = (CONNECTION **) p;
+  if(!(p = realloc(*fds, k*sizeof(struct pollfd))))
+    return(0);
+  *fds = (struct pollfd *) p;
+  *cap = k;
+  return(1);
+}
+
+static void dispatch_connections(SCORE_SERVER *srv)
+     /* polls the listening socket and the idle connections, and queues
+        connections with input for the workers, so that idle clients do
+        not hold a worker. Returns after a SHUTDOWN once all connections
+        are closed. */
+{
+  CONNECTION **idle = NULL, *c;
+  struct pollfd *fds = NULL;
+  long n_idle = 0, cap = 0, n_open = 0, n_fds, i, k;
+  int fd;
+
+  if(!grow_poll_set(&idle, &fds, &cap, 0)) {
+    printf("Error: out of memory for the server\n");
+    return;
+  }
+  for(;;) {
+    if(srv->stop && (n_open == 0))
+      break;
+    fds[0].fd = srv->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = srv->stop ? -1 : srv->listen_fd;
+    fds[1].events = POLLIN;
+    for(i = 0; i < n_idle; i++) {
+      fds[i+2].fd = idle[i]->fd;
+      fds[i+2].events = POLLIN;
+    }
+    n_fds = n_idle+2;
+    if(poll(fds, n_fds, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    /* idle connections with input, or whose client went away */
+    for(i = 0, k = 0; i < n_idle; i++) {
+      if(fds[i+2].revents)
+        queue_ready(srv, idle[i]);
+      else
+        idle[k++] = idle[i];
+    }
+    n_idle = k;
+
+    if(fds[0].revents & POLLIN) {
+      if(read(srv->wake[0], &c, sizeof(c)) == sizeof(c)) {
+        if(c->shutdown && !srv->stop) {
+          srv->stop = 1;
+          shutdown(srv->listen_fd, SHUT_RDWR);
+        }
+        if(c->closed) {
+          close_connection(c);
+          n_open--;
+        }
+        else {
+          idle[n_idle++] = c;
+        }
+      }
+    }
+
+    if(!srv->stop && fds[1].revents) {
+      fd = accept(srv->listen_fd, NULL, NULL);
+      if(fd >= 0) {
+        c = grow_poll_set(&idle, &fds, &cap, n_open+1) ? open_connection(fd) : NULL;
+        if(c) {
+          idle[n_idle++] = c;
+          n_open++;
+        }
+        else {
+          close(fd);
+        }
+      }
+      else if(!srv->stop && (errno != EINTR) && (errno != ECONNABORTED) && (errno != EAGAIN)) {
+        perror("accept");
+        break;
+      }
+    }
+  }
+
+  for(i = 0; i < n_idle; i++)
+    close_connection(idle[i]);
+  free(idle);
+  free(fds);
+}
+
+static int open_listen_socket(char *socket_path)
+{
+  struct sockaddr_un addr;
+  struct stat sb;
+  int fd;
+
+  if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+    printf("Error: socket path %s is too long\n", socket_path);
+    return(-1);
+  }
+  /* remove a stale socket of an earlier run, but never a regular file */
+  if(!stat(socket_path, &sb) && S_ISSOCK(sb.st_mode))
+    unlink(socket_path);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) {
+    perror("socket");
+    return(-1);
+  }
+  if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 64)) {
+    printf("Error: cannot listen on %s: %s\n", socket_path, strerror(errno));
+    close(fd);
+    return(-1);
+  }
+  return(fd);
+}
+
+int run_score_server(char *socket_path, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm)
+     /* serves requests until a client sends SHUTDOWN. Connections that
+        are open at that time are served until their clients close them. */
+{
+  SCORE_SERVER srv;
+  pthread_t *threads;
+  int n_workers, started, t;
+
+  memset(&srv, 0, sizeof(srv));
+  srv.sm = sm;
+  srv.stop = 0;
+  srv.cache = (sparm->feature_cache > 0) ? create_feature_cache(sparm->feature_cache) : NULL;
+  srv.ready_head = srv.ready_tail = NULL;
+  srv.quit = 0;
+  pthread_mutex_init(&srv.lock, NULL);
+  pthread_cond_init(&srv.cond, NULL);
+  if(pipe(srv.wake)) {
+    perror("pipe");
+    return(1);
+  }
+  srv.listen_fd = open_listen_socket(socket_path);
+  if(srv.listen_fd < 0)
+    return(1);
+
+  n_workers = resolve_thread_count(sparm->n_threads);
+  threads = (pthread_t *) my_malloc(n_workers*sizeof(pthread_t));
+  started = 0;
+  for(t = 0; t < n_workers; t++) {
+    if(pthread_create(&threads[started], NULL, server_worker, &srv))
+      break;  /* serve with the workers we have */
+    started++;
+  }
+  if(started == 0) {
+    printf("Error: cannot start a server worker\n");
+    close(srv.listen_fd);
+    unlink(socket_path);
+    return(1);
+  }
+  printf("Serving on %s with %d workers.\n", socket_path, started); fflush(stdout);
+
+  dispatch_connections(&srv);
+  pthread_mutex_lock(&srv.lock);
+  srv.quit = 1;
+  pthread_cond_broadcast(&srv.cond);
+  pthread_mutex_unlock(&srv.lock);
+  for(t = 0; t < started; t++)
+    pthread_join(threads[t], NULL);
+
+  close(srv.listen_fd);
+  close(srv.wake[0]);
+  close(srv.wake[1]);
+  unlink(socket_path);
+  free(threads);
+  pthread_mutex_destroy(&srv.lock);
+  pthread_cond_destroy(&srv.cond);
+  if(srv.cache)
+    free_feature_cache(srv.cache);
+  return(0);
+}
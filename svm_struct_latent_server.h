@@ -0,0 +1,41 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_server.h                                         */
+/*                                                                      */
+/*   Resident scoring server for Latent SVM^struct on a Unix domain     */
+/*   socket.                                                            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_SERVER
+#define SVM_STRUCT_LATENT_SERVER
+
+/* Line protocol. Every request is one line, answered by one line, in
+   order; requests may be pipelined, replies are flushed whenever the
+   server has no further input pending on the connection.
+
+     SCORE <n_candidates> <feature file>   -> OK <best box> <score>
+     INLINE <n_candidates>                 -> OK <best box> <score>
+       followed by n_candidates lines in the feature file format
+     STATS                                 -> latency histograms, then END
+     QUIT                                  closes the connection
+     SHUTDOWN                              stops the server
+
+   Malformed requests and unreadable files are answered with
+   ERR <reason>. A request has at most 65536 candidates and an INLINE
+   block at most 256 MB; an INLINE request that breaks either limit is
+   answered with ERR and closes the connection, as its block cannot be
+   told from further requests. Idle connections do not hold a worker.
+   A request must arrive and its reply be taken by the client within 30
+   seconds of its first byte, or the connection is closed; a worker
+   answers at most 64 pipelined requests of a connection before it
+   turns to the others. */
+
+int run_score_server(char *socket_path, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm);
+
+#endif
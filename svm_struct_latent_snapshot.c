@@ -0,0 +1,164 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_snapshot.c                                       */
+/*                                                                      */
+/*   Background writer for the per-iteration model snapshots of         */
+/*   Latent SVM^struct. The training loop only copies w into a free     */
+/*   buffer; formatting and I/O happen on the writer thread.            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_snapshot.h"
+#include "svm_struct_latent_profile.h"
+
+#define SNAPSHOT_FREE    0
+#define SNAPSHOT_PENDING 1
+#define SNAPSHOT_WRITING 2
+
+static void write_snapshot(SNAPSHOT_WRITER *sw, double *w, int iter)
+     /* writes to a temporary file first, so that a snapshot on disk is
+        always complete, and then drops the snapshot that falls out of
+        the retention window */
+{
+  char file[1100], tmpfile[1100];
+  double t = prof_now();
+  int failed;
+
+  if((snprintf(file, sizeof(file), "%s.%04d", sw->modelfile, iter) >= (int) sizeof(file))
+     || (snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", file) >= (int) sizeof(tmpfile))) {
+    printf("Warning: model snapshot name for %s is too long\n", sw->modelfile); fflush(stdout);
+    sw->n_failed++;
+    return;
+  }
+  failed = write_model_weights_binary(tmpfile, w, sw->sizePsi) || rename(tmpfile, file);
+  prof_add_time(PROF_SNAPSHOT, prof_now()-t);
+  if(failed) {
+    printf("Warning: cannot write model snapshot %s\n", file); fflush(stdout);
+    remove(tmpfile);
+    sw->n_failed++;
+    return;
+  }
+  sw->n_written++;
+
+  if((sw->keep > 0) && (iter-sw->keep >= 0)) {
+    if(snprintf(file, sizeof(file), "%s.%04d", sw->modelfile, iter-sw->keep) < (int) sizeof(file))
+      remove(file);
+  }
+}
+
+static int oldest_pending(SNAPSHOT_WRITER *sw)
+{
+  int b = -1, k;
+  for(k = 0; k < 2; k++) {
+    if((sw->state[k] == SNAPSHOT_PENDING) && ((b < 0) || (sw->iter[k] < sw->iter[b])))
+      b = k;
+  }
+  return(b);
+}
+
+static void *snapshot_thread(void *arg)
+{
+  SNAPSHOT_WRITER *sw = (SNAPSHOT_WRITER *) arg;
+  int b;
+
+  pthread_mutex_lock(&sw->lock);
+  for(;;) {
+    while(((b = oldest_pending(sw)) < 0) && !sw->shutdown)
+      pthread_cond_wait(&sw->cond, &sw->lock);
+    if(b < 0)
+      break;
+    sw->state[b] = SNAPSHOT_WRITING;
+    pthread_mutex_unlock(&sw->lock);
+
+    write_snapshot(sw, sw->buffer[b], sw->iter[b]);
+
+    pthread_mutex_lock(&sw->lock);
+    sw->state[b] = SNAPSHOT_FREE;
+    pthread_cond_broadcast(&sw->cond);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return(NULL);
+}
+
+SNAPSHOT_WRITER *start_snapshot_writer(char *modelfile, long sizePsi, int keep, int async)
+{
+  SNAPSHOT_WRITER *sw = (SNAPSHOT_WRITER *) my_malloc(sizeof(SNAPSHOT_WRITER));
+  int k;
+
+  strncpy(sw->modelfile, modelfile, sizeof(sw->modelfile)-1);
+  sw->modelfile[sizeof(sw->modelfile)-1] = '\0';
+  sw->sizePsi = sizePsi;
+  sw->keep = keep;
+  sw->async = async;
+  sw->shutdown = 0;
+  sw->n_written = 0;
+  sw->n_failed = 0;
+  for(k = 0; k < 2; k++) {
+    sw->buffer[k] = create_nvector(sizePsi);
+    sw->iter[k] = -1;
+    sw->state[k] = SNAPSHOT_FREE;
+  }
+  pthread_mutex_init(&sw->lock, NULL);
+  pthread_cond_init(&sw->cond, NULL);
+  if(sw->async && pthread_create(&sw->thread, NULL, snapshot_thread, sw)) {
+    printf("Warning: cannot start snapshot writer thread, writing synchronously\n");
+    sw->async = 0;
+  }
+  return(sw);
+}
+
+void queue_snapshot(SNAPSHOT_WRITER *sw, double *w, int iter)
+     /* copies w into a free buffer and hands it to the writer thread.
+        Blocks only if both buffers are still in use. */
+{
+  int b;
+
+  if(!sw->async) {
+    write_snapshot(sw, w, iter);
+    return;
+  }
+
+  pthread_mutex_lock(&sw->lock);
+  while((sw->state[0] != SNAPSHOT_FREE) && (sw->state[1] != SNAPSHOT_FREE))
+    pthread_cond_wait(&sw->cond, &sw->lock);
+  b = (sw->state[0] == SNAPSHOT_FREE) ? 0 : 1;
+  pthread_mutex_unlock(&sw->lock);
+
+  /* the writer never touches a free buffer, so copy without the lock */
+  memcpy(sw->buffer[b], w, (sw->sizePsi+1)*sizeof(double));
+
+  pthread_mutex_lock(&sw->lock);
+  sw->iter[b] = iter;
+  sw->state[b] = SNAPSHOT_PENDING;
+  pthread_cond_broadcast(&sw->cond);
+  pthread_mutex_unlock(&sw->lock);
+}
+
+void stop_snapshot_writer(SNAPSHOT_WRITER *sw)
+     /* writes all queued snapshots and releases the writer */
+{
+  if(sw->async) {
+    pthread_mutex_lock(&sw->lock);
+    sw->shutdown = 1;
+    pthread_cond_broadcast(&sw->cond);
+    pthread_mutex_unlock(&sw->lock);
+    pthread_join(sw->thread, NULL);
+  }
+  if(sw->n_failed) {
+    printf("Warning: %ld of %ld model snapshots could not be written\n", sw->n_failed, sw->n_failed+sw->n_written);
+  }
+  pthread_mutex_destroy(&sw->lock);
+  pthread_cond_destroy(&sw->cond);
+  free_nvector(sw->buffer[0]);
+  free_nvector(sw->buffer[1]);
+  free(sw);
+}
@@ -0,0 +1,42 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_snapshot.h                                       */
+/*                                                                      */
+/*   Background writer for the per-iteration model snapshots of         */
+/*   Latent SVM^struct.                                                 */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_SNAPSHOT
+#define SVM_STRUCT_LATENT_SNAPSHOT
+
+#include <pthread.h>
+
+typedef struct snapshot_writer {
+  char   modelfile[1024];  /* snapshots are written to modelfile.%04d */
+  long   sizePsi;
+  int    keep;             /* number of snapshots to retain, 0 keeps all */
+  int    async;            /* write on the background thread */
+
+  double *buffer[2];       /* double buffer of copied weight vectors */
+  int    iter[2];          /* outer iteration stored in each buffer */
+  int    state[2];         /* SNAPSHOT_FREE, SNAPSHOT_PENDING or SNAPSHOT_WRITING */
+  int    shutdown;
+  long   n_written;
+  long   n_failed;
+
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} SNAPSHOT_WRITER;
+
+SNAPSHOT_WRITER *start_snapshot_writer(char *modelfile, long sizePsi, int keep, int async);
+void queue_snapshot(SNAPSHOT_WRITER *sw, double *w, int iter);
+void stop_snapshot_writer(SNAPSHOT_WRITER *sw);
+
+#endif
@@ -0,0 +1,563 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_soa.c                                            */
+/*                                                                      */
+/*   Structure-of-arrays sparse vectors for Latent SVM^struct. The      */
+/*   candidates of an image are parsed straight into one index and one  */
+/*   weight array, and scored against w with AVX2 gathers if available. */
+/*   A feature permutation, if set, is applied while parsing.           */
+/*   Eight products are accumulated at a time, in two AVX2 registers    */
+/*   or in eight scalars, in the same order, so both give the same      */
+/*   scores.                                                            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "svm_struct_latent_soa.h"
+#include "svm_struct_latent_profile.h"
+
+#define SOA_ALIGN    32
+#define SOA_MIN_CAP  1024
+#define PADDED(n)    (((n)+SOA_WIDTH-1) & ~((long) SOA_WIDTH-1))
+
+/* set once before any vectors are read, see set_feature_permutation() */
+static int32_t *feature_perm = NULL;
+static long    feature_perm_n = 0;
+
+#define PERMUTED(f)  ((((f) > 0) && ((f) <= feature_perm_n)) ? feature_perm[f] : (f))
+
+static void *try_aligned_array(long n, size_t size)
+     /* NULL if there is no memory */
+{
+  void *p;
+
+  if(posix_memalign(&p, SOA_ALIGN, (n > 0 ? n : 1)*size))
+    return(NULL);
+  return(p);
+}
+
+static void *aligned_array(long n, size_t size)
+{
+  void *p = try_aligned_array(n, size);
+
+  if(!p) {
+    perror("Out of memory!\n");
+    exit(1);
+  }
+  return(p);
+}
+
+static int reserve_entries(SOA_BLOCK *b, long used, long need)
+     /* makes room for need entries, keeping the first used ones;
+        returns 0 and leaves b as it is if there is no memory */
+{
+  int32_t *wnum;
+  float *weight;
+  long cap = (b->n_alloc > 0) ? b->n_alloc : SOA_MIN_CAP;
+
+  while(cap < need)
+    cap *= 2;
+  if(cap == b->n_alloc)
+    return(1);
+  wnum = (int32_t *) try_aligned_array(cap, sizeof(int32_t));
+  weight = (float *) try_aligned_array(cap, sizeof(float));
+  if(!wnum || !weight) {
+    free(wnum);
+    free(weight);
+    return(0);
+  }
+  if(used > 0) {
+    memcpy(wnum, b->wnum, used*sizeof(int32_t));
+    memcpy(weight, b->weight, used*sizeof(float));
+  }
+  free(b->wnum);
+  free(b->weight);
+  b->wnum = wnum;
+  b->weight = weight;
+  b->n_alloc = cap;
+  return(1);
+}
+
+static int compare_wnum(const void *a, const void *b)
+{
+  return((((WORD *) a)->wnum > ((WORD *) b)->wnum)-(((WORD *) a)->wnum < ((WORD *) b)->wnum));
+}
+
+static int sort_entries(int32_t *wnum, float *weight, long n)
+     /* sorts n entries by feature number again after permuting them,
+        so that w is still walked in ascending order; returns 0 if there
+        is no memory */
+{
+  WORD *words;
+  long k;
+
+  if(n < 2)
+    return(1);
+  words = (WORD *) malloc(n*sizeof(WORD));
+  if(!words)
+    return(0);
+  for(k = 0; k < n; k++) {
+    words[k].wnum = wnum[k];
+    words[k].weight = weight[k];
+  }
+  qsort(words, n, sizeof(WORD), compare_wnum);
+  for(k = 0; k < n; k++) {
+    wnum[k] = words[k].wnum;
+    weight[k] = words[k].weight;
+  }
+  free(words);
+  return(1);
+}
+
+static void set_vector_pointers(SOA_BLOCK *b)
+     /* vecs[j].n_pad must be set; the vectors are laid out in order */
+{
+  long start = 0;
+  int j;
+
+  for(j = 0; j < b->n_vecs; j++) {
+    b->vecs[j].wnum = b->wnum+start;
+    b->vecs[j].weight = b->weight+start;
+    start += b->vecs[j].n_pad;
+  }
+}
+
+SOA_BLOCK *create_soa_block(int n_vecs, long *lengths)
+     /* uninitialized block of n_vecs vectors of the given lengths, with
+        their padding already cleared */
+{
+  SOA_BLOCK *b = (SOA_BLOCK *) my_malloc(sizeof(SOA_BLOCK));
+  long total = 0, k;
+  int j;
+
+  b->n_vecs = n_vecs;
+  b->vecs = (SVECTOR_SOA *) my_malloc((n_vecs > 0 ? n_vecs : 1)*sizeof(SVECTOR_SOA));
+  for(j = 0; j < n_vecs; j++) {
+    b->vecs[j].n = lengths[j];
+    b->vecs[j].n_pad = PADDED(lengths[j]);
+    total += b->vecs[j].n_pad;
+  }
+  b->wnum = (int32_t *) aligned_array(total, sizeof(int32_t));
+  b->weight = (float *) aligned_array(total, sizeof(float));
+  b->n_alloc = total;
+  set_vector_pointers(b);
+  for(j = 0; j < n_vecs; j++) {
+    for(k = b->vecs[j].n; k < b->vecs[j].n_pad; k++) {
+      b->vecs[j].wnum[k] = 0;
+      b->vecs[j].weight[k] = 0;
+    }
+  }
+  return(b);
+}
+
+SOA_BLOCK *soa_block_from_svectors(SVECTOR **fvecs, int n)
+{
+  long *lengths = (long *) my_malloc((n > 0 ? n : 1)*sizeof(long));
+  SOA_BLOCK *b;
+  WORD *ai;
+  long k;
+  int j;
+
+  for(j = 0; j < n; j++)
+    lengths[j] = words_length(fvecs[j]->words);
+  b = create_soa_block(n, lengths);
+  for(j = 0; j < n; j++) {
+    for(k = 0, ai = fvecs[j]->words; k < lengths[j]; k++, ai++) {
+      b->vecs[j].wnum[k] = PERMUTED(ai->wnum);
+      b->vecs[j].weight[k] = ai->weight;
+    }
+    if((feature_perm_n > 0) && !sort_entries(b->vecs[j].wnum, b->vecs[j].weight, lengths[j])) {
+      perror("Out of memory!\n");
+      exit(1);
+    }
+  }
+  free(lengths);
+  return(b);
+}
+
+static long parse_line_soa(char *line, SOA_BLOCK *b, long used)
+     /* appends the wnum:weight pairs of one feature line at entry used
+        and returns the new number of entries, or -1 if there is no
+        memory. Pairs are split exactly as parse_feature_line() does,
+        and as there a feature number 0 ends the vector. */
+{
+  char *s = line, *end, save;
+  int32_t wnum;
+  float weight;
+  int piece;
+
+  for(;;) {
+    while(*s == ' ')
+      s++;
+    if(*s == '\0')
+      break;
+    wnum = 0;
+    weight = 0;
+    for(piece = 0; *s && (*s != ' '); ) {
+      if(*s == ':') {
+        s++;
+        continue;
+      }
+      for(end = s; *end && (*end != ' ') && (*end != ':'); end++);
+      save = *end;
+      *end = '\0';
+      if(piece == 0)
+        wnum = atoi(s);
+      else
+        weight = atof(s);
+      *end = save;
+      piece++;
+      s = end;
+    }
+    if(wnum == 0)
+      break;
+    if((used == b->n_alloc) && !reserve_entries(b, used, used+1))
+      return(-1);
+    b->wnum[used] = PERMUTED(wnum);
+    b->weight[used] = weight;
+    used++;
+  }
+  return(used);
+}
+
+static char *read_whole_file(char *file, long *size)
+     /* returns the contents of file with a terminating '\0', or NULL if
+        it cannot be opened or there is no memory for it */
+{
+  FILE *fp = fopen(file, "r");
+  char *buf, *more;
+  long cap = 1<<16, got = 0;
+  size_t r;
+
+  if(fp == NULL)
+    return(NULL);
+  buf = (char *) malloc(cap+1);
+  while(buf && ((r = fread(buf+got, 1, cap-got, fp)) > 0)) {
+    got += r;
+    if(got == cap) {
+      cap *= 2;
+      more = (char *) realloc(buf, cap+1);
+      if(!more)
+        free(buf);
+      buf = more;
+    }
+  }
+  if(!buf) {
+    fclose(fp);
+    return(NULL);
+  }
+  fclose(fp);
+  buf[got] = '\0';
+  *size = got;
+  return(buf);
+}
+
+SOA_BLOCK *begin_feature_block(int n)
+     /* empty block for n candidates that are added one feature line at
+        a time; NULL if there is no memory. Unlike the other functions
+        here, building a block never exits for lack of memory, as the
+        lines may come from a client of the scoring server. */
+{
+  SOA_BLOCK *b = (SOA_BLOCK *) malloc(sizeof(SOA_BLOCK));
+
+  if(!b)
+    return(NULL);
+  b->n_vecs = 0;
+  b->vecs = (SVECTOR_SOA *) malloc((n > 0 ? n : 1)*sizeof(SVECTOR_SOA));
+  b->wnum = NULL;
+  b->weight = NULL;
+  b->n_alloc = 0;
+  if(!b->vecs || !reserve_entries(b, 0, SOA_MIN_CAP)) {
+    free_soa_block(b);
+    return(NULL);
+  }
+  return(b);
+}
+
+long add_feature_line(SOA_BLOCK *b, long used, char *line)
+     /* parses line, which is modified, as the next candidate of b after
+        the first used entries and returns the new number of entries,
+        or -1 if there is no memory. There must be room for the
+        candidate in the n of begin_feature_block(). */
+{
+  long start = used;
+  int j = b->n_vecs;
+
+  used = parse_line_soa(line, b, used);
+  if(used < 0)
+    return(-1);
+  if((feature_perm_n > 0) && !sort_entries(b->wnum+start, b->weight+start, used-start))
+    return(-1);
+  b->vecs[j].n = used-start;
+  b->vecs[j].n_pad = PADDED(used-start);
+  if(!reserve_entries(b, used, start+b->vecs[j].n_pad))
+    return(-1);
+  for(; used < start+b->vecs[j].n_pad; used++) {
+    b->wnum[used] = 0;
+    b->weight[used] = 0;
+  }
+  b->n_vecs++;
+  return(used);
+}
+
+void end_feature_block(SOA_BLOCK *b)
+     /* after the last add_feature_line() */
+{
+  set_vector_pointers(b);
+}
+
+SOA_BLOCK *read_feature_block(char *file, int n)
+     /* reads the n candidates of an image, one feature line each, like
+        read_feature_file(). Returns NULL if the file cannot be opened,
+        holds fewer than n lines or there is no memory for it; further
+        lines are ignored. The file is read in one go and then parsed,
+        so that both can be timed separately. */
+{
+  SOA_BLOCK *b;
+  char *buf, *line, *eol;
+  long size, used = 0;
+
+  prof_begin(PROF_FEATURE_IO);
+  buf = read_whole_file(file, &size);
+  prof_end(PROF_FEATURE_IO);
+  if(buf == NULL)
+    return(NULL);
+  prof_count(PROF_BYTES_READ, size);
+
+  prof_begin(PROF_PARSE);
+  b = begin_feature_block(n);
+  for(line = buf; b && (b->n_vecs < n) && (line < buf+size); line = eol+1) {
+    eol = strchr(line, '\n');
+    if(eol == NULL)
+      eol = buf+size;
+    *eol = '\0';
+    if((used = add_feature_line(b, used, line)) < 0)
+      break;
+  }
+  free(buf);
+  prof_end(PROF_PARSE);
+
+  if(!b || (b->n_vecs < n)) {
+    free_soa_block(b);
+    return(NULL);
+  }
+  end_feature_block(b);
+  return(b);
+}
+
+void free_soa_block(SOA_BLOCK *b)
+{
+  if(!b)
+    return;
+  free(b->vecs);
+  free(b->wnum);
+  free(b->weight);
+  free(b);
+}
+
+SVECTOR *svector_from_soa(SVECTOR_SOA *v)
+     /* WORD copy of v, as copy_svector() would make it */
+{
+  WORD *words = (WORD *) my_malloc((v->n+1)*sizeof(WORD));
+  char *userdefined = (char *) my_malloc(1);
+  long k;
+
+  for(k = 0; k < v->n; k++) {
+    words[k].wnum = v->wnum[k];
+    words[k].weight = v->weight[k];
+  }
+  words[k].wnum = 0;
+  words[k].weight = 0;
+  userdefined[0] = '\0';
+  return(create_svector_shallow(words, userdefined, 1.0));
+}
+
+long max_wnum_soa(SOA_BLOCK *b)
+     /* largest feature number in b, or -1 if some feature number is
+        negative */
+{
+  long max = 0, k;
+  int j;
+
+  for(j = 0; j < b->n_vecs; j++) {
+    for(k = 0; k < b->vecs[j].n; k++) {
+      if(b->vecs[j].wnum[k] < 0)
+        return(-1);
+      if(b->vecs[j].wnum[k] > max)
+        max = b->vecs[j].wnum[k];
+    }
+  }
+  return(max);
+}
+
+double sprod_ns_soa(const double *w, const SVECTOR_SOA *v)
+     /* <w,v>; the padding reads w[0] and adds w[0]*0 */
+{
+  const int32_t *idx = v->wnum;
+  const float *val = v->weight;
+  long i, n = v->n_pad;
+#ifdef __AVX2__
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  double t[4];
+
+  for(i = 0; i < n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_i32gather_pd(w, _mm_loadu_si128((const __m128i *)(idx+i)), 8),
+                                         _mm256_cvtps_pd(_mm_loadu_ps(val+i))));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_i32gather_pd(w, _mm_loadu_si128((const __m128i *)(idx+i+4)), 8),
+                                         _mm256_cvtps_pd(_mm_loadu_ps(val+i+4))));
+  }
+  _mm256_storeu_pd(t, _mm256_add_pd(s0, s1));
+  return((t[0]+t[1])+(t[2]+t[3]));
+#else
+  double s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int k;
+
+  for(i = 0; i < n; i += 8) {
+    for(k = 0; k < 8; k++)
+      s[k] += w[idx[i+k]]*(double) val[i+k];
+  }
+  return(((s[0]+s[4])+(s[1]+s[5]))+((s[2]+s[6])+(s[3]+s[7])));
+#endif
+}
+
+double sprod_fs_soa(const float *w, const SVECTOR_SOA *v)
+     /* <w,v> for a single precision w. Products and sums are taken in
+        double and in the order of sprod_ns_soa(), so the result only
+        differs by the rounding of w; with AVX2 one gather fetches
+        eight weights instead of four. */
+{
+  const int32_t *idx = v->wnum;
+  const float *val = v->weight;
+  long i, n = v->n_pad;
+#ifdef __AVX2__
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  __m256 g, x;
+  double t[4];
+
+  for(i = 0; i < n; i += 8) {
+    g = _mm256_i32gather_ps(w, _mm256_loadu_si256((const __m256i *)(idx+i)), 4);
+    x = _mm256_loadu_ps(val+i);
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(g)),
+                                         _mm256_cvtps_pd(_mm256_castps256_ps128(x))));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(g, 1)),
+                                         _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1))));
+  }
+  _mm256_storeu_pd(t, _mm256_add_pd(s0, s1));
+  return((t[0]+t[1])+(t[2]+t[3]));
+#else
+  double s[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int k;
+
+  for(i = 0; i < n; i += 8) {
+    for(k = 0; k < 8; k++)
+      s[k] += (double) w[idx[i+k]]*(double) val[i+k];
+  }
+  return(((s[0]+s[4])+(s[1]+s[5]))+((s[2]+s[6])+(s[3]+s[7])));
+#endif
+}
+
+void add_vector_ns_soa(double *w, const SVECTOR_SOA *v, double factor)
+     /* w += factor*v */
+{
+  long k;
+
+  for(k = 0; k < v->n; k++)
+    w[v->wnum[k]] += factor*v->weight[k];
+}
+
+int32_t *read_feature_permutation(char *file, long *n)
+     /* reads a permutation written by write_feature_permutation(): the
+        number of features n, then perm[1] to perm[n], one per line.
+        Returns NULL if the file cannot be read or does not hold a
+        permutation of 1..n. */
+{
+  FILE *fp = fopen(file, "r");
+  int32_t *perm;
+  char *seen;
+  long f, k;
+
+  if(fp == NULL)
+    return(NULL);
+  if((fscanf(fp, "%ld", n) != 1) || (*n < 1)) {
+    fclose(fp);
+    return(NULL);
+  }
+  perm = (int32_t *) my_malloc((*n+1)*sizeof(int32_t));
+  seen = (char *) my_malloc(*n+1);
+  memset(seen, 0, *n+1);
+  perm[0] = 0;
+  for(f = 1; f <= *n; f++) {
+    if((fscanf(fp, "%ld", &k) != 1) || (k < 1) || (k > *n) || seen[k])
+      break;
+    seen[k] = 1;
+    perm[f] = k;
+  }
+  fclose(fp);
+  free(seen);
+  if(f <= *n) {
+    free(perm);
+    return(NULL);
+  }
+  return(perm);
+}
+
+int write_feature_permutation(char *file, int32_t *perm, long n)
+     /* returns non-zero on failure */
+{
+  FILE *fp = fopen(file, "w");
+  long f;
+
+  if(fp == NULL)
+    return(1);
+  fprintf(fp, "%ld\n", n);
+  for(f = 1; f <= n; f++)
+    fprintf(fp, "%d\n", perm[f]);
+  if(ferror(fp)) {
+    fclose(fp);
+    return(1);
+  }
+  return(fclose(fp) != 0);
+}
+
+void set_feature_permutation(int32_t *perm, long n)
+     /* perm[1..n] is kept, not copied. Must be called before any
+        vectors are read and weights are loaded. */
+{
+  feature_perm = perm;
+  feature_perm_n = perm ? n : 0;
+}
+
+long feature_permutation_length(void)
+     /* n of the permutation that is set, 0 if none */
+{
+  return(feature_perm_n);
+}
+
+void permute_weights(double *dst, const double *src, long sizePsi)
+     /* weights in model order src[0..sizePsi] to the permuted order;
+        dst must hold the longer of sizePsi and the permutation */
+{
+  long f;
+
+  for(f = 0; f <= sizePsi; f++)
+    dst[PERMUTED(f)] = src[f];
+}
+
+void unpermute_weights(double *dst, const double *src, long sizePsi)
+     /* weights in permuted order src[0..sizePsi] back to model order */
+{
+  long f;
+
+  for(f = 0; f <= sizePsi; f++)
+    dst[f] = src[PERMUTED(f)];
+}
@@ -0,0 +1,73 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_soa.h                                            */
+/*                                                                      */
+/*   Structure-of-arrays sparse vectors for Latent SVM^struct: feature  */
+/*   numbers and weights in separate arrays with an explicit length,    */
+/*   for the candidate scoring kernels, and the feature permutation     */
+/*   that is applied as they are read.                                  */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_SOA
+#define SVM_STRUCT_LATENT_SOA
+
+#include <stdint.h>
+#include "./svm_light/svm_common.h"
+
+#define SOA_WIDTH 8   /* vectors are padded to a multiple of this many features,
+                         and the kernels keep this many partial sums */
+
+/* A sparse vector of n features. Both arrays hold n_pad entries and
+   start 32-byte aligned; the entries from n on have feature number 0
+   and weight 0, so the kernels need no remainder loop. Unlike a WORD
+   array there is no terminating entry. */
+typedef struct svector_soa {
+  long    n;
+  long    n_pad;
+  int32_t *wnum;
+  float   *weight;
+} SVECTOR_SOA;
+
+/* The candidates of one image, stored back to back in one pair of
+   arrays. vecs[j] points into wnum and weight. */
+typedef struct soa_block {
+  int         n_vecs;
+  SVECTOR_SOA *vecs;
+  int32_t     *wnum;
+  float       *weight;
+  long        n_alloc;  /* entries allocated in wnum and weight */
+} SOA_BLOCK;
+
+SOA_BLOCK *create_soa_block(int n_vecs, long *lengths);
+SOA_BLOCK *soa_block_from_svectors(SVECTOR **fvecs, int n);
+SOA_BLOCK *read_feature_block(char *file, int n);
+SOA_BLOCK *begin_feature_block(int n);
+long      add_feature_line(SOA_BLOCK *b, long used, char *line);
+void      end_feature_block(SOA_BLOCK *b);
+void      free_soa_block(SOA_BLOCK *b);
+SVECTOR   *svector_from_soa(SVECTOR_SOA *v);
+long      max_wnum_soa(SOA_BLOCK *b);
+
+double sprod_ns_soa(const double *w, const SVECTOR_SOA *v);
+double sprod_fs_soa(const float *w, const SVECTOR_SOA *v);
+void   add_vector_ns_soa(double *w, const SVECTOR_SOA *v, double factor);
+
+/* A feature permutation maps feature number f in 1..n to perm[f], so
+   that features scored together share cache lines of w. Once set, it
+   is applied to every vector read through this module, and weight
+   vectors are kept in the permuted order in memory; model files stay
+   in the original order. Feature numbers above n are not moved. */
+int32_t *read_feature_permutation(char *file, long *n);
+int      write_feature_permutation(char *file, int32_t *perm, long n);
+void     set_feature_permutation(int32_t *perm, long n);
+long     feature_permutation_length(void);
+void     permute_weights(double *dst, const double *src, long sizePsi);
+void     unpermute_weights(double *dst, const double *src, long sizePsi);
+
+#endif
@@ -25,6 +25,13 @@
 #include <math.h>
 #include "svm_struct_latent_api.h"
 #include "./svm_light/svm_learn.h"
+#include "svm_struct_latent_snapshot.h"
+#include "svm_struct_latent_checkpoint.h"
+#include "svm_struct_latent_kernels.h"
+#include "svm_struct_latent_profile.h"
+#include "svm_struct_latent_alloc.h"
+#include "svm_struct_latent_parallel.h"
+#include "svm_struct_latent_telemetry.h"
 
 
 #define ALPHA_THRESHOLD 1E-14
@@ -49,13 +56,33 @@ void my_read_input_parameters(int argc, char* argv[], char *trainfile, char *mod
 
 void my_wait_any_key();
 
-int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double **ptr_delta, DOC ***ptr_dXc,
+int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double **ptr_delta, double ***ptr_dXc,
 		double ***ptr_G, int *mv_iter);
 
 void approximate_to_psd(double **G, int size_active, double eps);
 
 void Jacobi_Cyclic_Method(double eigenvalues[], double *eigenvectors, double *A, int n);
 
+/* dense kernels for the feature dimension of this run, set in main() */
+static DENSE_KERNELS dense;
+
+/* progress events if --J is given, and the iterations they belong to;
+   acs_iter is -1 outside alternate_convex_search() */
+static TELEMETRY_WRITER *telemetry = NULL;
+static int outer_iter_now = 0, acs_iter_now = -1;
+
+/* the most violated labelling of every example from the self-paced
+   selection pass, with its loss. It seeds the first cutting plane of
+   the following solve, which is therefore the plane at the w and h of
+   the selection pass, not at the w = 0 the solver starts from, and is
+   taken without mine_negatives(). Runs with -k thus train differently
+   from runs that mine the first plane afresh. */
+typedef struct selection_cache {
+	LABEL *ybar;
+	double *loss;
+	int filled;
+} SELECTION_CACHE;
+
 double sprod_nn(double *a, double *b, long n) {
   double ans=0.0;
   long i;
@@ -72,87 +99,158 @@ void add_vector_nn(double *w, double *dense_x, long n, double factor) {
   }
 }
 
-double* add_list_nn(SVECTOR *a, long totwords) 
-     /* computes the linear combination of the SVECTOR list weighted
-	by the factor of each SVECTOR. assumes that the number of
-	features is small compared to the number of elements in the
-	list */
-{
-    SVECTOR *f;
-    long i;
-    double *sum;
 
-    sum=create_nvector(totwords);
+static void timed_parallel_for(PROF_PHASE p, long m, STRUCT_LEARN_PARM *sparm, PARALLEL_BODY body, void *arg)
+     /* parallel_for() over the examples. The profiler only times the
+        phases of the calling thread, so with several threads the loop
+        is timed as the one phase p instead of the phases inside it */
+{
+	if ((m > 1) && (resolve_thread_count(sparm->n_threads) > 1)) {
+		prof_begin(p);
+		prof_pause();
+		parallel_for(m, sparm->n_threads, body, arg);
+		prof_resume();
+		prof_end(p);
+	}
+	else {
+		parallel_for(m, sparm->n_threads, body, arg);
+	}
+}
 
-    for(i=0;i<=totwords;i++) 
-      sum[i]=0;
+/* the terms of the examples in a cutting plane, found in parallel */
+typedef struct constraint_job {
+	EXAMPLE *ex;
+	STRUCTMODEL *sm;
+	STRUCT_LEARN_PARM *sparm;
+	int *valid_examples;
+	SELECTION_CACHE *cache;
+	SVECTOR **fy;
+	SVECTOR **fybar;
+	double *lossval;
+} CONSTRAINT_JOB;
 
-    for(f=a;f;f=f->next)  
-      add_vector_ns(sum,f,f->factor);
+static void example_constraint_body(long i, int thread_id, void *arg)
+{
+	CONSTRAINT_JOB *job = (CONSTRAINT_JOB *) arg;
+	EXAMPLE *ex = &job->ex[i];
+	LABEL ybar;
+	LATENT_VAR hbar;
 
-    return(sum);
+	job->fy[i] = NULL;
+	job->fybar[i] = NULL;
+	if (!job->valid_examples[i])
+		return;
+	if (job->cache) {
+		/* hbar is h in the loss-augmented inference */
+		job->fy[i] = psi(ex->x, ex->y, ex->h, job->sm, job->sparm);
+		job->fybar[i] = psi(ex->x, job->cache->ybar[i], ex->h, job->sm, job->sparm);
+		job->lossval[i] = job->cache->loss[i];
+	}
+	else {
+		find_most_violated_constraint_marginrescaling(&ex->x, ex->y, &ex->h, &ybar, &hbar, job->sm, job->sparm);
+		job->fy[i] = psi(ex->x, ex->y, ex->h, job->sm, job->sparm);
+		job->fybar[i] = psi(ex->x, ybar, hbar, job->sm, job->sparm);
+		job->lossval[i] = loss(ex->y, ybar, hbar, job->sparm);
+		free_label(ybar);
+		free_latent_var(hbar, ex->x);
+	}
 }
 
-
-double current_obj_val(EXAMPLE *ex, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, double C, int *valid_examples) {
-
+static SVECTOR *most_violated_terms(EXAMPLE *ex, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+                                    int *valid_examples, SELECTION_CACHE *cache, double n_avg, double *margin) {
+/*
+  Returns psi(y,h)-psi(ybar,hbar) of the most violated labelling of
+  every valid example as one list, and their losses summed in *margin,
+  both weighted by example_cost/n_avg. The examples are searched in
+  parallel and added in their order. If cache is not NULL, the
+  labellings and losses are taken from it instead of being inferred
+  again.
+*/
   long i;
-  SVECTOR *f, *fy, *fybar, *lhs;
-  LABEL       ybar;
-  LATENT_VAR hbar;
-  double lossval, margin;
-  double *new_constraint;
-	double obj = 0.0;
+  SVECTOR *f, *lhs;
+  CONSTRAINT_JOB job;
+
+  job.ex = ex;
+  job.sm = sm;
+  job.sparm = sparm;
+  job.valid_examples = valid_examples;
+  job.cache = cache;
+  job.fy = (SVECTOR **) my_malloc(m*sizeof(SVECTOR *));
+  job.fybar = (SVECTOR **) my_malloc(m*sizeof(SVECTOR *));
+  job.lossval = (double *) my_malloc(m*sizeof(double));
+  /* psi is counted as loss-augmented inference if timed as one */
+  timed_parallel_for(PROF_LOSS_AUG, m, sparm, example_constraint_body, &job);
 
-  /* find cutting plane */
   lhs = NULL;
-  margin = 0;
+  *margin = 0;
   for (i=0;i<m;i++) {
-		if(!valid_examples[i])
-			continue;
-	
-    find_most_violated_constraint_marginrescaling(&ex[i].x, ex[i].y, &ex[i].h, &ybar, &hbar, sm, sparm);
-	
-    /* get difference vector */
-    //fy = copy_svector(fycache[i]);
-    fy = psi(ex[i].x, ex[i].y, ex[i].h, sm, sparm);
-    fybar = psi(ex[i].x,ybar,hbar,sm,sparm);
-    lossval = loss(ex[i].y,ybar,hbar,sparm);
-    
-    // added by aseem
-    //free_label(ybar);
-    free_latent_var(hbar, ex[i].x);
-
+    if (!valid_examples[i])
+      continue;
     /* scale difference vector */
-    for (f=fy;f;f=f->next) {
-      //f->factor*=1.0/m;
-      f->factor*=ex[i].x.example_cost/m;
+    for (f=job.fy[i];f;f=f->next) {
+      f->factor*=ex[i].x.example_cost/n_avg;
     }
-    for (f=fybar;f;f=f->next) {
-      //f->factor*=-1.0/m;
-      f->factor*=-ex[i].x.example_cost/m;
+    for (f=job.fybar[i];f;f=f->next) {
+      f->factor*=-ex[i].x.example_cost/n_avg;
     }
     /* add ybar to constraint */
-    append_svector_list(fy,lhs);
-    append_svector_list(fybar,fy);
-    lhs = fybar;
-    //margin+=lossval/m;
-		margin += lossval*ex[i].x.example_cost/m;
+    append_svector_list(job.fy[i],lhs);
+    append_svector_list(job.fybar[i],job.fy[i]);
+    lhs = job.fybar[i];
+    *margin+=job.lossval[i]*ex[i].x.example_cost/n_avg;
   }
 
+  free(job.fy);
+  free(job.fybar);
+  free(job.lossval);
+  return(lhs);
+}
+
+double current_obj_val(EXAMPLE *ex, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, double C, int *valid_examples) {
+
+  SVECTOR *lhs;
+  double margin;
+  double *new_constraint;
+	double obj = 0.0;
+
+  prof_begin(PROF_OBJECTIVE);
+  /* find cutting plane */
+  lhs = most_violated_terms(ex, m, sm, sparm, valid_examples, NULL, (double) m, &margin);
+
   /* compact the linear representation */
   new_constraint = add_list_nn(lhs, sm->sizePsi);
   free_svector(lhs);
 
 	obj = margin;
-	for(i = 1; i < sm->sizePsi+1; i++)
-		obj -= new_constraint[i]*sm->w[i];
+	obj -= dense.dot(new_constraint, sm->w, dense.n);
 	if(obj < 0.0)
 		obj = 0.0;
 	obj *= C;
-	for(i = 1; i < sm->sizePsi+1; i++)
-		obj += 0.5*sm->w[i]*sm->w[i];
+	obj += 0.5*dense.dot(sm->w, sm->w, dense.n);
   free(new_constraint);
+  prof_end(PROF_OBJECTIVE);
+
+	return obj;
+}
+
+double constraint_obj_val(double *constraint, double margin, long n_valid, long m, STRUCTMODEL *sm, double C) {
+/*
+  The objective of current_obj_val() from a cutting plane that
+  find_cutting_plane() built with the current w, without running the
+  inference again. find_cutting_plane() averages over the n_valid
+  selected examples, current_obj_val() over all m.
+*/
+	double obj;
+
+	prof_begin(PROF_OBJECTIVE);
+	obj = margin;
+	obj -= dense.dot(constraint, sm->w, dense.n);
+	obj *= (double) n_valid/m;
+	if(obj < 0.0)
+		obj = 0.0;
+	obj *= C;
+	obj += 0.5*dense.dot(sm->w, sm->w, dense.n);
+	prof_end(PROF_OBJECTIVE);
 
 	return obj;
 }
@@ -169,103 +267,98 @@ int compar(const void *a, const void *b)
 }
 
 
-SVECTOR* find_cutting_plane(EXAMPLE *ex, double *margin, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
-														int *valid_examples) {
+double* find_cutting_plane(EXAMPLE *ex, double *margin, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm,
+														int *valid_examples, SELECTION_CACHE *cache) {
+/*
+  Returns the constraint of the most violated labelling as a dense
+  vector indexed 0..sizePsi, for the dense kernels. If cache is not
+  NULL, the labellings and losses are taken from it instead of being
+  inferred again.
+*/
 
   long i;
-  SVECTOR *f, *fy, *fybar, *lhs;
-  LABEL       ybar;
-  LATENT_VAR hbar;
-  double lossval;
+  SVECTOR *lhs;
   double *new_constraint;
 	long valid_count = 0;
 
-  long l,k;
-  SVECTOR *fvec;
-  WORD *words;  
-
+  prof_begin(PROF_CONSTRAINT);
   /* find cutting plane */
-  lhs = NULL;
-  *margin = 0;
-
 	for (i=0;i<m;i++) {
 		if (valid_examples[i]) {
 			valid_count++;
 		}
 	}
+  lhs = most_violated_terms(ex, m, sm, sparm, valid_examples, cache, (double) valid_count, margin);
 
-  for (i=0;i<m;i++) {
-
-		if (!valid_examples[i]) {
-			continue;
-		}
-
-    
-    find_most_violated_constraint_marginrescaling(&ex[i].x, ex[i].y, &ex[i].h, &ybar, &hbar, sm, sparm);
-
-    /* get difference vector */
-    //fy = copy_svector(fycache[i]);
-    fy = psi(ex[i].x, ex[i].y, ex[i].h, sm, sparm);
-    fybar = psi(ex[i].x,ybar,hbar,sm,sparm);
-    lossval = loss(ex[i].y,ybar,hbar,sparm);
-    free_label(ybar);
-    free_latent_var(hbar, ex[i].x);
-		
-    /* scale difference vector */
-    for (f=fy;f;f=f->next) {
-      //f->factor*=1.0/m;
-      //f->factor*=ex[i].x.example_cost/m;
-      f->factor*=ex[i].x.example_cost/valid_count;
-    }
-    for (f=fybar;f;f=f->next) {
-      //f->factor*=-1.0/m;
-      //f->factor*=-ex[i].x.example_cost/m;
-      f->factor*=-ex[i].x.example_cost/valid_count;
-    }
-    /* add ybar to constraint */
-    append_svector_list(fy,lhs);
-    append_svector_list(fybar,fy);
-    lhs = fybar;
-    //*margin+=lossval/m;
-    //*margin+=lossval*ex[i].x.example_cost/m;
-    *margin+=lossval*ex[i].x.example_cost/valid_count;
-  }
-
-  /* compact the linear representation */
+  /* compact the linear representation; numerically zero entries are
+     dropped, as they were from the sparse constraints */
   new_constraint = add_list_nn(lhs, sm->sizePsi);
   free_svector(lhs);
 
-  l=0;
-  for (i=1;i<sm->sizePsi+1;i++) {
-    if (fabs(new_constraint[i])>1E-10) l++; // non-zero
-  }
-  words = (WORD*)my_malloc(sizeof(WORD)*(l+1)); 
-  assert(words!=NULL);
-  k=0;
   for (i=1;i<sm->sizePsi+1;i++) {
-    if (fabs(new_constraint[i])>1E-10) {
-      words[k].wnum = i;
-      words[k].weight = new_constraint[i]; 
-      k++;
-    }
+    if (fabs(new_constraint[i])<=1E-10) new_constraint[i] = 0.0;
   }
-  words[k].wnum = 0;
-  words[k].weight = 0.0;
-  fvec = create_svector(words,"",1);
+  prof_end(PROF_CONSTRAINT);
 
-  free(words);
-  free(new_constraint);
+  return(new_constraint); 
+}
+
+/* the latent variables of different examples are independent */
+typedef struct latent_job {
+	EXAMPLE *ex;
+	STRUCTMODEL *sm;
+	STRUCT_LEARN_PARM *sparm;
+	int outer_iter;
+} LATENT_JOB;
+
+static void example_mining_body(long i, int thread_id, void *arg)
+{
+	LATENT_JOB *job = (LATENT_JOB *) arg;
+
+	mine_negative_latent_variables(job->ex[i].x, &job->ex[i].h, job->sm);
+}
+
+static void example_imputation_body(long i, int thread_id, void *arg)
+{
+	LATENT_JOB *job = (LATENT_JOB *) arg;
+
+	infer_latent_variables(job->ex[i].x, job->ex[i].y, &job->ex[i].h, job->sm, job->sparm, job->outer_iter);
+}
+
+void mine_negatives(EXAMPLE *ex, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm) {
+/*
+  Mines the latent variables of the negative images of all examples. 
+*/
+	LATENT_JOB job;
+
+	job.ex = ex;
+	job.sm = sm;
+	job.sparm = sparm;
+	job.outer_iter = 0;
+	timed_parallel_for(PROF_NEG_MINING, m, sparm, example_mining_body, &job);
+}
 
-  return(fvec); 
+void impute_positives(EXAMPLE *ex, long m, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int outer_iter) {
+/*
+  Imputes the latent variables of the positive images of all examples. 
+*/
+	LATENT_JOB job;
+
+	job.ex = ex;
+	job.sm = sm;
+	job.sparm = sparm;
+	job.outer_iter = outer_iter;
+	timed_parallel_for(PROF_POS_IMPUTATION, m, sparm, example_imputation_body, &job);
 }
 
 double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double epsilon, EXAMPLE *ex, 
-															STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int *valid_examples) {
+															STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int *valid_examples,
+															SELECTION_CACHE *seed) {
   long i,j;
   double *alpha;
-  DOC **dXc; /* constraint matrix */
+  double **dXc; /* constraint matrix, one dense row per constraint */
   double *delta; /* rhs of constraints */
-  SVECTOR *new_constraint;
+  double *new_constraint;
   int iter, size_active; 
   double value;
 	double threshold = 0.0;
@@ -275,8 +368,9 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 	int mv_iter;
 	int *idle = NULL;
 	double **G = NULL;
-	SVECTOR *f;
 	int r;
+	long n_valid = 0;
+	int stale; /* new_constraint was not found with the current w */
 
   /* set parameters for hideo solver */
   LEARN_PARM lparm;
@@ -319,14 +413,30 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 
   printf("Running structural SVM solver: "); fflush(stdout); 
 
-  	mine_negative_latent_variables(ex[0].x, &ex[0].h, sm);
-	new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples);
- 	value = margin - sprod_ns(w, new_constraint);
+	prof_begin(PROF_CUTTING_PLANE);
+	for (i=0;i<m;i++)
+		n_valid += (valid_examples[i] != 0);
+	refresh_float_weights(sm);
+	/* the selection pass has already done the inference for the first
+	   constraint, at its own w and with the latent variables and
+	   negatives it had; see SELECTION_CACHE */
+	if (seed && seed->filled) {
+		new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples, seed);
+		stale = 1;
+	}
+	else {
+  		mine_negatives(ex, m, sm, sparm);
+		new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples, NULL);
+		stale = 0;
+	}
+ 	value = margin - dense.dot(w, new_constraint, dense.n);
 	while((iter<MAX_ITER)) {
 		if(value <= (threshold+epsilon)){
-			mine_negative_latent_variables(ex[0].x, &ex[0].h, sm);
-			new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples);
-			value = margin - sprod_ns(w, new_constraint);
+			mine_negatives(ex, m, sm, sparm);
+			free(new_constraint);
+			new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples, NULL);
+			stale = 0;
+			value = margin - dense.dot(w, new_constraint, dense.n);
 			if(value<=(threshold+epsilon)){
 	            break;
 	        }
@@ -338,12 +448,9 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 
 
         // add  constraint
-      	dXc = (DOC**)realloc(dXc, sizeof(DOC*)*size_active);
+      	dXc = (double**)realloc(dXc, sizeof(double*)*size_active);
        	assert(dXc!=NULL);
-       	dXc[size_active-1] = (DOC*)malloc(sizeof(DOC));
-       	dXc[size_active-1]->fvec = new_constraint; 
-       	dXc[size_active-1]->slackid = 1; // only one common slackid (one-slack)
-       	dXc[size_active-1]->costfactor = 1.0;
+       	dXc[size_active-1] = new_constraint; 
 
        	delta = (double*)realloc(delta, sizeof(double)*size_active);
        	assert(delta!=NULL);
@@ -358,6 +465,7 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 		idle[size_active-1] = 0;
 
 		// update Gram matrix
+		prof_begin(PROF_GRAM);
 		G = (double **) realloc(G, sizeof(double *)*size_active);
 		assert(G!=NULL);
 		G[size_active-1] = NULL;
@@ -366,16 +474,19 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 			assert(G[j]!=NULL);
 		}
 		for(j = 0; j < size_active-1; j++) {
-			G[size_active-1][j] = sprod_ss(dXc[size_active-1]->fvec, dXc[j]->fvec);
+			G[size_active-1][j] = dense.dot(dXc[size_active-1], dXc[j], dense.n);
 			G[j][size_active-1]  = G[size_active-1][j];
 		}
-		G[size_active-1][size_active-1] = sprod_ss(dXc[size_active-1]->fvec,dXc[size_active-1]->fvec);
+		G[size_active-1][size_active-1] = dense.dot(dXc[size_active-1], dXc[size_active-1], dense.n);
 
 		// hack: add a constant to the diagonal to make sure G is PSD 
 		G[size_active-1][size_active-1] += 1e-6;
+		prof_end(PROF_GRAM);
 
    	    // solve QP to update alpha 
+		prof_begin(PROF_QP);
 		r = mosek_qp_optimize(G, delta, alpha, (long) size_active, C, &cur_obj);
+		prof_end(PROF_QP);
 
 		if(r >= 1293 && r <= 1296)
 		{
@@ -391,24 +502,19 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
        	clear_nvector(w,sm->sizePsi);
        	for (j=0;j<size_active;j++) {
          	if (alpha[j]>C*ALPHA_THRESHOLD) {
-				    add_vector_ns(w,dXc[j]->fvec,alpha[j]);
+				    dense.axpy(w,alpha[j],dXc[j],dense.n);
 				    idle[j] = 0;
          	}
 			    else
 				    idle[j]++;
        	}
+		refresh_float_weights(sm);
+		stale = 1;
 
 		cur_slack = (double *) realloc(cur_slack,sizeof(double)*size_active);
 
 		for(i = 0; i < size_active; i++) {
-			cur_slack[i] = 0.0;
-			for(f = dXc[i]->fvec; f; f = f->next) {
-				j = 0;
-				while(f->words[j].wnum) {
-					cur_slack[i] += w[f->words[j].wnum]*f->words[j].weight;
-					j++;
-				}
-			}
+			cur_slack[i] = dense.dot(w, dXc[i], dense.n);
 			if(cur_slack[i] >= delta[i])
 				cur_slack[i] = 0.0;
 			else
@@ -428,34 +534,57 @@ double cutting_plane_algorithm(double *w, long m, int MAX_ITER, double C, double
 		else
 			threshold = 0.0;
 
- 		new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples);
-   	    value = margin - sprod_ns(w, new_constraint);
+ 		new_constraint = find_cutting_plane(ex, &margin, m, sm, sparm, valid_examples, NULL);
+		stale = 0;
+   	    value = margin - dense.dot(w, new_constraint, dense.n);
 
 		if((iter % CLEANUP_CHECK) == 0)
 		{
 			printf("+"); fflush(stdout);
+			prof_begin(PROF_CLEANUP);
 			size_active = resize_cleanup(size_active, &idle, &alpha, &delta, &dXc, &G, &mv_iter);
+			prof_end(PROF_CLEANUP);
 		}
+		prof_set(PROF_CONSTRAINTS, size_active);
+		if(sparm->profile > 1)
+			prof_report(PROF_LEVEL_CUTTING_PLANE, NULL, iter);
+		telemetry_begin(telemetry, "cutting_plane");
+		telemetry_int(telemetry, "outer", outer_iter_now);
+		telemetry_int(telemetry, "acs", acs_iter_now);
+		telemetry_int(telemetry, "iter", iter);
+		telemetry_double(telemetry, "slack", value);
+		telemetry_double(telemetry, "threshold", threshold);
+		telemetry_double(telemetry, "qp_objective", cur_obj);
+		telemetry_int(telemetry, "constraints", size_active);
+		telemetry_int(telemetry, "n_valid", n_valid);
+		telemetry_phases(telemetry, PROF_LEVEL_CUTTING_PLANE);
+		telemetry_end(telemetry);
 
  	} // end cutting plane while loop 
 
-	primal_obj = current_obj_val(ex, m, sm, sparm, C, valid_examples);
+	/* the last constraint is the most violated one at the final w unless
+	   w has changed since */
+	if (stale)
+		primal_obj = current_obj_val(ex, m, sm, sparm, C, valid_examples);
+	else
+		primal_obj = constraint_obj_val(new_constraint, margin, n_valid, m, sm, C);
 
   printf(" Inner loop optimization finished.\n"); fflush(stdout); 
       
   /* free memory */
   for (j=0;j<size_active;j++) {
 		free(G[j]);
-    free_example(dXc[j],1);	
+    free(dXc[j]);	
   }
 	free(G);
   free(dXc);
   free(alpha);
   free(delta);
-  free_svector(new_constraint);
+  free(new_constraint);
 	free(cur_slack);
 	free(idle);
   if (svm_model!=NULL) free_model(svm_model,0);
+	prof_end(PROF_CUTTING_PLANE);
 
   return(primal_obj);
 }
@@ -475,10 +604,47 @@ int check_acs_convergence(int *prev_valid_examples, int *valid_examples, long m)
 	return converged;
 }
 
-int update_valid_examples(double *w, long m, double C, EXAMPLE *ex, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int *valid_examples, double spl_weight)
+typedef struct slack_job {
+	EXAMPLE *ex;
+	STRUCTMODEL *sm;
+	STRUCT_LEARN_PARM *sparm;
+	sortStruct *slack;
+	SELECTION_CACHE *cache;
+} SLACK_JOB;
+
+static void example_slack_body(long i, int thread_id, void *arg)
+{
+	SLACK_JOB *job = (SLACK_JOB *) arg;
+
+	job->slack[i].index = i;
+	if(job->cache)
+		job->slack[i].val = most_violated_slack(&job->ex[i].x, job->ex[i].y, &job->ex[i].h, job->sm, job->sparm,
+		                                        &job->cache->ybar[i], &job->cache->loss[i]);
+	else
+		job->slack[i].val = most_violated_slack(&job->ex[i].x, job->ex[i].y, &job->ex[i].h, job->sm, job->sparm,
+		                                        NULL, NULL);
+}
+
+static void clear_selection_cache(SELECTION_CACHE *cache, long m)
+{
+	long i;
+
+	if(cache->filled)
+		for (i=0;i<m;i++)
+			free_label(cache->ybar[i]);
+	cache->filled = 0;
+}
+
+int update_valid_examples(double *w, long m, double C, EXAMPLE *ex, STRUCTMODEL *sm, STRUCT_LEARN_PARM *sparm, int *valid_examples, double spl_weight,
+                          SELECTION_CACHE *cache)
  {
+/*
+  Selects the examples whose slack is below the self-paced threshold.
+  If cache is not NULL, the most violated labellings found on the way
+  are kept there for the first cutting plane.
+*/
 
-	long i, j;
+	long i;
 
 	/* if self-paced learning weight is non-positive, all examples are valid */
 	if(spl_weight <= 0.0) {
@@ -487,48 +653,24 @@ int update_valid_examples(double *w, long m, double C, EXAMPLE *ex, STRUCTMODEL
 		return (m);
 	}
 
+	prof_begin(PROF_SELECTION);
 	sortStruct *slack = (sortStruct *) malloc(m*sizeof(sortStruct));
-	LABEL ybar;
-	LATENT_VAR hbar;
-	SVECTOR *f, *fy, *fybar;
-	//double lossval;
+	SLACK_JOB job;
 	double penalty = 1.0/spl_weight;
 	if(penalty < 0.0)
 		penalty = DBL_MAX;
 
-	for (i=0;i<m;i++) {
-		find_most_violated_constraint_marginrescaling(&ex[i].x, ex[i].y, &ex[i].h, &ybar, &hbar, sm, sparm);
-		//fy = copy_svector(fycache[i]);
-		fy = psi(ex[i].x, ex[i].y, ex[i].h, sm, sparm);
-		fybar = psi(ex[i].x,ybar,hbar,sm,sparm);
-		slack[i].index = i;
-		slack[i].val = loss(ex[i].y,ybar,hbar,sparm);
-		
-		// added by aseem
-		//free_label(ybar);
-        //free_latent_var(hbar, ex[i].x);
-		
-		for (f=fy;f;f=f->next) {
-			j = 0;
-			while (1) {
-				if(!f->words[j].wnum)
-					break;
-				slack[i].val -= sm->w[f->words[j].wnum]*f->words[j].weight;
-				j++;
-			}
-		}
-		for (f=fybar;f;f=f->next) {
-			j = 0;
-			while (1) {
-				if(!f->words[j].wnum)
-					break;
-				slack[i].val += sm->w[f->words[j].wnum]*f->words[j].weight;
-				j++;
-			}
-		}
-		free_svector(fy);
-		free_svector(fybar);
-	}
+	/* the slacks of the examples are independent */
+	job.ex = ex;
+	job.sm = sm;
+	job.sparm = sparm;
+	job.slack = slack;
+	job.cache = cache;
+	if(cache)
+		clear_selection_cache(cache, m);
+	timed_parallel_for(PROF_LOSS_AUG, m, sparm, example_slack_body, &job);
+	if(cache)
+		cache->filled = 1;
 	qsort(slack,m,sizeof(sortStruct),&compar);
 
 	int nValid = 0;
@@ -542,6 +684,7 @@ int update_valid_examples(double *w, long m, double C, EXAMPLE *ex, STRUCTMODEL
 	}
 
 	free(slack);
+	prof_end(PROF_SELECTION);
 
 	return nValid;
 }
@@ -556,10 +699,15 @@ double alternate_convex_search(double *w, long m, int MAX_ITER, double C, double
 
 	int *prev_valid_examples = (int *) malloc(m*sizeof(int));
 	double *best_w = (double *) malloc((sm->sizePsi+1)*sizeof(double));
+	SELECTION_CACHE cache;
 
+	prof_begin(PROF_ACS);
+	cache.ybar = (LABEL *) my_malloc(m*sizeof(LABEL));
+	cache.loss = (double *) my_malloc(m*sizeof(double));
+	cache.filled = 0;
 	for (i=0;i<sm->sizePsi+1;i++)
 		best_w[i] = w[i];
-	nValid = update_valid_examples(w, m, C, ex, sm, sparm, valid_examples, spl_weight);
+	/* the first selection is that of the loop below, with the same w */
 	/*last_relaxed_primal_obj = current_obj_val(ex, m, sm, sparm, C, valid_examples);
 	if(nValid < m)
 		last_relaxed_primal_obj += (double)(m-nValid)/((double)spl_weight);*/
@@ -569,14 +717,16 @@ double alternate_convex_search(double *w, long m, int MAX_ITER, double C, double
 	}
 
 	for (iter=0;;iter++) {
-		nValid = update_valid_examples(w, m, C, ex, sm, sparm, valid_examples, spl_weight);
+		acs_iter_now = iter;
+		nValid = update_valid_examples(w, m, C, ex, sm, sparm, valid_examples, spl_weight, &cache);
 		printf("ACS Iteration %d: number of examples = %d\n",iter,nValid); fflush(stdout);
 		converged = check_acs_convergence(prev_valid_examples,valid_examples,m);
 		if(converged)
 			break;
 		for (i=0;i<sm->sizePsi+1;i++)
 			w[i] = 0.0;
-		relaxed_primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, ex, sm, sparm, valid_examples);
+		relaxed_primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, ex, sm, sparm, valid_examples, &cache);
+		clear_selection_cache(&cache, m);
 		/*if(nValid < m)
 			relaxed_primal_obj += (double)(m-nValid)/((double)spl_weight);
 		decrement = last_relaxed_primal_obj-relaxed_primal_obj;
@@ -602,7 +752,18 @@ double alternate_convex_search(double *w, long m, int MAX_ITER, double C, double
 		for (i=0;i<m;i++) {
 			prev_valid_examples[i] = valid_examples[i];
 		}
+		if(sparm->profile)
+			prof_report(PROF_LEVEL_ACS, NULL, iter);
+		telemetry_begin(telemetry, "acs");
+		telemetry_int(telemetry, "outer", outer_iter_now);
+		telemetry_int(telemetry, "acs", iter);
+		telemetry_double(telemetry, "relaxed_primal_objective", relaxed_primal_obj);
+		telemetry_int(telemetry, "n_valid", nValid);
+		telemetry_double(telemetry, "spl_weight", spl_weight);
+		telemetry_phases(telemetry, PROF_LEVEL_ACS);
+		telemetry_end(telemetry);
 	}
+	acs_iter_now = -1;
 
 	for (i=0;i<m;i++) {
 		prev_valid_examples[i] = 1;
@@ -612,13 +773,18 @@ double alternate_convex_search(double *w, long m, int MAX_ITER, double C, double
 		for (i=0;i<sm->sizePsi+1;i++) {
 			w[i] = best_w[i];
 		}
+		refresh_float_weights(sm);
 	}
 
 	//double primal_obj;
 	//primal_obj = current_obj_val(ex, m, sm, sparm, C, prev_valid_examples);
 	
+	clear_selection_cache(&cache, m);
+	free(cache.ybar);
+	free(cache.loss);
 	free(prev_valid_examples);
 	free(best_w);
+	prof_end(PROF_ACS);
 
 	return(relaxed_primal_obj);
 }
@@ -647,6 +813,7 @@ SAMPLE  generate_train_set(SAMPLE alldata, long *perm, int ntrain)
 {
   SAMPLE  train;
   train.n = ntrain;
+  train.manifest = NULL; /* examples still belong to alldata */
   long i;
 
   train.examples = (EXAMPLE *) malloc(train.n*sizeof(EXAMPLE));
@@ -663,6 +830,7 @@ SAMPLE  generate_validation_set(SAMPLE alldata, long *perm, int ntrain)
 {
   SAMPLE  val;
   val.n = alldata.n - ntrain;
+  val.manifest = NULL; /* examples still belong to alldata */
   long i;
 
   val.examples = (EXAMPLE *) malloc(val.n*sizeof(EXAMPLE));
@@ -708,7 +876,7 @@ double negative_mine_loop(double *w, long m, int MAX_ITER, double C, double epsi
     while ((iter<2)||(!stop_crit)) { 
     	printf("NEG MINE ITER %d\n", iter); fflush(stdout);
 
-    	mine_negative_latent_variables(ex[0].x, &ex[0].h, sm);
+    	mine_negatives(ex, m, sm, sparm);
 		
 		primal_obj = alternate_convex_search(w, m, MAX_ITER, C, epsilon, ex, sm, sparm, valid_examples, spl_weight);
 
@@ -752,8 +920,10 @@ int main(int argc, char* argv[]) {
   
   double decrement;
   double primal_obj, last_primal_obj;
-  double stop_crit; 
-	char itermodelfile[2000];
+  double stop_crit = 0;
+	SNAPSHOT_WRITER *snapshots;
+	TRAINING_STATE state;
+	char checkpointfile[1100];
 
 	/* self-paced learning variables */
 	double init_spl_weight;
@@ -765,6 +935,12 @@ int main(int argc, char* argv[]) {
   /* read input parameters */
 	my_read_input_parameters(argc, argv, trainfile, modelfile, init_modelfile, objfile, &learn_parm, &kernel_parm, &sparm, 
 													&init_spl_weight, &spl_factor); 
+	if(sparm.profile || sparm.telemetry_file[0] || sparm.alloc_sites)
+		profile_enable();
+	if(sparm.alloc_sites && !alloc_tracking_enable())
+		printf("Warning: allocations cannot be tracked in this build, ignoring --A\n");
+	if(sparm.telemetry_file[0])
+		telemetry = start_telemetry_writer(sparm.telemetry_file);
 
   epsilon = learn_parm.eps;
   C = learn_parm.svm_c;
@@ -790,35 +966,65 @@ int main(int argc, char* argv[]) {
   /* initialization */
   init_struct_model(alldata,&sm,&sparm,&learn_parm,&kernel_parm); 
 
-  w = create_nvector(sm.sizePsi);
-  clear_nvector(w, sm.sizePsi);
+  w = create_dense_vector(sm.sizePsi);
+  dense = select_dense_kernels(sm.sizePsi);
   
   // added by aseem
   if (sparm.isInitByBinSVM){
-    sm = read_struct_model(init_modelfile, &sparm);
-    for (i=0;i<sm.sizePsi+1;i++)
-      w[i] = sm.w[i]; 
+    STRUCTMODEL init_sm = read_struct_model(init_modelfile, &sparm);
+    for (i=0;i<MIN(init_sm.sizePsi,sm.sizePsi)+1;i++)
+      w[i] = init_sm.w[i]; 
+    free_struct_model(init_sm, &sparm);
   }// added by aseem
   
   sm.w = w; /* establish link to w, as long as w does not change pointer */
+  sm.map_base = NULL;
+  sm.map_len = 0;
+  init_float_weights(&sm, &sparm);
+	valid_examples = (int *) malloc(m*sizeof(int));
+	sprintf(checkpointfile,"%s.ckpt",modelfile);
 
   /* some training information */
   printf("C: %.8g\n", C);
 	printf("spl weight: %.8g\n",init_spl_weight);
   printf("epsilon: %.8g\n", epsilon);
   printf("sample.n: %d\n", sample.n); 
-  printf("sm.sizePsi: %ld\n", sm.sizePsi); fflush(stdout);
+  printf("sm.sizePsi: %ld\n", sm.sizePsi);
+  printf("dense kernels: %s\n", dense.name); fflush(stdout);
+  telemetry_begin(telemetry, "start");
+  telemetry_int(telemetry, "n_examples", m);
+  telemetry_int(telemetry, "size_psi", sm.sizePsi);
+  telemetry_double(telemetry, "C", C);
+  telemetry_double(telemetry, "epsilon", epsilon);
+  telemetry_double(telemetry, "spl_weight", init_spl_weight);
+  telemetry_double(telemetry, "spl_factor", spl_factor);
+  telemetry_end(telemetry);
   
 
+  outer_iter = 0;
+  int latent_update = 0;
+	spl_weight = init_spl_weight;
+	if (sparm.resume_file[0]) {
+		/* restore the state after the last checkpointed outer iteration */
+		printf("Resuming from checkpoint %s...", sparm.resume_file); fflush(stdout);
+		read_checkpoint(sparm.resume_file, &state, w, sm.sizePsi, &sample, valid_examples);
+		refresh_float_weights(&sm);
+		outer_iter = state.outer_iter;
+		latent_update = state.latent_update;
+		stop_crit = state.stop_crit;
+		spl_weight = state.spl_weight;
+		last_primal_obj = state.last_primal_obj;
+		printf("done. Next outer iteration: %d\n", outer_iter); fflush(stdout);
+	}
+	else {
+
   /* impute latent variable for first iteration */
   init_latent_variables(&sample,&learn_parm,&sm,&sparm);
 
   // added by aseem. impute latent variable using updated weight vector
-  outer_iter = 0;
-  int latent_update = 0;
   if (sparm.isInitByBinSVM){
     //infer_latent_variables(ex[0].x, ex[0].y, &ex[0].h, &sm, &sparm);
-    infer_latent_variables(ex[0].x, ex[0].y, &ex[0].h, &sm, &sparm, sparm.initIter);
+    impute_positives(ex, m, &sm, &sparm, sparm.initIter);
     outer_iter = 1 + sparm.initIter;
     latent_update = 1 + sparm.initIter;
   }
@@ -836,7 +1042,6 @@ int main(int argc, char* argv[]) {
   }*/
 
  	/* learn initial weight vector using all training examples */
-	valid_examples = (int *) malloc(m*sizeof(int));
 	if (init_spl_weight>0.0) {
 		printf("INITIALIZATION\n"); fflush(stdout);
 		for (i=0;i<m;i++) {
@@ -844,7 +1049,7 @@ int main(int argc, char* argv[]) {
 		}
 		int initIter;
 		for (initIter=0;initIter<2;initIter++) {
-			primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, ex, &sm, &sparm, valid_examples);
+			primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, ex, &sm, &sparm, valid_examples, NULL);
   		for (i=0;i<m;i++) {
    	 		//aseem free_latent_var(ex[i].h);
    	 		//aseem ex[i].h = infer_latent_variables(ex[i].x, ex[i].y, &sm, &sparm);
@@ -863,13 +1068,15 @@ int main(int argc, char* argv[]) {
   /* outer loop: latent variable imputation */
   //aseem outer_iter = 0;
 	if (sparm.isInitByBinSVM){
-		update_valid_examples(w, m, C, ex, &sm, &sparm, valid_examples, init_spl_weight);
-		mine_negative_latent_variables(ex[0].x, &ex[0].h, &sm);
+		update_valid_examples(w, m, C, ex, &sm, &sparm, valid_examples, init_spl_weight, NULL);
+		mine_negatives(ex, m, &sm, &sparm);
 		last_primal_obj = current_obj_val(ex, m, &sm, &sparm, C, valid_examples);
 	}
 	else{
 		last_primal_obj = DBL_MAX;
 	}
+
+	} /* end of initialization without checkpoint */
   
   decrement = 0;
 
@@ -880,9 +1087,10 @@ int main(int argc, char* argv[]) {
 
 
 	/* initializations */
-	spl_weight = init_spl_weight;
+	snapshots = start_snapshot_writer(modelfile, sm.sizePsi, sparm.snapshot_keep, sparm.snapshot_async);
   while ((outer_iter<2)||((!stop_crit)&&(outer_iter<MAX_OUTER_ITER))) { 
     printf("OUTER ITER %d\n", outer_iter); fflush(stdout);
+    outer_iter_now = outer_iter;
     // cutting plane algorithm
     //primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, fycache, ex, &sm, &sparm, valid_examples);
 		//primal_obj = cutting_plane_algorithm(w, m, MAX_ITER, C, epsilon, ex, &sm, &sparm, valid_examples);
@@ -917,20 +1125,52 @@ int main(int argc, char* argv[]) {
   
     	// impute latent variable using updated weight vector
 		if(nValid) {
-	    	for (i=0;i<m;i++) {
-	    		if(!stop_crit){
-	    			infer_latent_variables(ex[i].x, ex[i].y, &ex[i].h, &sm, &sparm, outer_iter);
-	    		}
+	    	if(!stop_crit){
+	    		impute_positives(ex, m, &sm, &sparm, outer_iter);
 	    	}
 			latent_update++;
 		}
 
-		sprintf(itermodelfile,"%s.%04d",modelfile,outer_iter);
-		write_struct_model(itermodelfile, &sm, &sparm);
+		queue_snapshot(snapshots, w, outer_iter);
+
+		telemetry_begin(telemetry, "outer");
+		telemetry_int(telemetry, "outer", outer_iter);
+		telemetry_double(telemetry, "primal_objective", primal_obj);
+		telemetry_double(telemetry, "decrement", outer_iter ? decrement : NAN);
+		telemetry_int(telemetry, "n_valid", nValid);
+		telemetry_double(telemetry, "spl_weight", spl_weight);
+		telemetry_int(telemetry, "latent_update", latent_update);
+		telemetry_int(telemetry, "stop", stop_crit != 0);
 
     	outer_iter++;  
 		spl_weight /= spl_factor;
+
+		if((sparm.checkpoint_every > 0) && ((outer_iter % sparm.checkpoint_every) == 0)) {
+			state.outer_iter = outer_iter;
+			state.latent_update = latent_update;
+			state.stop_crit = (int) stop_crit;
+			state.spl_weight = spl_weight;
+			state.last_primal_obj = last_primal_obj;
+			prof_begin(PROF_CHECKPOINT);
+			write_checkpoint(checkpointfile, &state, w, sm.sizePsi, &sample, valid_examples);
+			prof_end(PROF_CHECKPOINT);
+		}
+		telemetry_phases(telemetry, PROF_LEVEL_OUTER);
+		if(alloc_tracking_enabled()) {
+			telemetry_int(telemetry, "heap_live_bytes", alloc_live_bytes());
+			telemetry_int(telemetry, "heap_peak_bytes", alloc_peak_bytes());
+		}
+		telemetry_end(telemetry);
+		if(sparm.profile)
+			prof_report(PROF_LEVEL_OUTER, NULL, outer_iter-1);
+		alloc_report("outer iteration", outer_iter-1, sparm.alloc_sites);
   } // end outer loop*/
+	stop_snapshot_writer(snapshots);
+	telemetry_begin(telemetry, "end");
+	telemetry_int(telemetry, "outer_iterations", outer_iter);
+	telemetry_double(telemetry, "primal_objective", last_primal_obj);
+	telemetry_end(telemetry);
+	stop_telemetry_writer(telemetry);
   
   /* write structural model */
   write_struct_model(modelfile, &sm, &sparm);
@@ -959,6 +1199,9 @@ int main(int argc, char* argv[]) {
   free(fycache);*/
 
 	free(valid_examples);
+	if(sparm.profile)
+		prof_summary();
+	alloc_summary(sparm.alloc_sites);
    
   return(0); 
   
@@ -1063,7 +1306,7 @@ void my_wait_any_key()
   (void)getc(stdin);
 }
 
-int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double **ptr_delta, DOC ***ptr_dXc, 
+int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double **ptr_delta, double ***ptr_dXc, 
 		double ***ptr_G, int *mv_iter) 
 {
   int i,j, new_size_active;
@@ -1072,7 +1315,7 @@ int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double *
   int *idle=*ptr_idle;
   double *alpha=*ptr_alpha;
   double *delta=*ptr_delta;
-	DOC	**dXc = *ptr_dXc;
+	double	**dXc = *ptr_dXc;
 	double **G = *ptr_G;
 	int new_mv_iter;
 
@@ -1088,7 +1331,7 @@ int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double *
 		free(G[i]);
 		G[i] = G[j];
 		G[j] = NULL;
-    free_example(dXc[i],1);
+    free(dXc[i]);
     dXc[i] = dXc[j];
     dXc[j] = NULL;
 		if(j == *mv_iter)
@@ -1100,14 +1343,14 @@ int resize_cleanup(int size_active, int **ptr_idle, double **ptr_alpha, double *
   }
   for (k=i;k<size_active;k++) {
 		if (G[k]!=NULL) free(G[k]);
-    if (dXc[k]!=NULL) free_example(dXc[k],1);
+    if (dXc[k]!=NULL) free(dXc[k]);
   }
 	*mv_iter = new_mv_iter;
   new_size_active = i;
   alpha = (double*)realloc(alpha, sizeof(double)*new_size_active);
   delta = (double*)realloc(delta, sizeof(double)*new_size_active);
 	G = (double **) realloc(G, sizeof(double *)*new_size_active);
-  dXc = (DOC**)realloc(dXc, sizeof(DOC*)*new_size_active);
+  dXc = (double**)realloc(dXc, sizeof(double*)*new_size_active);
   assert(dXc!=NULL);
 
   /* resize idle */
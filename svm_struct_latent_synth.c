@@ -0,0 +1,312 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_synth.c                                          */
+/*                                                                      */
+/*   Writes a synthetic training set for Latent SVM^struct: a manifest  */
+/*   and one candidate feature file per image, optionally a test        */
+/*   manifest and the packed training manifest. Features are drawn      */
+/*   from a Zipf-like popularity over scattered feature numbers, as in  */
+/*   real bag-of-words features. One candidate of every positive image  */
+/*   contains a planted set of signal features and tends to have a      */
+/*   large area ratio, so the latent boxes can be learned. The output   */
+/*   depends only on the options and the seed.                          */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "svm_struct_latent_manifest.h"
+#include "svm_struct_latent_tools.h"
+
+#define IMAGES_PER_DIR 1000   /* feature files are spread over subdirectories */
+#define SIGNAL_NOISE   0.02   /* chance of a signal feature in any other candidate */
+
+typedef struct synth_parm {
+  long   n_pos, n_neg;            /* training images */
+  long   n_test_pos, n_test_neg;  /* test images */
+  int    n_candidates;
+  long   feature_size;
+  int    nnz;                     /* feature draws per candidate */
+  double zipf;                    /* exponent of the feature popularity */
+  int    n_signal;                /* planted signal features */
+  double signal;                  /* weight of the signal features */
+  uint64_t seed;
+  int    packed;
+} SYNTH_PARM;
+
+void read_input_parameters(int argc, char **argv, char *prefix, SYNTH_PARM *sp);
+
+static void *checked_malloc(size_t size)
+{
+  void *p = malloc(size > 0 ? size : 1);
+  if(!p) {
+    printf("Error: out of memory\n");
+    exit(1);
+  }
+  return(p);
+}
+
+static int compare_int32(const void *a, const void *b)
+{
+  int32_t x = *(const int32_t *) a, y = *(const int32_t *) b;
+  return((x > y)-(x < y));
+}
+
+static void make_dir(char *dir)
+{
+  if((mkdir(dir, 0755) != 0) && (errno != EEXIST)) {
+    printf("Error: Cannot create directory %s\n", dir);
+    exit(1);
+  }
+}
+
+typedef struct features {
+  int32_t *ids;        /* popularity rank -> feature number */
+  double  *cum;        /* cumulative popularity by rank */
+  int32_t *signal;     /* the signal features */
+  char    *is_signal;  /* by feature number */
+} FEATURES;
+
+static FEATURES *make_features(SYNTH_PARM *sp)
+     /* signal features are taken from the middle of the popularity
+        ranking, so they are neither ubiquitous nor unseen */
+{
+  FEATURES *ft = (FEATURES *) checked_malloc(sizeof(FEATURES));
+  long f, r, t, lo;
+  int32_t tmp;
+
+  ft->ids = (int32_t *) checked_malloc(sp->feature_size*sizeof(int32_t));
+  ft->cum = (double *) checked_malloc(sp->feature_size*sizeof(double));
+  ft->signal = (int32_t *) checked_malloc(sp->n_signal*sizeof(int32_t));
+  ft->is_signal = (char *) checked_malloc(sp->feature_size+1);
+  for(f = 0; f < sp->feature_size; f++)
+    ft->ids[f] = (int32_t) (f+1);
+  for(f = sp->feature_size-1; f > 0; f--) {
+    t = uniform_int(f+1);
+    tmp = ft->ids[f]; ft->ids[f] = ft->ids[t]; ft->ids[t] = tmp;
+  }
+  for(r = 0; r < sp->feature_size; r++)
+    ft->cum[r] = ((r > 0) ? ft->cum[r-1] : 0)+pow(r+1.0, -sp->zipf);
+
+  memset(ft->is_signal, 0, sp->feature_size+1);
+  lo = sp->feature_size/4;
+  for(f = 0; f < sp->n_signal; f++) {
+    do {
+      t = ft->ids[lo+uniform_int(sp->feature_size/2)];
+    } while(ft->is_signal[t]);
+    ft->signal[f] = (int32_t) t;
+    ft->is_signal[t] = 1;
+  }
+  return(ft);
+}
+
+static void free_features(FEATURES *ft)
+{
+  free(ft->ids);
+  free(ft->cum);
+  free(ft->signal);
+  free(ft->is_signal);
+  free(ft);
+}
+
+static long draw_rank(FEATURES *ft, long n)
+{
+  double u = uniform()*ft->cum[n-1];
+  long lo = 0, hi = n-1, mid;
+
+  while(lo < hi) {
+    mid = (lo+hi)/2;
+    if(ft->cum[mid] < u)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return(lo);
+}
+
+static void write_candidate(FILE *fp, FEATURES *ft, SYNTH_PARM *sp, int is_object, int32_t *buf)
+     /* one feature line; background features have weights in (0,1],
+        signal features get sp->signal on top */
+{
+  long n = 0, k;
+  int s;
+  double v;
+
+  for(k = 0; k < sp->nnz; k++)
+    buf[n++] = ft->ids[draw_rank(ft, sp->feature_size)];
+  for(s = 0; s < sp->n_signal; s++) {
+    if(uniform() < (is_object ? 0.5 : SIGNAL_NOISE))
+      buf[n++] = ft->signal[s];
+  }
+  qsort(buf, n, sizeof(int32_t), compare_int32);
+  for(k = 0; k < n; k++) {
+    if((k > 0) && (buf[k] == buf[k-1]))
+      continue;
+    v = 1.0-uniform();
+    if(is_object && ft->is_signal[buf[k]])
+      v += sp->signal;
+    fprintf(fp, "%s%d:%.4f", (k > 0) ? " " : "", buf[k], v);
+  }
+  fprintf(fp, "\n");
+}
+
+static void write_images(char *prefix, char *manifest, long first, long n_pos, long n_neg,
+                         int with_area_ratios, FEATURES *ft, SYNTH_PARM *sp)
+     /* images first..first+n_pos+n_neg-1, positives spread evenly */
+{
+  FILE *mfp, *fp;
+  char dir[1100], file[1200];
+  int32_t *buf = (int32_t *) checked_malloc((sp->nnz+sp->n_signal)*sizeof(int32_t));
+  long n = n_pos+n_neg, i, img;
+  int j, object, label;
+
+  if((mfp = fopen(manifest, "w")) == NULL) {
+    printf("Error: Cannot open %s for output\n", manifest);
+    exit(1);
+  }
+  fprintf(mfp, "%ld\n", n);
+  for(i = 0; i < n; i++) {
+    img = first+i;
+    label = ((i+1)*n_pos/(n > 0 ? n : 1) > i*n_pos/(n > 0 ? n : 1));
+    if(img % IMAGES_PER_DIR == 0) {
+      sprintf(dir, "%s_f/%04ld", prefix, img/IMAGES_PER_DIR);
+      make_dir(dir);
+    }
+    sprintf(file, "%s_f/%04ld/img%07ld.txt", prefix, img/IMAGES_PER_DIR, img);
+    if((fp = fopen(file, "w")) == NULL) {
+      printf("Error: Cannot open %s for output\n", file);
+      exit(1);
+    }
+    object = label ? (int) uniform_int(sp->n_candidates) : -1;
+    for(j = 0; j < sp->n_candidates; j++)
+      write_candidate(fp, ft, sp, j == object, buf);
+    fclose(fp);
+
+    fprintf(mfp, "%s %d %d", file, label, sp->n_candidates);
+    if(label && with_area_ratios) {
+      /* the object usually, but not always, has the largest box */
+      for(j = 0; j < sp->n_candidates; j++)
+        fprintf(mfp, " %d", (int) ((j == object) ? 60+uniform_int(41) : 10+uniform_int(81)));
+    }
+    fprintf(mfp, "\n");
+    if((i+1) % 10000 == 0) {
+      printf("%ld images\n", i+1); fflush(stdout);
+    }
+  }
+  fclose(mfp);
+  free(buf);
+}
+
+
+int main(int argc, char* argv[]) {
+  char prefix[1024];
+  char file[1100];
+  SYNTH_PARM sp;
+  FEATURES *ft;
+  MANIFEST *mf;
+
+  read_input_parameters(argc,argv,prefix,&sp);
+  seed_random(sp.seed);
+
+  sprintf(file,"%s_f",prefix);
+  make_dir(file);
+  ft = make_features(&sp);
+
+  printf("Writing %ld training images...\n", sp.n_pos+sp.n_neg); fflush(stdout);
+  write_images(prefix, prefix, 0, sp.n_pos, sp.n_neg, 1, ft, &sp);
+  if(sp.n_test_pos+sp.n_test_neg > 0) {
+    printf("Writing %ld test images...\n", sp.n_test_pos+sp.n_test_neg); fflush(stdout);
+    sprintf(file,"%s.test",prefix);
+    write_images(prefix, file, sp.n_pos+sp.n_neg, sp.n_test_pos, sp.n_test_neg, 0, ft, &sp);
+  }
+
+  if(sp.packed) {
+    printf("Writing packed manifest..."); fflush(stdout);
+    mf = read_manifest_text(prefix, 1);
+    sprintf(file,"%s.bin",prefix);
+    if(write_manifest_packed(file, mf)) {
+      printf("\nError: failed to write %s\n", file);
+      exit(1);
+    }
+    free_manifest(mf);
+    printf("done.\n");
+  }
+  free_features(ft);
+
+  return(0);
+}
+
+
+void read_input_parameters(int argc, char **argv, char *prefix, SYNTH_PARM *sp) {
+
+  long i;
+
+  /* set default */
+  sp->n_pos = 100;
+  sp->n_neg = 900;
+  sp->n_test_pos = 0;
+  sp->n_test_neg = 0;
+  sp->n_candidates = 20;
+  sp->feature_size = 90112;
+  sp->nnz = 300;
+  sp->zipf = 1.1;
+  sp->n_signal = 64;
+  sp->signal = 1.0;
+  sp->seed = 1;
+  sp->packed = 0;
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 'p': i++; sp->n_pos = atol(argv[i]); break;
+      case 'n': i++; sp->n_neg = atol(argv[i]); break;
+      case 'P': i++; sp->n_test_pos = atol(argv[i]); break;
+      case 'N': i++; sp->n_test_neg = atol(argv[i]); break;
+      case 'c': i++; sp->n_candidates = atoi(argv[i]); break;
+      case 'f': i++; sp->feature_size = atol(argv[i]); break;
+      case 'z': i++; sp->nnz = atoi(argv[i]); break;
+      case 'a': i++; sp->zipf = atof(argv[i]); break;
+      case 'k': i++; sp->n_signal = atoi(argv[i]); break;
+      case 's': i++; sp->signal = atof(argv[i]); break;
+      case 'r': i++; sp->seed = strtoull(argv[i], NULL, 10); break;
+      case 'b': sp->packed = 1; break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  if ((i>=argc) || (sp->n_pos < 0) || (sp->n_neg < 0) || (sp->n_test_pos < 0) || (sp->n_test_neg < 0)
+      || (sp->n_pos+sp->n_neg < 1) || (sp->n_candidates < 1) || (sp->feature_size < 4) || (sp->nnz < 0)
+      || (sp->n_signal < 0) || (sp->n_signal > sp->feature_size/4)) {
+    printf("\nNot enough input parameters!\n\n");
+    printf("usage: svm_struct_latent_synth [options] prefix\n");
+    printf("       -p n  positive training images (default 100)\n");
+    printf("       -n n  negative training images (default 900)\n");
+    printf("       -P n  positive test images (default 0)\n");
+    printf("       -N n  negative test images (default 0)\n");
+    printf("       -c n  candidates per image (default 20)\n");
+    printf("       -f n  number of features, as given with --f (default 90112)\n");
+    printf("       -z n  features drawn per candidate (default 300)\n");
+    printf("       -a x  exponent of the Zipf feature popularity (default 1.1)\n");
+    printf("       -k n  number of signal features, at most a quarter of the\n");
+    printf("             features (default 64)\n");
+    printf("       -s x  weight added to the signal features of the object\n");
+    printf("             candidate of a positive image (default 1.0)\n");
+    printf("       -r n  random seed (default 1)\n");
+    printf("       -b    also write the packed training manifest prefix.bin\n\n");
+    printf("Writes the training manifest prefix, the test manifest prefix.test\n");
+    printf("and the feature files below prefix_f/.\n\n");
+    exit(0);
+  }
+
+  strcpy(prefix, argv[i]);
+
+}
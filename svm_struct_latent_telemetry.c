@@ -0,0 +1,272 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_telemetry.c                                      */
+/*                                                                      */
+/*   JSON-lines event stream for Latent SVM^struct training. The        */
+/*   training loop formats an event into a line buffer and appends it   */
+/*   to one of two buffers; the writer thread writes the other one, so  */
+/*   the loop only waits if a whole buffer is still being written.      */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "svm_struct_latent_api.h"
+#include "svm_struct_latent_telemetry.h"
+
+static void write_all(TELEMETRY_WRITER *tw, char *buf, long len)
+{
+  ssize_t r;
+
+  while(len > 0) {
+    r = write(tw->fd, buf, len);
+    if(r < 0) {
+      if(errno == EINTR)
+        continue;
+      tw->n_lost += len;
+      return;
+    }
+    buf += r;
+    len -= r;
+  }
+}
+
+static void *telemetry_thread(void *arg)
+{
+  TELEMETRY_WRITER *tw = (TELEMETRY_WRITER *) arg;
+  int b;
+
+  pthread_mutex_lock(&tw->lock);
+  for(;;) {
+    while((tw->used[tw->fill] == 0) && !tw->shutdown)
+      pthread_cond_wait(&tw->cond, &tw->lock);
+    if(tw->used[tw->fill] == 0)
+      break;
+    b = tw->fill;
+    tw->fill = 1-b;
+    pthread_mutex_unlock(&tw->lock);
+
+    write_all(tw, tw->buffer[b], tw->used[b]);
+
+    pthread_mutex_lock(&tw->lock);
+    tw->used[b] = 0;
+    pthread_cond_broadcast(&tw->cond);
+  }
+  pthread_mutex_unlock(&tw->lock);
+  return(NULL);
+}
+
+TELEMETRY_WRITER *start_telemetry_writer(char *target)
+     /* target is a file name, or the number of a file descriptor that
+        is already open */
+{
+  TELEMETRY_WRITER *tw = (TELEMETRY_WRITER *) my_malloc(sizeof(TELEMETRY_WRITER));
+  char *s;
+  int l;
+
+  for(s = target; isdigit((unsigned char) *s); s++);
+  if((*target != '\0') && (*s == '\0')) {
+    tw->fd = atoi(target);
+    tw->close_fd = 0;
+  }
+  else {
+    tw->fd = open(target, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    tw->close_fd = 1;
+  }
+  if(tw->fd < 0) {
+    printf("Cannot open telemetry file %s for output!\n", target);
+    exit(1);
+  }
+
+  tw->buffer[0] = (char *) my_malloc(TELEMETRY_BUFFER);
+  tw->buffer[1] = (char *) my_malloc(TELEMETRY_BUFFER);
+  tw->used[0] = tw->used[1] = 0;
+  tw->fill = 0;
+  tw->shutdown = 0;
+  tw->n_events = 0;
+  tw->n_lost = 0;
+  tw->line_len = 0;
+  tw->n_fields = 0;
+  for(l = 0; l < PROF_N_LEVELS; l++)
+    prof_mark(&tw->marks[l]);
+  tw->t_start = prof_now();
+  pthread_mutex_init(&tw->lock, NULL);
+  pthread_cond_init(&tw->cond, NULL);
+  tw->async = 1;
+  if(pthread_create(&tw->thread, NULL, telemetry_thread, tw)) {
+    printf("Warning: cannot start telemetry writer thread, writing synchronously\n");
+    tw->async = 0;
+  }
+  return(tw);
+}
+
+static void append(TELEMETRY_WRITER *tw, const char *format, ...)
+     __attribute__((format(printf, 2, 3)));
+
+static void append(TELEMETRY_WRITER *tw, const char *format, ...)
+     /* an event that does not fit is cut short and ends up invalid,
+        which cannot happen with the fields written by the trainer */
+{
+  va_list ap;
+  long room = TELEMETRY_LINE-tw->line_len;
+  int n;
+
+  va_start(ap, format);
+  n = vsnprintf(tw->line+tw->line_len, room, format, ap);
+  va_end(ap);
+  tw->line_len += (n < room) ? n : room-1;
+}
+
+static void field(TELEMETRY_WRITER *tw, const char *key)
+{
+  append(tw, "%s\"%s\":", tw->n_fields ? "," : "", key);
+  tw->n_fields++;
+}
+
+static void number(TELEMETRY_WRITER *tw, double value)
+     /* JSON has no infinities or NaN */
+{
+  if(isfinite(value))
+    append(tw, "%.10g", value);
+  else
+    append(tw, "null");
+}
+
+static long resident_kb(void)
+     /* current resident set size, -1 if /proc is not available */
+{
+  FILE *fp = fopen("/proc/self/statm", "r");
+  long size, resident = -1;
+
+  if(fp == NULL)
+    return(-1);
+  if(fscanf(fp, "%ld %ld", &size, &resident) != 2)
+    resident = -1;
+  fclose(fp);
+  return((resident < 0) ? -1 : resident*(sysconf(_SC_PAGESIZE)/1024));
+}
+
+void telemetry_begin(TELEMETRY_WRITER *tw, const char *event)
+     /* starts an event; all telemetry functions do nothing if tw is
+        NULL, so that callers need not check whether it is enabled */
+{
+  if(!tw)
+    return;
+  tw->line_len = 0;
+  tw->n_fields = 0;
+  append(tw, "{");
+  field(tw, "event");
+  append(tw, "\"%s\"", event);
+  field(tw, "time");
+  number(tw, prof_now()-tw->t_start);
+}
+
+void telemetry_int(TELEMETRY_WRITER *tw, const char *key, long value)
+{
+  if(!tw)
+    return;
+  field(tw, key);
+  append(tw, "%ld", value);
+}
+
+void telemetry_double(TELEMETRY_WRITER *tw, const char *key, double value)
+{
+  if(!tw)
+    return;
+  field(tw, key);
+  number(tw, value);
+}
+
+void telemetry_phases(TELEMETRY_WRITER *tw, PROF_LEVEL level)
+     /* the seconds spent in each phase, not counting the phases within
+        it, and the counters since the last event of this level */
+{
+  double phase_seconds[PROF_N_PHASES], elapsed;
+  long count_delta[PROF_N_COUNTERS];
+  int k, n;
+
+  if(!tw)
+    return;
+  prof_interval(&tw->marks[level], phase_seconds, count_delta, &elapsed);
+  field(tw, "elapsed");
+  number(tw, elapsed);
+  field(tw, "phases");
+  append(tw, "{");
+  for(k = 0, n = 0; k < PROF_N_PHASES; k++) {
+    if(phase_seconds[k] > 0) {
+      append(tw, "%s\"%s\":%.6f", n++ ? "," : "", prof_phase_key(k), phase_seconds[k]);
+    }
+  }
+  append(tw, "}");
+  field(tw, "counters");
+  append(tw, "{");
+  for(k = 0; k < PROF_N_COUNTERS; k++)
+    append(tw, "%s\"%s\":%ld", k ? "," : "", prof_counter_key(k), count_delta[k]);
+  append(tw, "}");
+}
+
+void telemetry_end(TELEMETRY_WRITER *tw)
+     /* adds the memory use and queues the event */
+{
+  struct rusage ru;
+  long rss;
+
+  if(!tw)
+    return;
+  rss = resident_kb();
+  if(rss >= 0)
+    telemetry_int(tw, "rss_kb", rss);
+  if(getrusage(RUSAGE_SELF, &ru) == 0)
+    telemetry_int(tw, "max_rss_kb", ru.ru_maxrss);
+  append(tw, "}\n");
+  tw->n_events++;
+
+  if(!tw->async) {
+    write_all(tw, tw->line, tw->line_len);
+    return;
+  }
+  pthread_mutex_lock(&tw->lock);
+  while(tw->used[tw->fill]+tw->line_len > TELEMETRY_BUFFER)
+    pthread_cond_wait(&tw->cond, &tw->lock);
+  memcpy(tw->buffer[tw->fill]+tw->used[tw->fill], tw->line, tw->line_len);
+  tw->used[tw->fill] += tw->line_len;
+  pthread_cond_broadcast(&tw->cond);
+  pthread_mutex_unlock(&tw->lock);
+}
+
+void stop_telemetry_writer(TELEMETRY_WRITER *tw)
+     /* writes all queued events and releases the writer */
+{
+  if(!tw)
+    return;
+  if(tw->async) {
+    pthread_mutex_lock(&tw->lock);
+    tw->shutdown = 1;
+    pthread_cond_broadcast(&tw->cond);
+    pthread_mutex_unlock(&tw->lock);
+    pthread_join(tw->thread, NULL);
+  }
+  if(tw->n_lost) {
+    printf("Warning: %ld bytes of telemetry could not be written\n", tw->n_lost);
+  }
+  if(tw->close_fd)
+    close(tw->fd);
+  pthread_mutex_destroy(&tw->lock);
+  pthread_cond_destroy(&tw->cond);
+  free(tw->buffer[0]);
+  free(tw->buffer[1]);
+  free(tw);
+}
@@ -0,0 +1,58 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_telemetry.h                                      */
+/*                                                                      */
+/*   Machine-readable training progress for Latent SVM^struct: one      */
+/*   JSON object per line and iteration, written by a background        */
+/*   thread to a file or an open file descriptor.                       */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_TELEMETRY
+#define SVM_STRUCT_LATENT_TELEMETRY
+
+#include <pthread.h>
+#include "svm_struct_latent_profile.h"
+
+#define TELEMETRY_BUFFER 65536  /* bytes per buffer */
+#define TELEMETRY_LINE   4096   /* longest event */
+
+typedef struct telemetry_writer {
+  int    fd;
+  int    close_fd;         /* the file was opened here */
+  int    async;            /* write on the background thread */
+
+  char   *buffer[2];       /* events are appended to buffer[fill] while
+                              the other one is written */
+  long   used[2];
+  int    fill;
+  int    shutdown;
+  long   n_events;
+  long   n_lost;           /* bytes lost to write errors */
+
+  char   line[TELEMETRY_LINE];  /* the event being built */
+  long   line_len;
+  int    n_fields;
+  PROF_MARK marks[PROF_N_LEVELS];  /* phase times since the last event
+                                      of each level */
+  double t_start;
+
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+} TELEMETRY_WRITER;
+
+TELEMETRY_WRITER *start_telemetry_writer(char *target);
+void telemetry_begin(TELEMETRY_WRITER *tw, const char *event);
+void telemetry_int(TELEMETRY_WRITER *tw, const char *key, long value);
+void telemetry_double(TELEMETRY_WRITER *tw, const char *key, double value);
+void telemetry_phases(TELEMETRY_WRITER *tw, PROF_LEVEL level);
+void telemetry_end(TELEMETRY_WRITER *tw);
+void stop_telemetry_writer(TELEMETRY_WRITER *tw);
+
+#endif
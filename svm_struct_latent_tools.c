@@ -0,0 +1,71 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_tools.c                                          */
+/*                                                                      */
+/*   Helpers shared by the stand-alone benchmark, check and data        */
+/*   generation tools of Latent SVM^struct.                             */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "svm_struct_latent_tools.h"
+
+static uint64_t rng_state = 1;
+
+void seed_random(uint64_t seed)
+{
+  rng_state = seed;
+}
+
+uint64_t next_random(void)
+{
+  uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return(z ^ (z >> 31));
+}
+
+double uniform(void)
+{
+  return((next_random() >> 11)*(1.0/9007199254740992.0));
+}
+
+long uniform_int(long n)
+{
+  return((long) (uniform()*n));
+}
+
+WORD *random_words(long n, long range)
+     /* random gaps averaging range/n spread the features over the range
+        without a pass over all of it */
+{
+  WORD *words = (WORD *) my_malloc(sizeof(WORD)*(n+1));
+  long k, wnum = 0, max_gap = (n > 0) ? 2*(range/n)-1 : 1;
+
+  if(max_gap < 1)
+    max_gap = 1;
+  for(k = 0; k < n; k++) {
+    wnum += 1+(long) (next_random()%max_gap);
+    if(wnum > range-(n-k-1))
+      wnum = range-(n-k-1);
+    words[k].wnum = wnum;
+    words[k].weight = (float) (2*uniform()-1);
+  }
+  words[k].wnum = 0;
+  words[k].weight = 0;
+  return(words);
+}
+
+SVECTOR *random_svector(long n, long range)
+{
+  WORD *words = random_words(n, range);
+  SVECTOR *vec = create_svector(words, "", 1.0);
+  free(words);
+  return(vec);
+}
@@ -0,0 +1,36 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_tools.h                                          */
+/*                                                                      */
+/*   Helpers shared by the stand-alone benchmark, check and data        */
+/*   generation tools of Latent SVM^struct: a seeded random number      */
+/*   generator and random sparse vector fixtures. The tools time with   */
+/*   prof_now() of the profiler.                                        */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef SVM_STRUCT_LATENT_TOOLS
+#define SVM_STRUCT_LATENT_TOOLS
+
+#include <stdint.h>
+#include "./svm_light/svm_common.h"
+#include "svm_struct_latent_profile.h"
+
+/* splitmix64, so that data and fixtures do not depend on the C
+   library; the sequence starts over with every seed_random() */
+void     seed_random(uint64_t seed);
+uint64_t next_random(void);
+double   uniform(void);          /* in [0,1) */
+long     uniform_int(long n);    /* in 0..n-1 */
+
+/* n distinct features out of 1..range in ascending order, with weights
+   in [-1,1); random_words() adds the terminating entry */
+WORD    *random_words(long n, long range);
+SVECTOR *random_svector(long n, long range);
+
+#endif
@@ -0,0 +1,403 @@
+/************************************************************************/
+/*                                                                      */
+/*   svm_struct_latent_train_bench.c                                    */
+/*                                                                      */
+/*   End-to-end scaling benchmark for Latent SVM^struct. For every      */
+/*   training set size it generates a synthetic data set with          */
+/*   svm_struct_latent_synth (unless it exists already), trains on it  */
+/*   and classifies its test set, and appends one JSON line with the    */
+/*   wall and CPU time and peak RSS of every step and the training     */
+/*   time per phase, taken from the trainer's --J telemetry.            */
+/*                                                                      */
+/*   This software is available for non-commercial use only. It must    */
+/*   not be modified and distributed without prior permission of the    */
+/*   author. The author is not responsible for implications from the    */
+/*   use of this software.                                              */
+/*                                                                      */
+/************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "svm_struct_latent_profile.h"
+
+#define MAX_SIZES   32
+#define MAX_ARGS    64
+#define MAX_PHASES  32
+
+typedef struct bench_parm {
+  long   sizes[MAX_SIZES];     /* training images per run */
+  int    n_sizes;
+  double pos_fraction;
+  double test_fraction;        /* test images per training image */
+  long   feature_size;
+  char   synth[1024];          /* programs */
+  char   train[1024];
+  char   classify[1024];
+  char   synth_args[1024];     /* extra options passed to them */
+  char   train_args[1024];
+  char   classify_args[1024];
+  int    regenerate;
+  char   results[1024];
+} BENCH_PARM;
+
+typedef struct run_stats {
+  int    status;               /* exit status, -1 if killed or not run */
+  double wall;                 /* seconds */
+  double user;
+  double sys;
+  long   max_rss_kb;
+} RUN_STATS;
+
+typedef struct phase_times {
+  int    n;
+  char   keys[MAX_PHASES][32];
+  double seconds[MAX_PHASES];
+  long   outer_iterations;
+  double primal_objective;
+} PHASE_TIMES;
+
+void read_input_parameters(int argc, char **argv, char *workdir, BENCH_PARM *bp);
+
+static int split_args(char *line, char **argv, int argc)
+     /* appends the space separated words of line to argv[0..argc);
+        line is modified */
+{
+  char *s;
+
+  for(s = strtok(line, " "); s && (argc < MAX_ARGS-1); s = strtok(NULL, " "))
+    argv[argc++] = s;
+  argv[argc] = NULL;
+  return(argc);
+}
+
+static RUN_STATS run(char **argv, char *logfile)
+     /* runs argv with its output in logfile and waits for it; the
+        resource usage is that of the child alone */
+{
+  RUN_STATS rs;
+  struct rusage ru;
+  double t0 = prof_now();
+  pid_t pid;
+  int status, fd;
+
+  rs.status = -1;
+  rs.wall = rs.user = rs.sys = 0;
+  rs.max_rss_kb = 0;
+  fflush(stdout);
+  pid = fork();
+  if(pid < 0) {
+    printf("Error: cannot fork: %s\n", strerror(errno));
+    return(rs);
+  }
+  if(pid == 0) {
+    fd = open(logfile, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd >= 0) {
+      dup2(fd, 1);
+      dup2(fd, 2);
+      close(fd);
+    }
+    execv(argv[0], argv);
+    fprintf(stderr, "Cannot run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  while(wait4(pid, &status, 0, &ru) < 0) {
+    if(errno != EINTR) {
+      printf("Error: wait4 failed: %s\n", strerror(errno));
+      return(rs);
+    }
+  }
+  rs.wall = prof_now()-t0;
+  rs.user = ru.ru_utime.tv_sec+1e-6*ru.ru_utime.tv_usec;
+  rs.sys = ru.ru_stime.tv_sec+1e-6*ru.ru_stime.tv_usec;
+  rs.max_rss_kb = ru.ru_maxrss;
+  rs.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  return(rs);
+}
+
+static void add_phase(PHASE_TIMES *pt, char *key, double seconds)
+{
+  int k;
+
+  for(k = 0; k < pt->n; k++) {
+    if(strcmp(pt->keys[k], key) == 0)
+      break;
+  }
+  if(k == pt->n) {
+    if(pt->n == MAX_PHASES)
+      return;
+    strcpy(pt->keys[k], key);  /* at most 31 characters, see read_telemetry() */
+    pt->seconds[k] = 0;
+    pt->n++;
+  }
+  pt->seconds[k] += seconds;
+}
+
+static char *find_value(char *line, const char *key)
+     /* the text after "key": in line, or NULL */
+{
+  char pattern[64];
+  char *s;
+
+  sprintf(pattern, "\"%s\":", key);
+  s = strstr(line, pattern);
+  return(s ? s+strlen(pattern) : NULL);
+}
+
+static PHASE_TIMES read_telemetry(char *file)
+     /* adds up the phases of all outer iteration events; the first one
+        also covers the initialization */
+{
+  PHASE_TIMES pt;
+  FILE *fp = fopen(file, "r");
+  char *line = NULL, *s, *end, key[32];
+  size_t len = 0;
+  int n;
+
+  pt.n = 0;
+  pt.outer_iterations = 0;
+  pt.primal_objective = 0;
+  if(fp == NULL)
+    return(pt);
+  while(getline(&line, &len, fp) != -1) {
+    if(strstr(line, "\"event\":\"end\"")) {
+      if((s = find_value(line, "outer_iterations")))
+        pt.outer_iterations = atol(s);
+      if((s = find_value(line, "primal_objective")))
+        pt.primal_objective = atof(s);
+    }
+    if(!strstr(line, "\"event\":\"outer\"") || !(s = find_value(line, "phases")))
+      continue;
+    end = strchr(s, '}');
+    for(s++; end && (s < end); ) {
+      if(sscanf(s, "\"%31[^\"]\":%n", key, &n) != 1)
+        break;
+      s += n;
+      add_phase(&pt, key, strtod(s, &s));
+      if(*s == ',')
+        s++;
+    }
+  }
+  free(line);
+  fclose(fp);
+  return(pt);
+}
+
+static void print_stats(FILE *fp, const char *name, RUN_STATS *rs)
+{
+  fprintf(fp, ",\"%s\":{\"status\":%d,\"wall\":%.3f,\"user\":%.3f,\"sys\":%.3f,\"max_rss_kb\":%ld",
+          name, rs->status, rs->wall, rs->user, rs->sys, rs->max_rss_kb);
+}
+
+static int file_exists(char *file)
+{
+  struct stat st;
+  return(stat(file, &st) == 0);
+}
+
+
+int main(int argc, char* argv[]) {
+  char workdir[1024];
+  char prefix[1100], testfile[1200], model[1200], obj[1200], scores[1200];
+  char telemetry[1200], logfile[1200], fsize[32], npos[32], nneg[32], ntpos[32], ntneg[32];
+  char args[3][1024];
+  char *cmd[MAX_ARGS];
+  BENCH_PARM bp;
+  RUN_STATS gen, train, cls;
+  PHASE_TIMES pt;
+  FILE *out;
+  long n, n_pos, n_test;
+  int s, k, c;
+
+  read_input_parameters(argc,argv,workdir,&bp);
+  if((mkdir(workdir, 0755) != 0) && (errno != EEXIST)) {
+    printf("Error: Cannot create directory %s\n", workdir);
+    exit(1);
+  }
+  if((out = fopen(bp.results, "a")) == NULL) {
+    printf("Error: Cannot open %s for output\n", bp.results);
+    exit(1);
+  }
+  sprintf(fsize, "%ld", bp.feature_size);
+
+  for(s = 0; s < bp.n_sizes; s++) {
+    n = bp.sizes[s];
+    n_pos = (long) (n*bp.pos_fraction+0.5);
+    if(n_pos < 1) n_pos = 1;
+    if(n_pos >= n) n_pos = n-1;
+    n_test = (long) (n*bp.test_fraction+0.5);
+    sprintf(prefix, "%s/synth%ld", workdir, n);
+    sprintf(testfile, "%s.test", prefix);
+    sprintf(model, "%s.model", prefix);
+    sprintf(obj, "%s.obj", prefix);
+    sprintf(scores, "%s.scores", prefix);
+    sprintf(telemetry, "%s.jsonl", prefix);
+    for(k = 0; k < 3; k++)
+      args[k][0] = '\0';
+    strcpy(args[0], bp.synth_args);
+    strcpy(args[1], bp.train_args);
+    strcpy(args[2], bp.classify_args);
+
+    /* data set */
+    gen.status = 0;
+    gen.wall = gen.user = gen.sys = 0;
+    gen.max_rss_kb = 0;
+    if(bp.regenerate || !file_exists(prefix) || (n_test && !file_exists(testfile))) {
+      printf("%ld images: generating...", n); fflush(stdout);
+      sprintf(npos, "%ld", n_pos);
+      sprintf(nneg, "%ld", n-n_pos);
+      sprintf(ntpos, "%ld", (long) (n_test*bp.pos_fraction+0.5));
+      sprintf(ntneg, "%ld", n_test-(long) (n_test*bp.pos_fraction+0.5));
+      c = 0;
+      cmd[c++] = bp.synth;
+      cmd[c++] = "-p"; cmd[c++] = npos;
+      cmd[c++] = "-n"; cmd[c++] = nneg;
+      cmd[c++] = "-P"; cmd[c++] = ntpos;
+      cmd[c++] = "-N"; cmd[c++] = ntneg;
+      cmd[c++] = "-f"; cmd[c++] = fsize;
+      c = split_args(args[0], cmd, c);
+      cmd[c++] = prefix;
+      cmd[c] = NULL;
+      sprintf(logfile, "%s.synth.log", prefix);
+      gen = run(cmd, logfile);
+      printf(" %.1fs\n", gen.wall);
+      if(gen.status) {
+        printf("Error: generator failed, see %s\n", logfile);
+        exit(1);
+      }
+    }
+
+    /* training */
+    printf("%ld images: training...", n); fflush(stdout);
+    c = 0;
+    cmd[c++] = bp.train;
+    cmd[c++] = "--f"; cmd[c++] = fsize;
+    cmd[c++] = "--J"; cmd[c++] = telemetry;
+    c = split_args(args[1], cmd, c);
+    cmd[c++] = prefix;
+    cmd[c++] = model;
+    cmd[c++] = obj;
+    cmd[c] = NULL;
+    sprintf(logfile, "%s.train.log", prefix);
+    train = run(cmd, logfile);
+    printf(" %.1fs, %ld kB\n", train.wall, train.max_rss_kb);
+    pt = read_telemetry(telemetry);
+
+    /* classification */
+    cls.status = -1;
+    cls.wall = cls.user = cls.sys = 0;
+    cls.max_rss_kb = 0;
+    if(n_test && (train.status == 0)) {
+      printf("%ld images: classifying...", n); fflush(stdout);
+      c = 0;
+      cmd[c++] = bp.classify;
+      cmd[c++] = "--f"; cmd[c++] = fsize;
+      c = split_args(args[2], cmd, c);
+      cmd[c++] = testfile;
+      cmd[c++] = model;
+      cmd[c++] = scores;
+      cmd[c] = NULL;
+      sprintf(logfile, "%s.classify.log", prefix);
+      cls = run(cmd, logfile);
+      printf(" %.1fs, %ld kB\n", cls.wall, cls.max_rss_kb);
+    }
+
+    fprintf(out, "{\"images\":%ld,\"n_pos\":%ld,\"n_neg\":%ld,\"test_images\":%ld,\"feature_size\":%ld",
+            n, n_pos, n-n_pos, n_test, bp.feature_size);
+    print_stats(out, "generate", &gen);
+    fprintf(out, "}");
+    print_stats(out, "train", &train);
+    fprintf(out, ",\"outer_iterations\":%ld,\"primal_objective\":%.10g,\"phases\":{",
+            pt.outer_iterations, pt.primal_objective);
+    for(k = 0; k < pt.n; k++)
+      fprintf(out, "%s\"%s\":%.6f", k ? "," : "", pt.keys[k], pt.seconds[k]);
+    fprintf(out, "}}");
+    print_stats(out, "classify", &cls);
+    fprintf(out, "}}\n");
+    fflush(out);
+  }
+  fclose(out);
+
+  return(0);
+}
+
+
+void read_input_parameters(int argc, char **argv, char *workdir, BENCH_PARM *bp) {
+
+  long i;
+  char list[1024], *s;
+
+  /* set default */
+  strcpy(list, "1000,10000,100000,1000000");
+  bp->pos_fraction = 0.1;
+  bp->test_fraction = 0.1;
+  bp->feature_size = 90112;
+  strcpy(bp->synth, "./svm_struct_latent_synth");
+  strcpy(bp->train, "./svm_struct_latent_spl");
+  strcpy(bp->classify, "./svm_struct_latent_classify");
+  bp->synth_args[0] = '\0';
+  strcpy(bp->train_args, "-c 10 -e 0.01");
+  bp->classify_args[0] = '\0';
+  bp->regenerate = 0;
+  bp->results[0] = '\0';
+
+  for (i=1;(i<argc)&&((argv[i])[0]=='-');i++) {
+    switch ((argv[i])[1]) {
+      case 's': i++; strcpy(list, argv[i]); break;
+      case 'q': i++; bp->pos_fraction = atof(argv[i]); break;
+      case 't': i++; bp->test_fraction = atof(argv[i]); break;
+      case 'f': i++; bp->feature_size = atol(argv[i]); break;
+      case 'g': i++; strcpy(bp->synth, argv[i]); break;
+      case 'l': i++; strcpy(bp->train, argv[i]); break;
+      case 'x': i++; strcpy(bp->classify, argv[i]); break;
+      case 'G': i++; strcpy(bp->synth_args, argv[i]); break;
+      case 'L': i++; strcpy(bp->train_args, argv[i]); break;
+      case 'X': i++; strcpy(bp->classify_args, argv[i]); break;
+      case 'r': bp->regenerate = 1; break;
+      case 'o': i++; strcpy(bp->results, argv[i]); break;
+      default: printf("\nUnrecognized option %s!\n\n",argv[i]); exit(0);
+    }
+  }
+
+  bp->n_sizes = 0;
+  for(s = strtok(list, ","); s && (bp->n_sizes < MAX_SIZES); s = strtok(NULL, ",")) {
+    bp->sizes[bp->n_sizes] = atol(s);
+    if(bp->sizes[bp->n_sizes] < 2)
+      break;
+    bp->n_sizes++;
+  }
+  if(s)
+    bp->n_sizes = 0;
+
+  if ((i>=argc) || (bp->n_sizes == 0) || (bp->pos_fraction <= 0) || (bp->pos_fraction >= 1)
+      || (bp->test_fraction < 0) || (bp->feature_size < 4)) {
+    printf("\nNot enough input parameters!\n\n");
+    printf("usage: svm_struct_latent_train_bench [options] workdir\n");
+    printf("       -s list  training images per run, comma separated, at least 2\n");
+    printf("                (default 1000,10000,100000,1000000)\n");
+    printf("       -q x     fraction of positive images (default 0.1)\n");
+    printf("       -t x     test images per training image (default 0.1)\n");
+    printf("       -f n     number of features (default 90112)\n");
+    printf("       -g prog  generator (default ./svm_struct_latent_synth)\n");
+    printf("       -l prog  trainer (default ./svm_struct_latent_spl)\n");
+    printf("       -x prog  classifier (default ./svm_struct_latent_classify)\n");
+    printf("       -G args  more generator options, e.g. \"-c 20 -z 300\"\n");
+    printf("       -L args  more trainer options (default \"-c 10 -e 0.01\")\n");
+    printf("       -X args  more classifier options\n");
+    printf("       -r       regenerate data sets that exist already\n");
+    printf("       -o file  append the results here (default workdir/results.jsonl)\n\n");
+    printf("Data sets, models, logs and telemetry are kept in workdir/synth<n>*.\n\n");
+    exit(0);
+  }
+
+  strcpy(workdir, argv[i]);
+  if(!bp->results[0])
+    sprintf(bp->results, "%s/results.jsonl", workdir);
+
+}